@@ -20,9 +20,12 @@
 #include "../query/music_source.hpp"
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
+#include "../util/history.hpp"
 #include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include "ui_music_control.h"
+#include <QDir>
+#include <QFileDialog>
 #include <QMenu>
 #include <QScreen>
 #include <QSizePolicy>
@@ -60,13 +63,11 @@ music_control::music_control(QWidget* parent)
     }
     connect(ui->cb_source, qOverload<int>(&QComboBox::currentIndexChanged), this, &music_control::source_changed);
     this->setContextMenuPolicy(Qt::CustomContextMenu);
-    m_timer = new QTimer(this);
-    connect(m_timer, SIGNAL(timeout()), SLOT(refresh_play_state()));
-
     connect(this, SIGNAL(customContextMenuRequested(QPoint)), this, SLOT(showcontextmenu(QPoint)));
 
-    /* This is dependent on tuna thread speed so lowering this wouldn't make a difference */
-    m_timer->start(700);
+    /* Emitted from the query thread, so the snapshot is queued to the UI thread */
+    qRegisterMetaType<song>("song");
+    connect(this, &music_control::state_changed, this, &music_control::apply_state, Qt::QueuedConnection);
 
     m_song_text = new scroll_text(this);
     m_song_text->setMinimumWidth(200);
@@ -76,6 +77,7 @@ music_control::music_control(QWidget* parent)
     ui->volume_widget->setVisible(CGET_BOOL(CFG_DOCK_VOLUME_VISIBLE));
     m_song_text->setVisible(CGET_BOOL(CFG_DOCK_INFO_VISIBLE));
     ui->cb_source->setVisible(CGET_BOOL(CFG_DOCK_SOURCE_VISIBLE));
+    notify();
 }
 
 void music_control::save_settings()
@@ -112,68 +114,75 @@ void music_control::select_source(int index)
 
 void music_control::on_btn_prev_clicked()
 {
-    music_sources::selected_source()->execute_capability(CAP_PREV_SONG);
+    music_sources::execute_capability(CAP_PREV_SONG);
 }
 
 void music_control::on_btn_play_pause_clicked()
 {
-    music_sources::selected_source()->execute_capability(CAP_PLAY_PAUSE);
+    music_sources::execute_capability(CAP_PLAY_PAUSE);
 }
 
 void music_control::on_btn_next_clicked()
 {
-    music_sources::selected_source()->execute_capability(CAP_NEXT_SONG);
+    music_sources::execute_capability(CAP_NEXT_SONG);
 }
 
-void music_control::refresh_play_state()
+void music_control::notify()
 {
-    static QString last_title = "";
     song copy;
+    {
+        std::lock_guard<std::mutex> lock(tuna_thread::copy_mutex);
+        copy = tuna_thread::copy;
+    }
 
-    tuna_thread::copy_mutex.lock();
-    copy = tuna_thread::copy;
-    tuna_thread::copy_mutex.unlock();
-    QString icon = copy.get<int>(meta::STATUS) == state_playing ? "://images/icons/pause.svg" : "://images/icons/play.svg";
-    ui->btn_play_pause->setIcon(QIcon(icon));
+    uint32_t flags = 0;
+    if (auto src = music_sources::active_source())
+        flags = src->get_capabilities();
+    emit state_changed(copy, flags, tuna_thread::thread_flag);
+}
+
+void music_control::apply_state(song s, uint32_t capabilities, bool running)
+{
+    const int status = s.get<int>(meta::STATUS);
+    if (status != m_status) {
+        QString icon = status == state_playing ? "://images/icons/pause.svg" : "://images/icons/play.svg";
+        ui->btn_play_pause->setIcon(QIcon(icon));
+        m_status = status;
+    }
 
     /* refresh song info */
-    if (copy.get(meta::TITLE) != last_title) {
-        QString info = utf8_to_qt(T_DOCK_SONG_INFO);
-        if (copy.get<int>(meta::STATUS) <= state_paused) {
-            last_title = copy.get(meta::TITLE);
-            QString artists, title = copy.get(meta::TITLE);
-            artists = copy.get<QStringList>(meta::ARTIST).join(", ");
-            // Icecast and window title don't provide these
-            if (!artists.isEmpty()) {
-                info.append(artists);
-                info.append(" - ");
-            }
-            info.append(title);
-            last_title = title;
-        } else {
-            info.append(config::placeholder);
-            last_title = "n/a";
+    QString info = utf8_to_qt(T_DOCK_SONG_INFO);
+    if (status <= state_paused) {
+        auto artists = s.get<QStringList>(meta::ARTIST).join(", ");
+        // Icecast and window title don't provide these
+        if (!artists.isEmpty()) {
+            info.append(artists);
+            info.append(" - ");
         }
-        info.replace("%s", " ");
+        info.append(s.get(meta::TITLE));
+    } else {
+        info.append(config::get()->placeholder);
+    }
+    info.replace("%s", " ");
+    if (info != m_info) {
         m_song_text->set_text(info);
+        m_info = info;
     }
 
-    refresh_source();
-    last_thread_state = tuna_thread::thread_flag;
-    setEnabled(tuna_thread::thread_flag);
-    save_settings();
-}
+    if (capabilities != m_capabilities) {
+        refresh_source(capabilities);
+        m_capabilities = capabilities;
+    }
 
-void music_control::refresh_source()
-{
-    uint32_t flags = 0;
-    {
-        auto src = music_sources::selected_source();
-        if (src)
-            flags = src->get_capabilities();
+    if (running != m_running) {
+        setEnabled(running);
+        m_running = running;
     }
+}
 
-    bool next = flags & CAP_NEXT_SONG, prev = flags & CAP_NEXT_SONG, play = flags & CAP_PLAY_PAUSE,
+void music_control::refresh_source(uint32_t flags)
+{
+    bool next = flags & CAP_NEXT_SONG, prev = flags & CAP_PREV_SONG, play = flags & CAP_PLAY_PAUSE,
          stop = flags & CAP_STOP_SONG;
 
     ui->btn_next->setVisible(next);
@@ -199,7 +208,7 @@ void music_control::refresh_source()
 
 void music_control::on_btn_stop_clicked()
 {
-    music_sources::selected_source()->execute_capability(CAP_STOP_SONG);
+    music_sources::execute_capability(CAP_STOP_SONG);
 }
 
 void music_control::showcontextmenu(const QPoint& pos)
@@ -209,14 +218,18 @@ void music_control::showcontextmenu(const QPoint& pos)
     QAction title(T_DOCK_TOGGLE_INFO, this);
     QAction volume(T_DOCK_TOGGLE_VOLUME, this);
     QAction source(T_DOCK_TOGGLE_SOURCE, this);
+    QAction setlist(T_DOCK_EXPORT_SETLIST, this);
 
     connect(&title, SIGNAL(triggered()), this, SLOT(toggle_title()));
     connect(&volume, SIGNAL(triggered()), this, SLOT(toggle_volume()));
     connect(&source, SIGNAL(triggered()), this, SLOT(toggle_source()));
+    connect(&setlist, SIGNAL(triggered()), this, SLOT(export_setlist()));
 
     contextMenu.addAction(&title);
     contextMenu.addAction(&volume);
     contextMenu.addAction(&source);
+    contextMenu.addSeparator();
+    contextMenu.addAction(&setlist);
 
     contextMenu.exec(mapToGlobal(pos));
 }
@@ -229,7 +242,7 @@ void music_control::toggle_title()
 
 void music_control::toggle_volume()
 {
-    auto flags = music_sources::selected_source()->get_capabilities();
+    auto flags = music_sources::active_source()->get_capabilities();
     if (flags & CAP_VOLUME_UP || flags & CAP_VOLUME_DOWN)
         ui->volume_widget->setVisible(!ui->volume_widget->isVisible());
     save_settings();
@@ -238,6 +251,19 @@ void music_control::toggle_volume()
 void music_control::toggle_source()
 {
     ui->cb_source->setVisible(!ui->cb_source->isVisible());
+    save_settings();
+}
+
+void music_control::export_setlist()
+{
+    auto path = QFileDialog::getSaveFileName(this, T_DOCK_SETLIST_FILE, QDir::home().path(), FILTER("Text file", "*.txt"));
+    if (path.isEmpty())
+        return;
+
+    QFile f(path);
+    const auto text = history::setlist().toUtf8();
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text) || f.write(text) != text.size())
+        berr("Couldn't write setlist to %s", qt_to_utf8(path));
 }
 
 void music_control::source_changed(int index)
@@ -253,10 +279,10 @@ void music_control::source_changed(int index)
 
 void music_control::on_btn_voldown_clicked()
 {
-    music_sources::selected_source()->execute_capability(CAP_VOLUME_DOWN);
+    music_sources::execute_capability(CAP_VOLUME_DOWN);
 }
 
 void music_control::on_btn_volup_clicked()
 {
-    music_sources::selected_source()->execute_capability(CAP_VOLUME_UP);
+    music_sources::execute_capability(CAP_VOLUME_UP);
 }
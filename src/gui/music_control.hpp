@@ -18,9 +18,9 @@
 
 #pragma once
 
+#include "../query/song.hpp"
 #include "scrolltext.hpp"
 #include <QDockWidget>
-#include <QTimer>
 #include <memory>
 
 class music_source;
@@ -40,12 +40,20 @@ public:
 
     void select_source(int index);
 
+    /* Can be called from any thread whenever the song, the shown source or the
+     * query thread state changed, the dock is updated on the UI thread */
+    void notify();
+
+signals:
+    void state_changed(song s, uint32_t capabilities, bool running);
+
 private slots:
-    void refresh_play_state();
+    void apply_state(song s, uint32_t capabilities, bool running);
     void showcontextmenu(const QPoint& pos);
     void toggle_title();
     void toggle_volume();
     void toggle_source();
+    void export_setlist();
     void source_changed(int index);
 
     void on_btn_prev_clicked();
@@ -57,11 +65,15 @@ private slots:
 
 private:
     void save_settings();
-    void refresh_source();
-    bool last_thread_state = false;
+    void refresh_source(uint32_t flags);
     Ui::music_control* ui;
-    QTimer* m_timer = nullptr;
     scroll_text* m_song_text = nullptr;
+
+    /* What is currently shown, so that only changed widgets are touched */
+    QString m_info;
+    int m_status = -1;
+    uint32_t m_capabilities = UINT32_MAX;
+    bool m_running = true;
 };
 
 extern music_control* music_dock;
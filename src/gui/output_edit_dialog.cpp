@@ -17,9 +17,9 @@
  *************************************************************************/
 
 #include "output_edit_dialog.hpp"
-#include "../query/music_source.hpp"
 #include "../util/constants.hpp"
 #include "../util/format.hpp"
+#include "../util/tuna_thread.hpp"
 #include "tuna_gui.hpp"
 #include "ui_output_edit_dialog.h"
 #include <QDir>
@@ -119,11 +119,13 @@ void output_edit_dialog::accept_clicked()
 
 void output_edit_dialog::format_changed(const QString& format)
 {
-    auto src = music_sources::selected_source();
-    if (src) {
-        auto copy = format;
-        ui->lbl_format_error->setVisible(!format::execute(copy));
-    }
+    song current;
+    tuna_thread::copy_mutex.lock();
+    current = tuna_thread::copy;
+    tuna_thread::copy_mutex.unlock();
+
+    auto copy = format;
+    ui->lbl_format_error->setVisible(!format::execute(copy, current));
 
     static QRegularExpression e("%[a-zA-Z](\\[[0-9]+\\])?");
     Q_ASSERT(e.isValid());
@@ -17,7 +17,15 @@
  *************************************************************************/
 
 #include "scrolltext.hpp"
+#include <QGuiApplication>
+#include <QLinearGradient>
 #include <QPainter>
+#include <QScreen>
+
+/* Scrolling speed in pixels per second and the pause before scrolling starts */
+#define SCROLL_SPEED 20
+#define SCROLL_DELAY 3200
+#define FADE_WIDTH 15
 
 scroll_text::scroll_text(QWidget* parent)
     : QWidget(parent)
@@ -31,7 +39,7 @@ scroll_text::scroll_text(QWidget* parent)
     set_separator(" // ");
 
     connect(&m_timer, SIGNAL(timeout()), this, SLOT(timer_timeout()));
-    m_timer.setInterval(50);
+    m_timer.setTimerType(Qt::PreciseTimer);
 }
 
 QString scroll_text::text() const
@@ -60,7 +68,6 @@ void scroll_text::set_separator(QString separator)
 
 void scroll_text::update_text()
 {
-    m_timer.stop();
 #if QT_VERSION_MINOR <= 10 && QT_VERSION_MAJOR < 6
 #    define horizontalAdvance width
 #endif
@@ -68,46 +75,109 @@ void scroll_text::update_text()
 
     m_scroll_enabled = (m_single_text_width > width() - m_left_margin);
 
-    if (m_scroll_enabled) {
-        m_scroll_pos = -64;
+    if (m_scroll_enabled)
         m_static_text.setText(m_text + m_separator);
-        m_timer.start();
-    } else
+    else
         m_static_text.setText(m_text);
 
     m_static_text.prepare(QTransform(), font());
     m_whole_text_size = QSize(fontMetrics().horizontalAdvance(m_static_text.text()), fontMetrics().height());
 #undef horizontalAdvance
+
+    m_clock.start();
+    m_scroll_pos = 0;
+    update_strip();
+    update_timer();
+}
+
+/* The text is only rendered here, frames just blit the strip at an offset */
+void scroll_text::update_strip()
+{
+    if (!m_scroll_enabled || m_whole_text_size.width() <= 0) {
+        m_strip = QPixmap();
+        return;
+    }
+
+    const qreal dpr = devicePixelRatioF();
+    const int strip_width = m_whole_text_size.width() * (width() / m_whole_text_size.width() + 2);
+    m_strip = QPixmap(QSize(strip_width, height()) * dpr);
+    m_strip.setDevicePixelRatio(dpr);
+    m_strip.fill(Qt::transparent);
+
+    QPainter p(&m_strip);
+    p.setPen(palette().color(foregroundRole()));
+    p.setFont(font());
+    for (int x = 0; x < strip_width; x += m_whole_text_size.width())
+        p.drawStaticText(QPointF(x, (height() - m_whole_text_size.height()) / 2), m_static_text);
+}
+
+/* Only animate while someone can actually see the text */
+void scroll_text::update_timer()
+{
+    const bool run = m_scroll_enabled && isVisible() && m_window && m_window->isExposed();
+    if (!run) {
+        m_timer.stop();
+        return;
+    }
+
+    /* Pace frames to the display, but don't wake up more often than the text
+     * moves by a device pixel. The position only depends on the elapsed time */
+    qreal rate = m_window->screen() ? m_window->screen()->refreshRate() : 60;
+    if (rate < 1)
+        rate = 60;
+    const qreal per_pixel = 1000. / (SCROLL_SPEED * devicePixelRatioF());
+    m_timer.setInterval(qMax(1, int(qMax(1000 / rate, per_pixel))));
+    if (!m_timer.isActive())
+        m_timer.start();
+}
+
+/* Scrolled distance in device pixels, negative while waiting to start */
+int scroll_text::scroll_offset() const
+{
+    const qreal dpr = devicePixelRatioF();
+    const qreal logical = (m_clock.elapsed() - SCROLL_DELAY) * SCROLL_SPEED / 1000.0;
+    const int period = qRound(m_whole_text_size.width() * dpr);
+    int offset = qRound(logical * dpr);
+    if (offset > 0 && period > 0)
+        offset %= period;
+    return offset;
+}
+
+void scroll_text::draw_edge(QPainter& p, QImage const& mask, int x, qreal strip_x, qreal opacity)
+{
+    m_edge.fill(Qt::transparent);
+    QPainter pe(&m_edge);
+    pe.drawPixmap(QPointF(strip_x - x, 0), m_strip);
+    pe.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+    pe.setOpacity(opacity);
+    pe.drawImage(0, 0, mask);
+    pe.end();
+    p.drawImage(x, 0, m_edge);
 }
 
 void scroll_text::paintEvent(QPaintEvent*)
 {
     QPainter p(this);
 
-    if (m_scroll_enabled) {
-        m_buffer.fill(qRgba(0, 0, 0, 0));
-        QPainter pb(&m_buffer);
-        pb.setPen(p.pen());
-        pb.setFont(p.font());
+    if (m_scroll_enabled && !m_strip.isNull()) {
+        const qreal dpr = devicePixelRatioF();
+        const int offset = scroll_offset();
+        m_scroll_pos = offset;
+        const qreal strip_x = m_left_margin - qMax(offset, 0) / dpr;
 
-        int x = qMin(-m_scroll_pos, 0) + m_left_margin;
-        while (x < width()) {
-            pb.drawStaticText(QPointF(x, (height() - m_whole_text_size.height()) / 2), m_static_text);
-            x += m_whole_text_size.width();
+        if (width() <= 64) {
+            p.drawPixmap(QPointF(strip_x, 0), m_strip);
+            return;
         }
 
-        // Apply Alpha Channel
-        pb.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-        pb.setClipRect(width() - 15, 0, 15, height());
-        pb.drawImage(0, 0, m_alpha_channel);
-        pb.setClipRect(0, 0, 15, height());
-        // initial situation: don't apply alpha channel in the left half of the image at all; apply it more and more until scrollPos gets positive
-        if (m_scroll_pos < 0)
-            pb.setOpacity((qreal)(qMax(-8, m_scroll_pos) + 8) / 8.0);
-        pb.drawImage(0, 0, m_alpha_channel);
-
-        // pb.end();
-        p.drawImage(0, 0, m_buffer);
+        p.setClipRect(FADE_WIDTH, 0, width() - 2 * FADE_WIDTH, height());
+        p.drawPixmap(QPointF(strip_x, 0), m_strip);
+        p.setClipping(false);
+
+        /* initial situation: don't fade the left edge at all, apply it more and more until the text starts moving */
+        const qreal logical = offset / dpr;
+        draw_edge(p, m_fade_left, 0, strip_x, logical < 0 ? (qMax<qreal>(-8, logical) + 8) / 8.0 : 1);
+        draw_edge(p, m_fade_right, width() - FADE_WIDTH, strip_x, 1);
     } else {
         p.drawStaticText(QPointF((width() - m_whole_text_size.width()) / 2,
                              (height() - m_whole_text_size.height()) / 2),
@@ -115,35 +185,100 @@ void scroll_text::paintEvent(QPaintEvent*)
     }
 }
 
+void scroll_text::update_fade()
+{
+    const qreal dpr = devicePixelRatioF();
+    auto make_mask = [&](bool left) {
+        QImage mask(QSize(FADE_WIDTH, height()) * dpr, QImage::Format_ARGB32_Premultiplied);
+        mask.setDevicePixelRatio(dpr);
+        mask.fill(Qt::transparent);
+        QLinearGradient gradient(0, 0, FADE_WIDTH, 0);
+        gradient.setColorAt(left ? 0 : 1, QColor(0, 0, 0, 16));
+        gradient.setColorAt(left ? 1 : 0, QColor(0, 0, 0, 255));
+        QPainter p(&mask);
+        p.fillRect(QRect(0, 0, FADE_WIDTH, height()), gradient);
+        return mask;
+    };
+    m_fade_left = make_mask(true);
+    m_fade_right = make_mask(false);
+    m_edge = QImage(m_fade_left.size(), QImage::Format_ARGB32_Premultiplied);
+    m_edge.setDevicePixelRatio(dpr);
+}
+
 void scroll_text::resizeEvent(QResizeEvent*)
 {
-    // When the widget is resized, we need to update the alpha channel.
-
-    m_alpha_channel = QImage(size(), QImage::Format_ARGB32_Premultiplied);
-    m_buffer = QImage(size(), QImage::Format_ARGB32_Premultiplied);
-
-    // Create Alpha Channel:
-    if (width() > 64) {
-        // create first scanline
-        QRgb* scanline1 = (QRgb*)m_alpha_channel.scanLine(0);
-        for (int x = 1; x < 16; ++x)
-            scanline1[x - 1] = scanline1[width() - x] = qRgba(0, 0, 0, x << 4);
-        for (int x = 15; x < width() - 15; ++x)
-            scanline1[x] = qRgb(0, 0, 0);
-        // copy scanline to the other ones
-        for (int y = 1; y < height(); ++y)
-            memcpy(m_alpha_channel.scanLine(y), (uchar*)scanline1, width() * 4);
-    } else
-        m_alpha_channel.fill(qRgb(0, 0, 0));
+    // When the widget is resized, we need to update the fade masks.
+    update_fade();
 
     // Update scrolling state
     bool newScrollEnabled = (m_single_text_width > width() - m_left_margin);
     if (newScrollEnabled != m_scroll_enabled)
         update_text();
+    else
+        update_strip();
 }
 
-void scroll_text::timer_timeout()
+void scroll_text::showEvent(QShowEvent*)
+{
+    /* The top level window changes when the dock is floated or docked again */
+    auto* window = this->window()->windowHandle();
+    if (window != m_window) {
+        if (m_window) {
+            m_window->removeEventFilter(this);
+            disconnect(m_window, &QWindow::screenChanged, this, &scroll_text::screen_changed);
+        }
+        m_window = window;
+        if (m_window) {
+            m_window->installEventFilter(this);
+            connect(m_window, &QWindow::screenChanged, this, &scroll_text::screen_changed);
+        }
+        /* The new window can be on a screen with another pixel ratio */
+        screen_changed();
+        return;
+    }
+    update_timer();
+}
+
+/* Everything that was rendered at the pixel ratio of the old screen */
+void scroll_text::screen_changed()
 {
-    m_scroll_pos = (m_scroll_pos + 1) % m_whole_text_size.width();
+    update_fade();
+    update_strip();
+    update_timer();
     update();
 }
+
+void scroll_text::hideEvent(QHideEvent*)
+{
+    m_timer.stop();
+}
+
+void scroll_text::changeEvent(QEvent* e)
+{
+    if (e->type() == QEvent::FontChange || e->type() == QEvent::PaletteChange) {
+        update_text();
+        update();
+    }
+    QWidget::changeEvent(e);
+}
+
+bool scroll_text::eventFilter(QObject* obj, QEvent* e)
+{
+    /* Minimizing or covering the window doesn't hide the widget */
+    if (obj == m_window && e->type() == QEvent::Expose)
+        update_timer();
+    return QWidget::eventFilter(obj, e);
+}
+
+void scroll_text::timer_timeout()
+{
+    if (!m_window || !m_window->isExposed()) {
+        m_timer.stop();
+        return;
+    }
+
+    /* The timer runs at the display rate, but there's only something new
+     * to draw once the text moved by a whole pixel */
+    if (scroll_offset() != m_scroll_pos)
+        update();
+}
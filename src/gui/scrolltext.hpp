@@ -21,9 +21,16 @@
  *************************************************************************/
 
 #pragma once
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPixmap>
+#include <QPointer>
 #include <QStaticText>
 #include <QTimer>
 #include <QWidget>
+#include <QWindow>
+
+class QPainter;
 
 class scroll_text : public QWidget {
     Q_OBJECT
@@ -42,9 +49,18 @@ public:
 protected:
     virtual void paintEvent(QPaintEvent*);
     virtual void resizeEvent(QResizeEvent*);
+    virtual void showEvent(QShowEvent*);
+    virtual void hideEvent(QHideEvent*);
+    virtual void changeEvent(QEvent*);
+    virtual bool eventFilter(QObject*, QEvent*);
 
 private:
     void update_text();
+    void update_strip();
+    void update_fade();
+    void update_timer();
+    void draw_edge(QPainter& p, QImage const& mask, int x, qreal strip_x, qreal opacity);
+    int scroll_offset() const;
     QString m_text;
     QString m_separator;
     QStaticText m_static_text;
@@ -52,11 +68,16 @@ private:
     QSize m_whole_text_size;
     int m_left_margin;
     bool m_scroll_enabled;
-    int m_scroll_pos;
-    QImage m_alpha_channel;
-    QImage m_buffer;
+    int m_scroll_pos; /* Device pixels of the last painted frame */
+    QPixmap m_strip;  /* Text and separator repeated to cover the width */
+    QImage m_fade_left;
+    QImage m_fade_right;
+    QImage m_edge; /* Where the fade is applied to the strip */
+    QElapsedTimer m_clock;
     QTimer m_timer;
+    QPointer<QWindow> m_window;
 
 private slots:
     virtual void timer_timeout();
+    void screen_changed();
 };
@@ -21,15 +21,23 @@
 #include "../query/vlc_obs_source.hpp"
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
+#include "../util/metrics.hpp"
+#include "../util/trace.hpp"
 #include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include "../util/web_server.hpp"
 #include "music_control.hpp"
 #include "output_edit_dialog.hpp"
 #include "ui_tuna_gui.h"
+#include <QCheckBox>
 #include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
 #include <QMessageBox>
+#include <QPushButton>
 #include <QString>
+#include <QTableWidget>
+#include <QVBoxLayout>
 #include <curl/curl.h>
 #include <httplib.h>
 #include <mpd/client.h>
@@ -55,7 +63,6 @@ tuna_gui::tuna_gui(QWidget* parent)
     ui->setupUi(this);
     connect(ui->buttonBox->button(QDialogButtonBox::Apply), SIGNAL(clicked()), this, SLOT(apply_pressed()));
     connect(ui->buttonBox->button(QDialogButtonBox::Ok), SIGNAL(clicked()), this, SLOT(tuna_gui_accepted()));
-    connect(ui->cb_download_missing, SIGNAL(stateChanged(int)), this, SLOT(cb_download_missing_covers_clicked));
 
     /* Other signals */
 #define ADD_SIGNAL(btn) connect(ui->btn, SIGNAL(clicked()), this, SLOT(btn##_clicked()))
@@ -104,13 +111,13 @@ tuna_gui::tuna_gui(QWidget* parent)
     int i = 0;
     for (const auto& Size : { 64, 128, 256, 512, 1024 }) {
         ui->cb_cover_size->addItem(QString::number(Size) + "x" + QString::number(Size), Size);
-        if (config::cover_size == Size)
+        if (config::get()->cover_size == Size)
             ui->cb_cover_size->setCurrentIndex(i);
         i++;
     }
-    ui->cb_cover_size->addItem(T_LARGEST_COVER, 8129);
+    ui->cb_cover_size->addItem(T_LARGEST_COVER, COVER_SIZE_LARGEST);
 
-    if (config::cover_size == 8129)
+    if (config::get()->cover_size == COVER_SIZE_LARGEST)
         ui->cb_cover_size->setCurrentIndex(i);
 
     connect(ui->cb_dl_lyrics, &QCheckBox::stateChanged, this, [this](int s) {
@@ -119,13 +126,75 @@ tuna_gui::tuna_gui(QWidget* parent)
 
     connect(ui->cb_dl_cover, &QCheckBox::stateChanged, this, [this](int s) {
         ui->cb_download_missing->setEnabled(s == Qt::CheckState::Checked);
-        ui->cb_cover_size->setEnabled(s == Qt::CheckState::Checked && ui->cb_download_missing->isChecked());
+        ui->cb_cover_size->setEnabled(s == Qt::CheckState::Checked);
         ui->frame_cover->setEnabled(s == Qt::CheckState::Checked);
+        ui->txt_cover_names->setEnabled(s == Qt::CheckState::Checked);
     });
 
-    connect(ui->cb_download_missing, &QCheckBox::stateChanged, this, [this](int s) {
-        ui->cb_cover_size->setEnabled(s == Qt::CheckState::Checked);
+    /* Also available at /metrics, this is just a quick overview */
+    m_metrics_tab = new QWidget(this);
+    m_metrics = new QTableWidget(0, 6, m_metrics_tab);
+    m_metrics->setHorizontalHeaderLabels({ T_METRICS_NAME, T_METRICS_LABEL, T_METRICS_COUNT, T_METRICS_AVG, T_METRICS_P95, T_METRICS_MAX });
+    m_metrics->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_metrics->verticalHeader()->setVisible(false);
+    m_metrics->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+
+    /* Recording isn't saved, it's only meant to be turned on while looking into something */
+    auto* cb_trace = new QCheckBox(T_TRACE_RECORD, m_metrics_tab);
+    cb_trace->setToolTip(T_TRACE_RECORD_TOOLTIP);
+    cb_trace->setChecked(trace::enabled);
+    connect(cb_trace, &QCheckBox::toggled, this, [](bool checked) {
+        if (checked)
+            trace::clear();
+        trace::enabled = checked;
     });
+    auto* btn_save_trace = new QPushButton(T_TRACE_SAVE, m_metrics_tab);
+    connect(btn_save_trace, &QPushButton::clicked, this, &tuna_gui::save_trace);
+
+    auto* trace_row = new QHBoxLayout;
+    trace_row->addWidget(cb_trace);
+    trace_row->addStretch();
+    trace_row->addWidget(btn_save_trace);
+    auto* layout = new QVBoxLayout(m_metrics_tab);
+    layout->addWidget(m_metrics);
+    layout->addLayout(trace_row);
+    ui->settings_tabs->insertTab(ui->settings_tabs->indexOf(ui->tab_about), m_metrics_tab, T_METRICS);
+}
+
+void tuna_gui::save_trace()
+{
+    QString path;
+    choose_file(path, T_TRACE_SAVE_FILE, FILTER("Trace file", "*.json"));
+    if (path.isEmpty())
+        return;
+
+    QFile f(path);
+    const auto json = trace::to_json();
+    if (!f.open(QIODevice::WriteOnly) || f.write(json.c_str(), qint64(json.size())) != qint64(json.size()))
+        berr("Couldn't write trace to %s", qt_to_utf8(path));
+}
+
+void tuna_gui::refresh_metrics()
+{
+    const auto rows = metrics::rows();
+    m_metrics->setRowCount(int(rows.size()));
+    auto set = [this](int row, int col, QString const& text) {
+        auto* item = m_metrics->item(row, col);
+        if (!item)
+            m_metrics->setItem(row, col, new QTableWidgetItem(text));
+        else if (item->text() != text)
+            item->setText(text);
+    };
+
+    for (int i = 0; i < int(rows.size()); i++) {
+        auto const& r = rows[size_t(i)];
+        set(i, 0, r.name);
+        set(i, 1, r.label);
+        set(i, 2, QString::number(r.count));
+        set(i, 3, r.is_histogram ? QString::number(r.avg_ms, 'f', 2) : "");
+        set(i, 4, r.is_histogram ? QString::number(r.p95_ms, 'f', 1) : "");
+        set(i, 5, r.is_histogram ? QString::number(r.max_ms, 'f', 2) : "");
+    }
 }
 
 void tuna_gui::choose_file(QString& path, const char* title, const char* file_types)
@@ -155,27 +224,36 @@ void tuna_gui::toggleShowHide()
         music_sources::set_gui_values();
 
         /* load basic values */
-        ui->txt_song_cover->setText(config::cover_path);
-        ui->txt_song_lyrics->setText(config::lyrics_path);
-        ui->sb_refresh_rate->setValue(config::refresh_rate);
-        ui->txt_song_placeholder->setText(config::placeholder);
-        ui->cb_dl_lyrics->setChecked(config::download_lyrics);
-        ui->cb_dl_cover->setChecked(config::download_cover);
-        ui->cb_download_missing->setChecked(config::download_missing_cover);
-        auto idx = ui->cb_source->findData(config::selected_source);
+        const auto cfg = config::get();
+        ui->txt_song_cover->setText(cfg->cover_path);
+        ui->txt_song_lyrics->setText(cfg->lyrics_path);
+        ui->sb_refresh_rate->setValue(cfg->refresh_rate);
+        ui->txt_song_placeholder->setText(cfg->placeholder);
+        ui->cb_dl_lyrics->setChecked(cfg->download_lyrics);
+        ui->cb_dl_cover->setChecked(cfg->download_cover);
+        ui->cb_download_missing->setChecked(cfg->download_missing_cover);
+        ui->txt_cover_names->setText(cfg->cover_names.join(", "));
+        auto idx = ui->cb_source->findData(cfg->selected_source);
 
         ui->frame_lyrics->setEnabled(ui->cb_dl_lyrics->isChecked());
         ui->frame_cover->setEnabled(ui->cb_dl_cover->isChecked());
+        ui->txt_cover_names->setEnabled(ui->cb_dl_cover->isChecked());
         ui->cb_download_missing->setEnabled(ui->cb_dl_cover->isChecked());
-        ui->cb_cover_size->setEnabled(ui->cb_dl_cover->isChecked() && ui->cb_download_missing->isChecked());
+        ui->cb_cover_size->setEnabled(ui->cb_dl_cover->isChecked());
 
         if (idx >= 0)
             ui->cb_source->setCurrentIndex(idx);
         else
             ui->cb_source->setCurrentIndex(0);
-        ui->cb_host_server->setChecked(config::webserver_enabled);
-        ui->sb_web_port->setValue(config::webserver_port);
-        ui->cb_remove_file_extensions->setChecked(config::remove_file_extensions);
+        ui->cb_host_server->setChecked(cfg->webserver_enabled);
+        ui->sb_web_port->setValue(cfg->webserver_port);
+        ui->cb_remove_file_extensions->setChecked(cfg->remove_file_extensions);
+        ui->cb_remove_title_clutter->setChecked(cfg->remove_title_clutter);
+        ui->cb_split_featured->setChecked(cfg->split_featured);
+        ui->txt_title_rules->setPlainText(cfg->title_rules.join('\n'));
+        ui->group_fallback->setChecked(cfg->fallback_enabled);
+        ui->sb_fallback_hold->setValue(cfg->fallback_hold);
+        load_fallback_sources();
         set_state();
 
         /* Load table contents */
@@ -183,8 +261,8 @@ void tuna_gui::toggleShowHide()
         for (; row < ui->tbl_outputs->rowCount(); row++)
             ui->tbl_outputs->removeRow(row);
         row = 0; /* Load rows */
-        ui->tbl_outputs->setRowCount(config::outputs.size());
-        for (const auto& entry : std::as_const(config::outputs)) {
+        ui->tbl_outputs->setRowCount(cfg->outputs.size());
+        for (const auto& entry : std::as_const(cfg->outputs)) {
             ui->tbl_outputs->setItem(row, 0, new QTableWidgetItem(entry.log_mode ? "Yes" : "No"));
             ui->tbl_outputs->setItem(row, 1, new QTableWidgetItem(entry.format));
             ui->tbl_outputs->setItem(row, 2, new QTableWidgetItem(entry.path));
@@ -195,6 +273,31 @@ void tuna_gui::toggleShowHide()
     }
 }
 
+void tuna_gui::load_fallback_sources()
+{
+    /* Sources that are part of the chain come first in their configured order */
+    ui->list_fallback->clear();
+    auto add = [this](const QString& id, bool checked) {
+        auto idx = ui->cb_source->findData(id);
+        if (idx < 0)
+            return;
+        auto* item = new QListWidgetItem(ui->cb_source->itemText(idx), ui->list_fallback);
+        item->setData(Qt::UserRole, id);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable | Qt::ItemIsDragEnabled);
+        item->setFlags(item->flags() & ~Qt::ItemIsDropEnabled);
+        item->setCheckState(checked ? Qt::Checked : Qt::Unchecked);
+    };
+
+    const auto cfg = config::get();
+    for (auto const& id : std::as_const(cfg->fallback_sources))
+        add(id, true);
+    for (int i = 0; i < ui->cb_source->count(); i++) {
+        auto id = ui->cb_source->itemData(i).toString();
+        if (!cfg->fallback_sources.contains(id))
+            add(id, false);
+    }
+}
+
 void tuna_gui::add_source(const QString& display, const QString& id, source_widget* w)
 {
     ui->cb_source->addItem(display, id);
@@ -208,6 +311,8 @@ void tuna_gui::refresh()
 {
     for (auto widget : std::as_const(m_source_widgets))
         widget->tick();
+    if (ui->settings_tabs->currentWidget() == m_metrics_tab)
+        refresh_metrics();
 }
 
 void tuna_gui::select_source(int index)
@@ -217,42 +322,60 @@ void tuna_gui::select_source(int index)
 
 void tuna_gui::tuna_gui_accepted()
 {
-    tuna_thread::thread_mutex.lock();
-    // Save UI values into temp storage
-    config::selected_source = qt_to_utf8(ui->cb_source->currentData().toString());
-    config::cover_path = qt_to_utf8(ui->txt_song_cover->text());
-    config::lyrics_path = qt_to_utf8(ui->txt_song_lyrics->text());
-    config::refresh_rate = ui->sb_refresh_rate->value();
-    config::placeholder = qt_to_utf8(ui->txt_song_placeholder->text());
-    config::download_lyrics = ui->cb_dl_lyrics->isChecked();
-    config::download_cover = ui->cb_dl_cover->isChecked();
-    config::download_missing_cover = ui->cb_download_missing->isChecked();
-    config::webserver_enabled = ui->cb_host_server->isChecked();
-    config::webserver_port = ui->sb_web_port->value();
-    config::remove_file_extensions = ui->cb_remove_file_extensions->isChecked();
-    config::cover_size = ui->cb_cover_size->currentData().toInt();
-    config::refresh_rate = ui->sb_refresh_rate->value();
+    /* The threads keep using the current settings until the new ones are loaded */
+    auto s = *config::get();
+    s.selected_source = qt_to_utf8(ui->cb_source->currentData().toString());
+    s.cover_path = qt_to_utf8(ui->txt_song_cover->text());
+    s.lyrics_path = qt_to_utf8(ui->txt_song_lyrics->text());
+    s.refresh_rate = ui->sb_refresh_rate->value();
+    s.placeholder = qt_to_utf8(ui->txt_song_placeholder->text());
+    s.download_lyrics = ui->cb_dl_lyrics->isChecked();
+    s.download_cover = ui->cb_dl_cover->isChecked();
+    s.download_missing_cover = ui->cb_download_missing->isChecked();
+    s.webserver_enabled = ui->cb_host_server->isChecked();
+    s.webserver_port = ui->sb_web_port->value();
+    s.remove_file_extensions = ui->cb_remove_file_extensions->isChecked();
+    s.remove_title_clutter = ui->cb_remove_title_clutter->isChecked();
+    s.split_featured = ui->cb_split_featured->isChecked();
+    s.title_rules.clear();
+    for (auto const& rule : ui->txt_title_rules->toPlainText().split('\n', Qt::SkipEmptyParts)) {
+        if (!rule.trimmed().isEmpty())
+            s.title_rules.append(rule);
+    }
+    s.cover_size = ui->cb_cover_size->currentData().toInt();
+    s.cover_names.clear();
+    for (auto const& name : ui->txt_cover_names->text().toLower().split(',', Qt::SkipEmptyParts)) {
+        if (!name.trimmed().isEmpty())
+            s.cover_names.append(name.trimmed());
+    }
+    s.refresh_rate = ui->sb_refresh_rate->value();
+    s.fallback_enabled = ui->group_fallback->isChecked();
+    s.fallback_hold = ui->sb_fallback_hold->value();
+    s.fallback_sources.clear();
+    for (int row = 0; row < ui->list_fallback->count(); row++) {
+        auto* item = ui->list_fallback->item(row);
+        if (item->checkState() == Qt::Checked)
+            s.fallback_sources.append(item->data(Qt::UserRole).toString());
+    }
 
     /* save outputs */
-    config::outputs.clear();
+    s.outputs.clear();
     for (int row = 0; row < ui->tbl_outputs->rowCount(); row++) {
         config::output tmp;
         tmp.log_mode = ui->tbl_outputs->item(row, 0)->text() == "Yes";
         tmp.format = ui->tbl_outputs->item(row, 1)->text();
         tmp.path = ui->tbl_outputs->item(row, 2)->text();
-        config::outputs.push_back(tmp);
+        s.outputs.push_back(tmp);
     }
 
-    // Save temp storage into obs config
+    // Save settings into obs config
 
     for (auto& w : m_source_widgets) {
         if (w)
             w->save_settings();
     }
 
-    tuna_thread::thread_mutex.unlock();
-
-    config::save();
+    config::save(s);
     config::load();
     if (music_dock)
         music_dock->select_source(ui->cb_source->currentIndex());
@@ -352,8 +475,3 @@ void tuna_gui::btn_edit_output_clicked()
         dialog->exec();
     }
 }
-
-void tuna_gui::cb_download_missing_covers_clicked(int state)
-{
-    ui->cb_cover_size->setEnabled(state == Qt::CheckState::Checked);
-}
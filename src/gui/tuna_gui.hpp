@@ -25,6 +25,7 @@
 namespace Ui {
 class tuna_gui;
 }
+class QTableWidget;
 
 class source_widget : public QWidget {
     Q_OBJECT
@@ -43,6 +44,11 @@ class tuna_gui : public QDialog {
 
     QList<source_widget*> m_source_widgets;
     QTimer* m_refresh = nullptr;
+    QWidget* m_metrics_tab = nullptr;
+    QTableWidget* m_metrics = nullptr;
+
+    void refresh_metrics();
+    void save_trace();
 
 public:
     explicit tuna_gui(QWidget* parent = nullptr);
@@ -70,10 +76,10 @@ private slots:
     void btn_add_output_clicked();
     void btn_remove_output_clicked();
     void btn_edit_output_clicked();
-    void cb_download_missing_covers_clicked(int);
 
 private:
     void choose_file(QString& path, const char* title, const char* file_types);
+    void load_fallback_sources();
     Ui::tuna_gui* ui;
 };
 
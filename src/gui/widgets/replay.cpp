@@ -0,0 +1,89 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "replay.hpp"
+#include "../../util/config.hpp"
+#include "../../util/constants.hpp"
+#include "../../util/recorder.hpp"
+#include "../../util/utility.hpp"
+#include "ui_replay.h"
+#include <QDir>
+#include <QFileDialog>
+
+replay::replay(QWidget* parent)
+    : source_widget(parent)
+    , ui(new Ui::replay)
+{
+    ui->setupUi(this);
+    connect(ui->btn_browse_replay_file, &QPushButton::clicked, this, &replay::btn_browse_replay_file_clicked);
+    connect(ui->btn_browse_record_file, &QPushButton::clicked, this, &replay::btn_browse_record_file_clicked);
+    connect(ui->btn_record, &QPushButton::clicked, this, &replay::btn_record_clicked);
+}
+
+replay::~replay()
+{
+    delete ui;
+}
+
+void replay::load_settings()
+{
+    ui->txt_replay_file->setText(utf8_to_qt(CGET_STR(CFG_REPLAY_FILE)));
+    ui->sb_speed->setValue(CGET_DOUBLE(CFG_REPLAY_SPEED));
+    ui->cb_loop->setChecked(CGET_BOOL(CFG_REPLAY_LOOP));
+    ui->txt_record_file->setText(utf8_to_qt(CGET_STR(CFG_RECORD_FILE)));
+    update_record_button();
+}
+
+void replay::save_settings()
+{
+    CSET_STR(CFG_REPLAY_FILE, qt_to_utf8(ui->txt_replay_file->text()));
+    CSET_DOUBLE(CFG_REPLAY_SPEED, ui->sb_speed->value());
+    CSET_BOOL(CFG_REPLAY_LOOP, ui->cb_loop->isChecked());
+    CSET_STR(CFG_RECORD_FILE, qt_to_utf8(ui->txt_record_file->text()));
+}
+
+void replay::update_record_button()
+{
+    ui->btn_record->setText(recorder::active() ? T_RECORD_STOP : T_RECORD_START);
+    ui->txt_record_file->setEnabled(!recorder::active());
+    ui->btn_browse_record_file->setEnabled(!recorder::active());
+}
+
+void replay::btn_browse_replay_file_clicked()
+{
+    auto path = QFileDialog::getOpenFileName(this, T_SELECT_RECORDING_FILE, QDir::home().path(), FILTER("Tuna recording", "*.tunarec"));
+    if (!path.isEmpty())
+        ui->txt_replay_file->setText(path);
+}
+
+void replay::btn_browse_record_file_clicked()
+{
+    auto path = QFileDialog::getSaveFileName(this, T_SELECT_RECORDING_FILE, QDir::home().path(), FILTER("Tuna recording", "*.tunarec"));
+    if (!path.isEmpty())
+        ui->txt_record_file->setText(path);
+}
+
+/* Recording isn't a setting, it only runs until it's stopped or OBS closes */
+void replay::btn_record_clicked()
+{
+    if (recorder::active())
+        recorder::stop();
+    else if (!ui->txt_record_file->text().isEmpty())
+        recorder::start(ui->txt_record_file->text());
+    update_record_button();
+}
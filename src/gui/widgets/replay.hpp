@@ -0,0 +1,46 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+
+#include "../tuna_gui.hpp"
+#include <QWidget>
+
+namespace Ui {
+class replay;
+}
+
+class replay : public source_widget {
+    Q_OBJECT
+
+public:
+    explicit replay(QWidget* parent = nullptr);
+    ~replay();
+
+    void load_settings() override;
+    void save_settings() override;
+
+private slots:
+    void btn_browse_replay_file_clicked();
+    void btn_browse_record_file_clicked();
+    void btn_record_clicked();
+
+private:
+    void update_record_button();
+    Ui::replay* ui;
+};
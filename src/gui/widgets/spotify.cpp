@@ -36,8 +36,6 @@ spotify::spotify(QWidget* parent)
 spotify::~spotify()
 {
     delete ui;
-    delete m_token_refresh_promise;
-    delete m_token_request_promise;
 }
 
 void spotify::load_settings()
@@ -73,7 +71,6 @@ void spotify::tick()
         auto result = m_token_refresh_future.get();
         apply_login_state(result.success, result.value);
         m_token_refresh_future = {};
-        delete m_token_refresh_promise;
         m_token_refresh_promise = nullptr;
     }
 
@@ -81,7 +78,6 @@ void spotify::tick()
         auto result = m_token_request_future.get();
         apply_login_state(result.success, result.value);
         m_token_request_future = {};
-        delete m_token_request_promise;
         m_token_request_promise = nullptr;
     }
 }
@@ -177,18 +173,15 @@ void spotify::on_btn_request_token_clicked()
 
     if (spotify) {
         spotify->set_auth_code(ui->txt_auth_code->text());
-        delete m_token_request_promise;
-        m_token_request_promise = new std::promise<result>;
+        m_token_request_promise = std::make_shared<std::promise<result>>();
         m_token_request_future = m_token_request_promise->get_future();
-        // Do the request in a separate thread so the ui doesn't freeze
-        std::thread([this] {
-            auto spotify = music_sources::get<spotify_source>(S_SOURCE_SPOTIFY);
-            if (spotify) {
-                QString log;
-                bool result = spotify->new_token(log);
-                m_token_request_promise->set_value_at_thread_exit({ result, log });
-            }
-        }).detach();
+        // Do the request on the worker of the source so the ui doesn't freeze
+        auto promise = m_token_request_promise;
+        music_sources::post(spotify, [spotify, promise] {
+            QString log;
+            bool result = spotify->new_token(log);
+            promise->set_value({ result, log });
+        });
     } else {
         berr("Couldn't get spotify source instance");
     }
@@ -228,18 +221,16 @@ void spotify::on_btn_performrefresh_clicked()
 
     if (spotify) {
         spotify->set_auth_code(ui->txt_auth_code->text());
-        m_token_refresh_promise = new std::promise<spotify::result>;
+        m_token_refresh_promise = std::make_shared<std::promise<spotify::result>>();
         m_token_refresh_future = m_token_refresh_promise->get_future();
 
-        // Do the refresh in a  separate thread so the ui doesn't freeze
-        std::thread([this] {
-            auto spotify = music_sources::get<spotify_source>(S_SOURCE_SPOTIFY);
-            if (spotify) {
-                QString log;
-                bool result = spotify->do_refresh_token(log);
-                m_token_refresh_promise->set_value_at_thread_exit({ result, log });
-            }
-        }).detach();
+        // Do the refresh on the worker of the source so the ui doesn't freeze
+        auto promise = m_token_refresh_promise;
+        music_sources::post(spotify, [spotify, promise] {
+            QString log;
+            bool result = spotify->do_refresh_token(log);
+            promise->set_value({ result, log });
+        });
     } else {
         berr("Couldn't get spotify source instance");
     }
@@ -20,6 +20,7 @@
 
 #include "../tuna_gui.hpp"
 #include <future>
+#include <memory>
 
 namespace Ui {
 class spotify;
@@ -34,7 +35,8 @@ class spotify : public source_widget {
     Q_OBJECT
     void apply_login_state(bool state, const QString& log);
 
-    std::promise<result>*m_token_request_promise {}, *m_token_refresh_promise {};
+    /* Shared with the command that runs on the source's worker */
+    std::shared_ptr<std::promise<result>> m_token_request_promise {}, m_token_refresh_promise {};
     std::future<result> m_token_request_future {}, m_token_refresh_future {};
 
 public:
@@ -19,7 +19,6 @@
 #include "vlc.hpp"
 #include "../../util/config.hpp"
 #include "../../util/constants.hpp"
-#include "../../util/tuna_thread.hpp"
 #include "../../util/utility.hpp"
 #include "ui_vlc.h"
 #include <QJsonArray>
@@ -66,6 +65,7 @@ void vlc::load_settings()
     }
 
     if (doc.isObject()) {
+        std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
         m_source_map = doc.object();
     } else {
         berr("Failed to load vlc mappings: Json content must be an object");
@@ -77,6 +77,7 @@ void vlc::build_list()
 {
     auto sc = get_scene_collection();
     auto scene = ui->cb_scene->currentText();
+    std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
     auto maps = m_source_map[sc].toObject()[scene].toArray();
     m_list->clear();
     for (const auto& map : maps) {
@@ -88,6 +89,7 @@ void vlc::build_list()
 
 bool vlc::has_mapping(const char* scene, const char* source)
 {
+    std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
     auto map = m_source_map[get_scene_collection()].toObject();
     for (const auto& k : map.keys()) {
         if (k == utf8_to_qt(scene)) {
@@ -104,6 +106,7 @@ bool vlc::has_mapping(const char* scene, const char* source)
 void vlc::rebuild_mapping()
 {
     auto sc = get_scene_collection();
+    std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
     auto map = m_source_map[sc].toObject();
     for (auto& scene_id : map.keys()) {
         auto* scene = obs_get_scene_by_name(qt_to_utf8(scene_id));
@@ -122,6 +125,7 @@ void vlc::rebuild_mapping()
 QJsonArray vlc::get_mappings_for_scene(const char* scene)
 {
     auto sc = get_scene_collection();
+    std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
     if (m_source_map[sc].toObject().contains(utf8_to_qt(scene)))
         return m_source_map[sc].toObject()[utf8_to_qt(scene)].toArray();
     return {};
@@ -129,6 +133,7 @@ QJsonArray vlc::get_mappings_for_scene(const char* scene)
 
 void vlc::save_settings()
 {
+    std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
     if (!util::save_config(VLC_SCENE_MAPPING, QJsonDocument(m_source_map)))
         berr("Failed to save vlc mappings");
 }
@@ -161,7 +166,9 @@ void vlc::on_scene_changed(int)
     refresh_sources();
     m_list->clear();
     auto id = ui->cb_scene->currentText();
+    std::unique_lock<std::recursive_mutex> lock(m_map_mutex);
     auto map = m_source_map[get_scene_collection()].toObject();
+    lock.unlock();
     if (map.contains(id)) {
         auto val = map[id];
         if (val.isArray()) {
@@ -183,6 +190,7 @@ void vlc::on_remove_source()
 void vlc::set_map(const QString& scene, const QJsonArray& map)
 {
     auto sc = get_scene_collection();
+    std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
     auto obj = m_source_map[sc].toObject();
     obj[scene] = map;
     m_source_map[sc] = obj;
@@ -232,7 +240,7 @@ void vlc::on_add_source()
     auto* scene = obs_get_scene_by_name(qt_to_utf8(scene_id));
 
     if (src && scene) {
-        std::lock_guard<std::mutex> lock(tuna_thread::thread_mutex);
+        std::lock_guard<std::recursive_mutex> lock(m_map_mutex);
         if (m_source_map[sc].toObject().contains(scene_id)) {
             auto arr = m_source_map[sc].toObject()[scene_id].toArray();
             arr.append(src_id);
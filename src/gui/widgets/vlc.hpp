@@ -22,6 +22,7 @@
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QListWidgetItem>
+#include <mutex>
 #include <obs-module.h>
 
 namespace Ui {
@@ -33,6 +34,8 @@ class drag_list;
 class vlc : public source_widget {
     Q_OBJECT
     void load_vlc_sources();
+    /* Read by the vlc source on its worker */
+    std::recursive_mutex m_map_mutex;
     QJsonObject m_source_map;
     drag_list* m_list { nullptr };
 
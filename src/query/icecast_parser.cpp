@@ -0,0 +1,349 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "icecast_parser.hpp"
+#include <algorithm>
+
+namespace icecast {
+
+void icy_reader::reset(size_t metaint)
+{
+    m_metaint = metaint;
+    m_audio_left = metaint;
+    m_meta_left = 0;
+    m_meta.clear();
+}
+
+void icy_reader::feed(const char* data, size_t length)
+{
+    if (m_metaint == 0)
+        return;
+
+    while (length > 0) {
+        if (m_meta_left > 0) {
+            auto n = std::min(length, m_meta_left);
+            m_meta.append(data, n);
+            data += n;
+            length -= n;
+            m_meta_left -= n;
+            if (m_meta_left == 0 && m_on_metadata)
+                m_on_metadata(m_meta);
+        } else if (m_audio_left > 0) {
+            /* Audio data is skipped */
+            auto n = std::min(length, m_audio_left);
+            data += n;
+            length -= n;
+            m_audio_left -= n;
+        } else {
+            /* Length byte, a zero length means the metadata didn't change */
+            m_meta_left = size_t(uint8_t(*data)) * 16;
+            m_audio_left = m_metaint;
+            m_meta.clear();
+            data++;
+            length--;
+        }
+    }
+}
+
+bool parse_stream_title(std::string const& block, std::string& title)
+{
+    static const std::string key = "StreamTitle='";
+    auto start = block.find(key);
+    if (start == std::string::npos)
+        return false;
+    start += key.length();
+
+    /* Titles can contain apostrophes, so the value only ends at "';" */
+    auto end = block.find("';", start);
+    if (end == std::string::npos) {
+        /* Last field, the rest of the block is zero padding */
+        end = block.find('\0', start);
+        if (end == std::string::npos)
+            end = block.length();
+        if (end > start && block[end - 1] == '\'')
+            end--;
+    }
+    title = block.substr(start, end - start);
+    return true;
+}
+
+/* === status-json.xsl === */
+
+/* Containers nested deeper than this aren't part of any valid status page */
+#define MAX_DEPTH 32
+/* Captured strings are cut off at this length */
+#define MAX_VALUE_LENGTH 1024
+
+/* listenurl is the full url of the mount, e.g. http://host:8000/stream,
+ * only its path is compared with the mount */
+static bool matches_mount(std::string const& url, std::string const& mount)
+{
+    size_t start = 0;
+    auto scheme = url.find("://");
+    if (scheme != std::string::npos) {
+        start = url.find('/', scheme + 3);
+        if (start == std::string::npos)
+            return false;
+    }
+    auto end = url.find_first_of("?#", start);
+    if (end == std::string::npos)
+        end = url.length();
+    return url.compare(start, end - start, mount) == 0;
+}
+
+status_parser::status_parser(std::string mount)
+    : m_mount(std::move(mount))
+{
+    m_stack.reserve(MAX_DEPTH);
+}
+
+bool status_parser::capturing() const
+{
+    /* Only values directly inside of a source entry are of interest */
+    return !m_stack.empty() && m_stack.back().source && !m_string_is_key;
+}
+
+bool status_parser::complete() const
+{
+    auto const& c = m_current;
+    return !c.listen_url.empty() && !c.title.empty() && !c.artist.empty() && c.listeners >= 0;
+}
+
+void status_parser::begin_container(bool object)
+{
+    if (m_stack.size() >= MAX_DEPTH) {
+        m_error = true;
+        return;
+    }
+
+    frame f { object, false, m_stack.empty() ? "" : m_key };
+    if (!m_stack.empty() && !m_stack.back().object)
+        f.name = m_stack.back().name; /* Array entries inherit the name of the array */
+
+    if (object && f.name == "source") {
+        auto const depth = m_stack.size();
+        if (depth == 2 && m_stack[1].name == "icestats") /* "source": { ... } */
+            f.source = true;
+        else if (depth == 3 && !m_stack[2].object && m_stack[1].name == "icestats") /* "source": [ { ... } ] */
+            f.source = true;
+    }
+
+    if (f.source)
+        m_current = {};
+    m_stack.push_back(std::move(f));
+    m_expect_key = object;
+    m_key.clear();
+}
+
+void status_parser::end_container()
+{
+    if (m_stack.empty()) {
+        m_error = true;
+        return;
+    }
+
+    const bool was_source = m_stack.back().source;
+    m_stack.pop_back();
+    m_expect_key = false;
+
+    if (was_source) {
+        /* Without a configured mount the first one is used */
+        if (m_mount.empty() || matches_mount(m_current.listen_url, m_mount)) {
+            m_result = m_current;
+            m_found = true;
+        }
+    }
+}
+
+void status_parser::end_value()
+{
+    if (m_string_is_key) {
+        m_key = m_buffer;
+        m_string_is_key = false;
+    } else if (!m_stack.empty() && m_stack.back().source) {
+        if (m_key == "listenurl")
+            m_current.listen_url = m_buffer;
+        else if (m_key == "title")
+            m_current.title = m_buffer;
+        else if (m_key == "artist")
+            m_current.artist = m_buffer;
+        else if (m_key == "listeners")
+            m_current.listeners = atoi(m_buffer.c_str());
+
+        /* Everything we need is there, no point in waiting for the rest of the object */
+        if (complete() && !m_mount.empty() && matches_mount(m_current.listen_url, m_mount)) {
+            m_result = m_current;
+            m_found = true;
+        }
+    }
+    m_buffer.clear();
+}
+
+void status_parser::append_codepoint(uint32_t cp)
+{
+    if (!capturing() && !m_string_is_key)
+        return;
+    if (cp < 0x80) {
+        m_buffer += char(cp);
+    } else if (cp < 0x800) {
+        m_buffer += char(0xC0 | (cp >> 6));
+        m_buffer += char(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        m_buffer += char(0xE0 | (cp >> 12));
+        m_buffer += char(0x80 | ((cp >> 6) & 0x3F));
+        m_buffer += char(0x80 | (cp & 0x3F));
+    } else {
+        m_buffer += char(0xF0 | (cp >> 18));
+        m_buffer += char(0x80 | ((cp >> 12) & 0x3F));
+        m_buffer += char(0x80 | ((cp >> 6) & 0x3F));
+        m_buffer += char(0x80 | (cp & 0x3F));
+    }
+}
+
+bool status_parser::feed(const char* data, size_t length)
+{
+    for (size_t i = 0; i < length && !m_found && !m_error; i++) {
+        const char c = data[i];
+        const bool keep = capturing() || m_string_is_key;
+
+        switch (m_state) {
+        case state::string:
+            if (c == '\\') {
+                m_state = state::string_escape;
+            } else if (c == '"') {
+                m_state = state::value;
+                end_value();
+            } else if (keep && m_buffer.length() < MAX_VALUE_LENGTH) {
+                m_buffer += c;
+            }
+            continue;
+        case state::string_escape:
+            m_state = state::string;
+            if (!keep || m_buffer.length() >= MAX_VALUE_LENGTH) {
+                if (c == 'u') {
+                    m_state = state::string_unicode;
+                    m_unicode_digits = 0;
+                    m_unicode = 0;
+                }
+                continue;
+            }
+            switch (c) {
+            case 'n':
+                m_buffer += '\n';
+                break;
+            case 't':
+                m_buffer += '\t';
+                break;
+            case 'r':
+                m_buffer += '\r';
+                break;
+            case 'b':
+                m_buffer += '\b';
+                break;
+            case 'f':
+                m_buffer += '\f';
+                break;
+            case 'u':
+                m_state = state::string_unicode;
+                m_unicode_digits = 0;
+                m_unicode = 0;
+                break;
+            default: /* \" \\ \/ */
+                m_buffer += c;
+            }
+            continue;
+        case state::string_unicode: {
+            int digit = -1;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                digit = c - 'A' + 10;
+            if (digit < 0) {
+                m_error = true;
+                continue;
+            }
+            m_unicode = (m_unicode << 4) | uint32_t(digit);
+            if (++m_unicode_digits == 4) {
+                m_state = state::string;
+                if (m_unicode >= 0xD800 && m_unicode < 0xDC00) {
+                    m_high_surrogate = m_unicode;
+                } else if (m_unicode >= 0xDC00 && m_unicode < 0xE000 && m_high_surrogate) {
+                    append_codepoint(0x10000 + ((m_high_surrogate - 0xD800) << 10) + (m_unicode - 0xDC00));
+                    m_high_surrogate = 0;
+                } else {
+                    append_codepoint(m_unicode);
+                    m_high_surrogate = 0;
+                }
+            }
+            continue;
+        }
+        case state::literal:
+            if (c == ',' || c == '}' || c == ']' || c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+                m_state = state::value;
+                end_value();
+                break; /* The delimiter is handled below */
+            }
+            if (capturing() && m_buffer.length() < MAX_VALUE_LENGTH)
+                m_buffer += c;
+            continue;
+        case state::value:
+            break;
+        }
+
+        switch (c) {
+        case '{':
+            begin_container(true);
+            break;
+        case '[':
+            begin_container(false);
+            break;
+        case '}':
+        case ']':
+            end_container();
+            break;
+        case ':':
+            m_expect_key = false;
+            break;
+        case ',':
+            if (!m_stack.empty() && m_stack.back().object)
+                m_expect_key = true;
+            break;
+        case '"':
+            m_state = state::string;
+            m_string_is_key = m_expect_key;
+            m_buffer.clear();
+            break;
+        case ' ':
+        case '\n':
+        case '\r':
+        case '\t':
+            break;
+        default:
+            /* Numbers, true, false and null */
+            m_state = state::literal;
+            m_buffer.clear();
+            if (capturing())
+                m_buffer += c;
+        }
+    }
+    return !m_found && !m_error;
+}
+
+}
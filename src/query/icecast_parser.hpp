@@ -0,0 +1,115 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace icecast {
+
+/* Splits a stream requested with "Icy-MetaData: 1" into audio, which is
+ * discarded, and metadata blocks. The server sends <metaint> bytes of
+ * audio followed by one length byte (in units of 16 bytes) and then the
+ * metadata block itself. */
+class icy_reader {
+    size_t m_metaint = 0;
+    size_t m_audio_left = 0;
+    size_t m_meta_left = 0;
+    std::string m_meta;
+    std::function<void(std::string const&)> m_on_metadata;
+
+public:
+    explicit icy_reader(std::function<void(std::string const&)> on_metadata)
+        : m_on_metadata(std::move(on_metadata))
+    {
+    }
+
+    void reset(size_t metaint);
+    void feed(const char* data, size_t length);
+    size_t metaint() const { return m_metaint; }
+};
+
+/* Extracts the value of StreamTitle='...'; from a metadata block,
+ * returns false if the block doesn't contain a title */
+extern bool parse_stream_title(std::string const& block, std::string& title);
+
+struct mount_info {
+    std::string listen_url;
+    std::string title;
+    std::string artist;
+    int listeners = -1;
+};
+
+/* Incremental reader for <server>/status-json.xsl. Data is fed straight
+ * from the cURL write callback and only the fields of the source object
+ * belonging to the wanted mount are kept, so memory use doesn't depend
+ * on how many mounts the server has. icestats.source can either be a
+ * single object or an array of them. */
+class status_parser {
+    struct frame {
+        bool object;
+        bool source;    /* An entry of icestats.source */
+        std::string name; /* Key this container was stored under */
+    };
+
+    enum class state {
+        value,
+        string,
+        string_escape,
+        string_unicode,
+        literal
+    };
+
+    std::string m_mount;
+    std::vector<frame> m_stack;
+    state m_state = state::value;
+    bool m_expect_key = false;
+    bool m_string_is_key = false;
+    std::string m_key;
+    std::string m_buffer;
+    uint32_t m_unicode = 0, m_high_surrogate = 0;
+    int m_unicode_digits = 0;
+
+    mount_info m_current;
+    mount_info m_result;
+    bool m_found = false;
+    bool m_error = false;
+
+    bool capturing() const;
+    void begin_container(bool object);
+    void end_container();
+    void end_value();
+    void append_codepoint(uint32_t cp);
+    bool complete() const;
+
+public:
+    explicit status_parser(std::string mount);
+
+    /* Returns false once the mount was found (or the data is broken),
+     * at which point the transfer can be stopped */
+    bool feed(const char* data, size_t length);
+
+    bool found() const { return m_found; }
+    bool failed() const { return m_error; }
+    mount_info const& result() const { return m_result; }
+};
+
+}
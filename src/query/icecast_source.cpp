@@ -20,78 +20,331 @@
 #include "../gui/widgets/icecast.hpp"
 #include "../util/config.hpp"
 #include "../util/utility.hpp"
+#include "icecast_parser.hpp"
 #include <QDateTime>
-#include <QJsonDocument>
-#include <QJsonObject>
+#include <algorithm>
+#include <cstdlib>
 #include <curl/curl.h>
 
+/* Longest wait between reconnection attempts in seconds */
+#define ICY_MAX_BACKOFF 60
+
 icecast_source::icecast_source()
     : music_source(S_SOURCE_ICECAST, T_SOURCE_ICECAST, new icecast)
 {
-    supported_metadata({ meta::TITLE });
+    supported_metadata({ meta::TITLE, meta::ARTIST, meta::LISTENERS });
 }
 
 void icecast_source::load()
 {
     music_source::load();
     CDEF_STR(CFG_ICECAST_URL, "");
-    m_url = utf8_to_qt(CGET_STR(CFG_ICECAST_URL)) + "/status-json.xsl";
-    m_logged_response_too_big = false;
+    CDEF_STR(CFG_ICECAST_MOUNT, "");
+    CDEF_BOOL(CFG_ICECAST_USE_ICY, false);
+
+    /* Settings might have changed, the listener is started again with the
+     * new url on the next refresh */
+    stop_listener();
+
+    auto base = utf8_to_qt(CGET_STR(CFG_ICECAST_URL));
+    while (base.endsWith('/'))
+        base.chop(1);
+    auto mount = utf8_to_qt(CGET_STR(CFG_ICECAST_MOUNT));
+    if (!mount.isEmpty() && !mount.startsWith('/'))
+        mount.prepend('/');
+
+    m_url = base + "/status-json.xsl";
+    m_stream_url = (base.isEmpty() || mount.isEmpty()) ? "" : base + mount;
+    m_mount = qt_to_utf8(mount);
+    m_use_icy = CGET_BOOL(CFG_ICECAST_USE_ICY);
+}
+
+void icecast_source::reset_info()
+{
+    music_source::reset_info();
+    /* Only listen to the stream while this source is in use */
+    stop_listener();
 }
 
 void icecast_source::refresh()
 {
-    static char error_buffer[CURL_ERROR_SIZE];
+    if (m_use_icy)
+        refresh_icy();
+    else
+        refresh_status();
+}
 
-    if (m_logged_response_too_big || m_url.isEmpty())
+void icecast_source::refresh_icy()
+{
+    if (m_stream_url.isEmpty())
         return;
 
+    start_listener();
     begin_refresh();
-    auto* curl = curl_easy_init();
-    if (curl) {
-        error_buffer[0] = '\0';
-        std::string response;
-        curl_easy_setopt(curl, CURLOPT_URL, qt_to_utf8(m_url));
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, util::write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buffer);
-        auto result = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
-
-        if (result == CURLE_OK) {
-            // Pretty arbitrary, but I have tested this with some stations
-            // and they respond with ~1MB of data which we will not parse
-            if (response.length() > 1024 * 512) {
-                m_logged_response_too_big = true;
-                berr("The IceCast server at %s responded with %zu bytes of data "
-                     "which is too long and therefore will not be processed",
-                    qt_to_utf8(m_url), response.length());
-                return;
-            }
-            QJsonParseError err;
-            auto doc = QJsonDocument::fromJson(response.c_str(), &err);
-
-            if (doc.isNull() || !doc.isObject()) {
-                berr("Failed to parse json response from IceCast server: %s", qt_to_utf8(err.errorString()));
-            } else {
-                auto stats = doc.object()["icestats"].toObject();
-                if (!stats.isEmpty()) {
-                    auto source = stats["source"].toObject();
-                    if (source["title"].isString()) {
-                        m_current.set(meta::TITLE, source["title"].toString());
-                        m_current.set(meta::STATUS, state_playing);
-                    }
-                }
-            }
+
+    std::lock_guard<std::mutex> lock(m_icy_mutex);
+    if (m_icy_connected) {
+        /* Stations send an empty title e.g. during ads, which shouldn't
+         * leave the previous song around */
+        if (m_icy_title.isEmpty()) {
+            m_current.reset<meta::TITLE>();
+            m_current.reset<meta::ARTIST>();
         } else {
-            auto epoch = QDateTime::currentSecsSinceEpoch();
-            if (m_last_log == 0 || m_last_log - epoch > 10) {
-                m_last_log = epoch;
-                berr("Failed to retrieve information from IceCast server %s: cURL error '%s' (%i)",
-                    qt_to_utf8(m_url), curl_easy_strerror(result), result);
-                if (strlen(error_buffer) > 0)
-                    berr("Additional curl error message: %s", error_buffer);
+            m_current.set(meta::TITLE, m_icy_title);
+        }
+        m_current.set(meta::STATUS, state_playing);
+    } else {
+        m_current.set(meta::STATUS, state_stopped);
+    }
+}
+
+void icecast_source::set_icy_title(const std::string& title)
+{
+    /* Stations don't agree on an encoding, most use utf8 but some still send latin1 */
+    auto str = QString::fromUtf8(title.c_str(), int(title.length()));
+    if (str.contains(QChar::ReplacementCharacter))
+        str = QString::fromLatin1(title.c_str(), int(title.length()));
+
+    std::lock_guard<std::mutex> lock(m_icy_mutex);
+    if (str != m_icy_title) {
+        m_icy_title = str;
+        bdebug("IceCast stream title changed to '%s'", qt_to_utf8(str));
+    }
+}
+
+void icecast_source::set_icy_connected()
+{
+    std::lock_guard<std::mutex> lock(m_icy_mutex);
+    m_icy_connected = true;
+}
+
+void icecast_source::start_listener()
+{
+    std::lock_guard<std::mutex> lock(m_listener_mutex);
+    if (m_listener_flag)
+        return;
+    if (m_listener.joinable())
+        m_listener.join();
+    m_listener_flag = true;
+    m_listener = std::thread(&icecast_source::listener_method, this);
+}
+
+void icecast_source::stop_listener()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_listener_mutex);
+        m_listener_flag = false;
+    }
+    m_listener_cv.notify_all();
+    if (m_listener.joinable())
+        m_listener.join();
+
+    std::lock_guard<std::mutex> lock(m_icy_mutex);
+    m_icy_connected = false;
+    m_icy_title.clear();
+}
+
+void icecast_source::listener_method()
+{
+    util::set_thread_name("tuna-icecast");
+    int backoff = 0;
+
+    std::unique_lock<std::mutex> lock(m_listener_mutex);
+    while (m_listener_flag) {
+        auto url = m_stream_url;
+        lock.unlock();
+        const bool received_metadata = listen(url);
+        {
+            std::lock_guard<std::mutex> icy_lock(m_icy_mutex);
+            m_icy_connected = false;
+        }
+        lock.lock();
+
+        if (!m_listener_flag)
+            break;
+
+        /* A connection that delivered metadata was working fine, so the
+         * server probably just dropped us and we can retry quickly */
+        backoff = received_metadata ? 1 : std::min(backoff > 0 ? backoff * 2 : 1, ICY_MAX_BACKOFF);
+        binfo("IceCast stream %s disconnected, reconnecting in %i seconds", qt_to_utf8(url), backoff);
+        m_listener_cv.wait_for(lock, std::chrono::seconds(backoff), [this] { return !m_listener_flag; });
+    }
+}
+
+/* === cURL handling for the ICY stream === */
+
+struct icy_session {
+    icecast_source* source;
+    icecast::icy_reader reader;
+    size_t metaint = 0;
+    long status = 0; /* Of the last response, there can be redirects before the stream */
+    bool received_metadata = false;
+    bool logged_missing_metaint = false;
+
+    explicit icy_session(icecast_source* src)
+        : source(src)
+        , reader([this](std::string const& block) {
+            std::string title;
+            if (icecast::parse_stream_title(block, title)) {
+                received_metadata = true;
+                source->set_icy_title(title);
             }
+        })
+    {
+    }
+};
+
+static size_t icy_header_callback(char* ptr, size_t size, size_t nmemb, icy_session* session)
+{
+    static const std::string key = "icy-metaint:";
+    const size_t length = size * nmemb;
+    std::string line(ptr, length);
+
+    /* Status line, e.g. "HTTP/1.1 200 OK" or "ICY 200 OK" for older servers */
+    if (line.rfind("HTTP/", 0) == 0 || line.rfind("ICY ", 0) == 0) {
+        auto space = line.find(' ');
+        session->status = strtol(line.c_str() + space + 1, nullptr, 10);
+        return length;
+    }
+
+    /* The empty line after the headers, only now the stream is actually there */
+    if (line == "\r\n" || line == "\n") {
+        if (session->status >= 200 && session->status < 300)
+            session->source->set_icy_connected();
+        return length;
+    }
+
+    if (line.length() > key.length()) {
+        std::string name = line.substr(0, key.length());
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == key) {
+            session->metaint = strtoul(line.c_str() + key.length(), nullptr, 10);
+            session->reader.reset(session->metaint);
+        }
+    }
+    return length;
+}
+
+static size_t icy_write_callback(char* ptr, size_t size, size_t nmemb, icy_session* session)
+{
+    const size_t length = size * nmemb;
+    if (session->metaint == 0) {
+        /* Without the interval there's no way to find the metadata */
+        if (!session->logged_missing_metaint) {
+            session->logged_missing_metaint = true;
+            berr("IceCast server did not send icy-metaint, in-band metadata is not available for this mount");
+        }
+        return 0;
+    }
+    session->reader.feed(ptr, length);
+    return length;
+}
+
+static int icy_progress_callback(icy_session* session, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+    /* Aborts the transfer once the listener is stopped */
+    return session->source->listening() ? 0 : 1;
+}
+
+bool icecast_source::listen(const QString& url)
+{
+    char error_buffer[CURL_ERROR_SIZE] {};
+    auto* curl = curl_easy_init();
+    if (!curl)
+        return false;
+
+    icy_session session(this);
+    auto* headers = curl_slist_append(nullptr, "Icy-MetaData: 1");
+    curl_easy_setopt(curl, CURLOPT_URL, qt_to_utf8(url));
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+    /* Streams never end on their own, but a stalled one should be dropped */
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 30L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, icy_header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &session);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, icy_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &session);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, icy_progress_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &session);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buffer);
+
+    binfo("Listening for metadata on IceCast stream %s", qt_to_utf8(url));
+    auto result = curl_easy_perform(curl);
+
+    if (result != CURLE_OK && result != CURLE_ABORTED_BY_CALLBACK && listening() && !session.logged_missing_metaint) {
+        berr("IceCast stream %s failed: cURL error '%s' (%i)", qt_to_utf8(url), curl_easy_strerror(result), result);
+        if (strlen(error_buffer) > 0)
+            berr("Additional curl error message: %s", error_buffer);
+    }
+
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    return session.received_metadata;
+}
+
+/* === status-json.xsl polling === */
+
+static size_t status_write_callback(char* ptr, size_t size, size_t nmemb, icecast::status_parser* parser)
+{
+    const size_t length = size * nmemb;
+    /* Returning less than we got makes cURL stop the transfer */
+    return parser->feed(ptr, length) ? length : 0;
+}
+
+void icecast_source::refresh_status()
+{
+    static char error_buffer[CURL_ERROR_SIZE];
+
+    if (m_url.isEmpty())
+        return;
+
+    begin_refresh();
+    auto* curl = curl_easy_init();
+    if (!curl)
+        return;
+
+    error_buffer[0] = '\0';
+    icecast::status_parser parser(m_mount);
+    curl_easy_setopt(curl, CURLOPT_URL, qt_to_utf8(m_url));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, status_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &parser);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buffer);
+    auto result = util::curl_perform(curl, "icecast");
+    curl_easy_cleanup(curl);
+
+    /* The transfer is cut short once the mount was found */
+    if (parser.found()) {
+        auto const& info = parser.result();
+        if (!info.title.empty()) {
+            m_current.set(meta::TITLE, QString::fromStdString(info.title));
+            m_current.set(meta::STATUS, state_playing);
         }
+        if (!info.artist.empty())
+            m_current.set(meta::ARTIST, QStringList(QString::fromStdString(info.artist)));
+        if (info.listeners >= 0)
+            m_current.set(meta::LISTENERS, info.listeners);
+        return;
+    }
+
+    auto epoch = QDateTime::currentSecsSinceEpoch();
+    if (m_last_log != 0 && epoch - m_last_log < 10)
+        return;
+    m_last_log = epoch;
+
+    if (result == CURLE_OK || parser.failed()) {
+        if (parser.failed())
+            berr("Failed to parse status of IceCast server %s", qt_to_utf8(m_url));
+        else if (m_mount.empty())
+            berr("IceCast server %s has no active mounts", qt_to_utf8(m_url));
+        else
+            berr("IceCast server %s has no active mount %s", qt_to_utf8(m_url), m_mount.c_str());
+    } else {
+        berr("Failed to retrieve information from IceCast server %s: cURL error '%s' (%i)",
+            qt_to_utf8(m_url), curl_easy_strerror(result), result);
+        if (strlen(error_buffer) > 0)
+            berr("Additional curl error message: %s", error_buffer);
     }
 }
@@ -20,17 +20,48 @@
 #include "../util/constants.hpp"
 #include "music_source.hpp"
 #include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 class icecast_source : public music_source {
     QString m_url {};
+    std::string m_mount {};
     qint64 m_last_log {};
-    bool m_logged_response_too_big { false };
+
+    /* In-band (ICY) metadata, read from the stream of one mount */
+    bool m_use_icy { false };
+    QString m_stream_url {};
+    std::thread m_listener;
+    std::mutex m_listener_mutex;
+    std::condition_variable m_listener_cv;
+    std::atomic<bool> m_listener_flag { false };
+
+    /* Written by the listener thread, read in refresh() */
+    std::mutex m_icy_mutex;
+    QString m_icy_title {};
+    bool m_icy_connected { false };
+
+    void refresh_status();
+    void refresh_icy();
+
+    void start_listener();
+    void stop_listener();
+    void listener_method();
+    bool listen(const QString& url);
 
 public:
     icecast_source();
+    ~icecast_source() { stop_listener(); }
 
     void load() override;
     void refresh() override;
+    void reset_info() override;
+    void set_icy_title(const std::string& title);
+    /* Called once the stream's response headers arrived */
+    void set_icy_connected();
+    bool listening() const { return m_listener_flag; }
     bool execute_capability(capability) override { return false; };
     bool enabled() const override { return true; };
 };
@@ -28,6 +28,8 @@
 #include <QUrl>
 #include <curl/curl.h>
 
+#define API_URL "https://ws.audioscrobbler.com/2.0/"
+
 long lastfm_request(QJsonDocument& response_json, const QString& url);
 
 lastfm_source::lastfm_source()
@@ -39,7 +41,9 @@ lastfm_source::lastfm_source()
 void lastfm_source::load()
 {
     music_source::load();
+    CDEF_STR(CFG_LASTFM_API_URL, API_URL);
     m_username = utf8_to_qt(CGET_STR(CFG_LASTFM_USERNAME));
+    m_api_url = utf8_to_qt(CGET_STR(CFG_LASTFM_API_URL));
     m_api_key = utf8_to_qt(CGET_STR(CFG_LASTFM_API_KEY));
     if (m_api_key.isEmpty()) {
         m_custom_api_key = false;
@@ -69,7 +73,7 @@ void lastfm_source::refresh()
 
     begin_refresh();
     m_current.clear();
-    QString track_request = "https://ws.audioscrobbler.com/2.0/?method=user.getrecenttracks&user=" + m_username + "&api_key=" + m_api_key + "&limit=1&format=json";
+    QString track_request = m_api_url + "?method=user.getrecenttracks&user=" + m_username + "&api_key=" + m_api_key + "&limit=1&format=json";
     QJsonDocument response;
     auto code = lastfm_request(response, track_request);
     if (code == HTTP_OK) {
@@ -148,7 +152,7 @@ long lastfm_request(QJsonDocument& response_json, const QString& url)
 #ifdef DEBUG
     curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = util::curl_perform(curl, "lastfm");
 
     if (res == CURLE_OK) {
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
@@ -21,7 +21,7 @@
 #include "music_source.hpp"
 
 class lastfm_source : public music_source {
-    QString m_username, m_api_key;
+    QString m_username, m_api_key, m_api_url;
     bool m_custom_api_key = false;
     uint64_t m_next_refresh = 0;
     void parse_song(const QJsonObject& s);
@@ -22,16 +22,21 @@
 #include "../util/config.hpp"
 #include "../util/cover_tag_handler.hpp"
 #include "../util/lyrics_handler.hpp"
+#include "../util/metrics.hpp"
+#include "../util/tag_reader.hpp"
 #include "../util/utility.hpp"
 #include <QStringList>
 #include <obs-module.h>
 #include <taglib/fileref.h>
 
+/* Volume change per press in percent */
+#define VOLUME_STEP 2
+
 mpd_source::mpd_source()
     : music_source(S_SOURCE_MPD, T_SOURCE_MPD, new mpd)
 {
     m_capabilities = CAP_NEXT_SONG | CAP_PREV_SONG | CAP_PLAY_PAUSE | CAP_STOP_SONG | CAP_VOLUME_UP | CAP_VOLUME_DOWN | CAP_VOLUME_MUTE;
-    supported_metadata({ meta::TITLE, meta::ARTIST, meta::ALBUM, meta::RELEASE, meta::RELEASE_DAY, meta::RELEASE_MONTH, meta::RELEASE_YEAR, meta::COVER, meta::LYRICS, meta::DURATION, meta::DISC_NUMBER, meta::TRACK_NUMBER, meta::PROGRESS, meta::STATUS, meta::LABEL, meta::FILE_NAME });
+    supported_metadata({ meta::TITLE, meta::ARTIST, meta::ALBUM, meta::RELEASE, meta::RELEASE_DAY, meta::RELEASE_MONTH, meta::RELEASE_YEAR, meta::COVER, meta::LYRICS, meta::DURATION, meta::DISC_NUMBER, meta::TRACK_NUMBER, meta::PROGRESS, meta::STATUS, meta::LABEL, meta::FILE_NAME, meta::GENRE, meta::COMPOSER, meta::ALBUM_ARTIST });
     m_address = nullptr;
     m_port = 0;
 }
@@ -42,6 +47,12 @@ void mpd_source::reset_info()
     disconnect();
 }
 
+static void count_error()
+{
+    static auto* errors = metrics::get_counter("tuna_source_errors_total", "Errors reported by sources", "source", S_SOURCE_MPD);
+    errors->add();
+}
+
 void mpd_source::ensure_connection()
 {
     if (m_connection)
@@ -54,6 +65,7 @@ void mpd_source::ensure_connection()
         result = mpd_connection_new(qt_to_utf8(m_address), m_port, 1000);
 
     if (mpd_connection_get_error(result) != MPD_ERROR_SUCCESS) {
+        count_error();
         if (util::epoch() - m_last_error_log > 5) {
             if (m_local) {
                 berr("local mpd connection on default port (usually %i) failed with error '%s'", 6600,
@@ -125,6 +137,7 @@ void mpd_source::refresh()
         m_current.set<int>(meta::PROGRESS, ((int)mpd_status_get_elapsed_ms(status)));
         m_current.set<int>(meta::STATUS, from_mpd_state(new_state));
     } else {
+        count_error();
         if (util::epoch() - m_last_error_log > 5) {
             if (m_local) {
                 berr("local mpd connection on default port (usually %i) failed with error '%s'", 6600,
@@ -187,7 +200,7 @@ void mpd_source::refresh()
             auto file = util::file_from_path(file_path);
             m_current.set(meta::FILE_NAME, file);
             if (!title)
-                m_current.set(meta::TITLE, util::remove_extensions(file));
+                m_current.set(meta::TITLE, file);
         }
 
         m_current.set(meta::DURATION, (int)mpd_song_get_duration_ms(mpd_song));
@@ -196,12 +209,28 @@ void mpd_source::refresh()
         file_path.prepend(m_base_folder);
         m_song_file_path = file_path;
 
+        /* Read once per song together with everything the cover and lyrics
+         * need, so the song is complete on the first refresh and they don't
+         * open the file again */
+        if (m_song_file_path != m_tags_path) {
+            m_tags_path = m_song_file_path;
+            m_tags = tags::read(m_song_file_path, tag_parts());
+        }
+        if (auto const& t = m_tags) {
+            if (!t->genre.isEmpty())
+                m_current.set(meta::GENRE, t->genre);
+            if (!t->composer.isEmpty())
+                m_current.set(meta::COMPOSER, t->composer);
+            if (!t->album_artist.isEmpty())
+                m_current.set(meta::ALBUM_ARTIST, t->album_artist);
+        }
+
         /* The song url link is now used by the browser widget which requires
          * a proper url to embed it into the browser source, the actal
          * retrieval of the cover is done via m_song_file_path which checks
          * the song file for cover tags as well as the folder the file is in
          */
-        QString path = config::cover_path;
+        QString path = config::get()->cover_path;
 
         // Convert to proper file:// url
         path = '/' + path;
@@ -216,6 +245,18 @@ void mpd_source::refresh()
         mpd_status_free(status);
 }
 
+/* Everything that will be needed for this song is read in one go */
+uint32_t mpd_source::tag_parts() const
+{
+    uint32_t parts = tags::PART_META;
+    const auto cfg = config::get();
+    if (cfg->download_cover)
+        parts |= tags::PART_COVER;
+    if (cfg->download_lyrics)
+        parts |= tags::PART_LYRICS;
+    return parts;
+}
+
 void mpd_source::handle_cover()
 {
     if (m_current == m_prev)
@@ -224,7 +265,7 @@ void mpd_source::handle_cover()
     if (m_current.get<int>(meta::STATUS) == state_playing) {
         bool result = false;
         QString file_path = m_song_file_path, tmp;
-        if (cover::find_embedded_cover(file_path)) {
+        if (cover::find_embedded_cover(file_path, tag_parts())) {
             result = true;
         } else {
             cover::get_file_folder(file_path);
@@ -237,7 +278,7 @@ void mpd_source::handle_cover()
         }
         if (!result && !download_missing_cover())
             util::reset_cover();
-    } else if (m_current.get<int>(meta::STATUS) != state_paused || config::placeholder_when_paused) {
+    } else if (m_current.get<int>(meta::STATUS) != state_paused || config::get()->placeholder_when_paused) {
         /* We either
             - are in a stopped/unknown state                -> reset cover
             - are paused & want a placeholder when paused   -> reset cover
@@ -258,7 +299,7 @@ void mpd_source::handle_lyrics()
     if (m_current.get<int>(meta::STATUS) == state_playing) {
         bool result = false;
         QString file_path = m_song_file_path;
-        if (lyrics::find_embedded_lyrics(file_path)) {
+        if (lyrics::find_embedded_lyrics(file_path, tag_parts()) || lyrics::find_local_lyrics(file_path)) {
             result = true;
         }
         if (!result && !lyrics::download_missing_lyrics(m_current))
@@ -282,10 +323,10 @@ bool mpd_source::execute_capability(capability c)
         result = mpd_run_previous(m_connection);
         break;
     case CAP_VOLUME_UP:
-        result = mpd_run_change_volume(m_connection, 2);
+        result = mpd_run_change_volume(m_connection, VOLUME_STEP);
         break;
     case CAP_VOLUME_DOWN:
-        result = mpd_run_change_volume(m_connection, -2);
+        result = mpd_run_change_volume(m_connection, -VOLUME_STEP);
         break;
     case CAP_VOLUME_MUTE:
         result = mpd_run_set_volume(m_connection, 0);
@@ -305,3 +346,15 @@ bool mpd_source::execute_capability(capability c)
 
     return result;
 }
+
+bool mpd_source::execute_capability_repeated(capability c, int count)
+{
+    if (c != CAP_VOLUME_UP && c != CAP_VOLUME_DOWN)
+        return music_source::execute_capability_repeated(c, count);
+
+    /* One request for all presses instead of one per press */
+    ensure_connection();
+    if (!m_connection)
+        return false;
+    return mpd_run_change_volume(m_connection, (c == CAP_VOLUME_UP ? VOLUME_STEP : -VOLUME_STEP) * count);
+}
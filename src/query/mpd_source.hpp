@@ -18,6 +18,7 @@
 
 #pragma once
 #include "../util/constants.hpp"
+#include "../util/tag_reader.hpp"
 #include "music_source.hpp"
 
 #include <mpd/client.h>
@@ -27,6 +28,9 @@ class mpd_source : public music_source {
     QString m_address;
     QString m_base_folder;
     QString m_song_file_path;
+    /* Tags of m_tags_path, only read again once the song file changes */
+    QString m_tags_path;
+    std::shared_ptr<const tags::file_tags> m_tags;
     uint16_t m_port;
     bool m_local;
     mpd_connection* m_connection {};
@@ -39,6 +43,7 @@ public:
     void load() override;
     void refresh() override;
     bool execute_capability(capability c) override;
+    bool execute_capability_repeated(capability c, int count) override;
     bool enabled() const override;
     void handle_cover() override;
     void handle_lyrics() override;
@@ -46,6 +51,7 @@ public:
 
 private:
     void ensure_connection();
+    uint32_t tag_parts() const;
 
     void close_connection()
     {
@@ -20,12 +20,15 @@
 #include "../gui/music_control.hpp"
 #include "../gui/tuna_gui.hpp"
 #include "../util/config.hpp"
+#include "../util/format.hpp"
 #include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include "gpmdp_source.hpp"
 #include "icecast_source.hpp"
 #include "lastfm_source.hpp"
 #include "mpd_source.hpp"
+#include "replay_source.hpp"
+#include "source_worker.hpp"
 #if WITH_DBUS
 #    include "mpris_source.hpp"
 #endif
@@ -47,11 +50,20 @@
 
 namespace music_sources {
 static std::atomic<int> selected_index = -1;
+static std::atomic<int> active_index = -1;
 QList<std::shared_ptr<music_source>> instances;
+static std::vector<std::unique_ptr<source_worker>> workers;
+
+static bool active_provides_metadata(std::vector<meta::type> const& fields)
+{
+    auto src = active_source();
+    return !src || src->provides_metadata(fields);
+}
 
 void init()
 {
     obs_frontend_push_ui_translation(obs_module_get_string);
+    format::set_metadata_check(active_provides_metadata);
     instances.append(std::make_shared<spotify_source>());
     instances.append(std::make_shared<mpd_source>());
     instances.append(std::make_shared<vlc_obs_source>());
@@ -68,6 +80,7 @@ void init()
     //    instances.append(std::make_shared<gpmdp_source>()); // Deprecated, Youtube music can send information to tuna
     instances.append(std::make_shared<web_source>());
     instances.append(std::make_shared<icecast_source>());
+    instances.append(std::make_shared<replay_source>());
 
 #if WITH_DBUS
     instances.append(std::make_shared<mpris_source>());
@@ -79,6 +92,8 @@ void init()
     obs_frontend_pop_ui_translation();
 
     for (auto& s : instances) {
+        workers.emplace_back(new source_worker(s));
+        workers.back()->start();
         //        s->load(); // Config loading already calls this
         tuna_dialog->add_source(utf8_to_qt(s->name()), utf8_to_qt(s->id()), s->get_settings_tab());
         if (music_dock)
@@ -109,14 +124,43 @@ void init()
 
 void load()
 {
-    for (auto& src : instances)
-        src->load();
+    /* The settings tabs live on the UI thread, the sources read
+     * their config on their worker */
+    for (auto& src : instances) {
+        src->set_gui_values();
+        post(src, [src] { src->load(); });
+    }
 }
 
 void save()
 {
-    for (auto& src : instances)
-        src->save();
+    for (auto& src : instances) {
+        if (auto* tab = src->get_settings_tab())
+            tab->save_settings();
+        post(src, [src] { src->save(); });
+    }
+}
+
+source_worker* worker(music_source const* src)
+{
+    for (auto const& w : workers) {
+        if (w->source().get() == src)
+            return w.get();
+    }
+    return nullptr;
+}
+
+void post(std::shared_ptr<music_source> const& src, std::function<void()> command)
+{
+    if (auto* w = src ? worker(src.get()) : nullptr)
+        w->post(std::move(command));
+}
+
+void execute_capability(capability c)
+{
+    auto src = active_source();
+    if (auto* w = src ? worker(src.get()) : nullptr)
+        w->post_capability(c);
 }
 
 void select(const char* id)
@@ -128,8 +172,6 @@ void select(const char* id)
     if (selected && strcmp(selected->id(), id) == 0)
         return;
 
-    if (selected)
-        selected->reset_info();
     int i = 0;
     for (const auto& src : std::as_const(instances)) {
         if (strcmp(src->id(), id) == 0) {
@@ -139,8 +181,11 @@ void select(const char* id)
         i++;
     }
 
-    /* Ensure that cover is set to place holder on switch */
-    util::reset_cover();
+    /* The query thread stops the worker of the previous source, which
+     * resets its information, and picks the new one up right away */
+    tuna_thread::wake();
+    if (music_dock)
+        music_dock->notify();
 }
 
 void set_gui_values()
@@ -157,8 +202,44 @@ std::shared_ptr<music_source> selected_source()
     return nullptr;
 }
 
+QList<std::shared_ptr<music_source>> fallback_chain()
+{
+    QList<std::shared_ptr<music_source>> chain;
+    auto selected = selected_source();
+    if (selected)
+        chain.append(selected);
+
+    const auto cfg = config::get();
+    if (cfg->fallback_enabled) {
+        for (auto const& id : std::as_const(cfg->fallback_sources)) {
+            auto src = get<music_source>(qt_to_utf8(id));
+            if (src && src != selected && src->enabled())
+                chain.append(src);
+        }
+    }
+    return chain;
+}
+
+std::shared_ptr<music_source> active_source()
+{
+    int index = active_index;
+    if (index >= 0)
+        return instances[index];
+    return selected_source();
+}
+
+void set_active(std::shared_ptr<music_source> const& src)
+{
+    active_index = src ? int(instances.indexOf(src)) : -1;
+}
+
 void deinit()
 {
+    /* Workers hold a reference to their source */
+    for (auto& w : workers)
+        w->stop();
+    workers.clear();
+
     /* check if all source references were decreased correctly */
     for (int i = 0; i < instances.count(); i++) {
         if (instances[i].use_count() > 1) {
@@ -173,13 +254,13 @@ void deinit()
 
 bool music_source::download_missing_cover()
 {
-    static const QString request = "https://itunes.apple.com/search?term={}&media=music&entity=album"; // should we also look for singles?
-    if (config::download_missing_cover && m_current.has_cover_lookup_information()) {
+    const auto cfg = config::get();
+    if (cfg->download_missing_cover && m_current.has_cover_lookup_information()) {
         auto artists = m_current.get<QStringList>(meta::ARTIST);
         auto search_term = QUrl::toPercentEncoding(artists[0] + " " + m_current.get(meta::ALBUM));
-        auto url = request;
-        url = url.replace("{}", search_term);
-        auto doc = util::curl_get_json(qt_to_utf8(url));
+        // should we also look for singles?
+        auto url = cfg->itunes_search_url + "?term=" + QString::fromUtf8(search_term) + "&media=music&entity=album";
+        auto doc = util::curl_get_json(qt_to_utf8(url), "itunes");
         if (doc["results"].isArray()) {
             if (doc["results"].toArray().isEmpty())
                 return false;
@@ -194,7 +275,7 @@ bool music_source::download_missing_cover()
             }
             if (first["artworkUrl60"].isString()) {
                 auto url2 = first["artworkUrl60"].toString();
-                url2 = url2.replace("60x60", QString::number(config::cover_size) + "x" + QString::number(config::cover_size));
+                url2 = url2.replace("60x60", QString::number(cfg->cover_size) + "x" + QString::number(cfg->cover_size));
                 return util::download_cover(url2);
             }
         }
@@ -211,14 +292,10 @@ music_source::music_source(const char* id, const char* name, source_widget* w)
 
 void music_source::load()
 {
-    if (m_settings_tab)
-        m_settings_tab->load_settings();
 }
 
 void music_source::save()
 {
-    if (m_settings_tab)
-        m_settings_tab->save_settings();
 }
 
 void music_source::set_gui_values()
@@ -237,7 +314,7 @@ void music_source::handle_cover()
             if (!download_missing_cover())
                 util::reset_cover();
         }
-    } else if (m_current.get<int>(meta::STATUS) != state_paused || config::placeholder_when_paused) {
+    } else if (m_current.get<int>(meta::STATUS) != state_paused || config::get()->placeholder_when_paused) {
         /* We either
             - are in a stopped/unknown state                -> reset cover
             - are paused & want a placeholder when paused   -> reset cover
@@ -22,6 +22,7 @@
 #include <QDate>
 #include <QObject>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -78,6 +79,8 @@ public:
     bool has_capability(capability c) const { return m_capabilities & ((uint16_t)c); }
 
     const song& song_info() const { return m_current; }
+    /* Makes the next cover/lyrics handling behave as if the song changed */
+    void force_update() { m_prev.clear(); }
     virtual void reset_info()
     {
         m_current.clear();
@@ -88,13 +91,27 @@ public:
 
     /* Abstract stuff */
     virtual bool enabled() const = 0;
-    /* Save/load config values */
+    /* Save/load config values, called on the worker of the source. The
+     * settings tab is synced separately on the UI thread */
     virtual void load();
     virtual void save();
     /* Perform information query */
     virtual void refresh() = 0;
     /* Execute and return true if successful */
     virtual bool execute_capability(capability c) = 0;
+    /* Executes a capability that was requested count times in a row, sources
+     * can override this to apply e.g. repeated volume changes at once */
+    virtual bool execute_capability_repeated(capability c, int count)
+    {
+        bool result = true;
+        for (int i = 0; i < count && result; i++)
+            result = execute_capability(c);
+        return result;
+    }
+    /* True if executing the capability twice undoes it, so that two queued
+     * presses can cancel each other out. Called from any thread, so it must
+     * not depend on the state of the source */
+    virtual bool is_toggle(capability) const { return false; }
     virtual void set_gui_values();
     virtual void handle_cover();
     virtual void handle_lyrics()
@@ -115,6 +132,8 @@ public:
     virtual void post_refresh();
 };
 
+class source_worker;
+
 namespace music_sources {
 extern QList<std::shared_ptr<music_source>> instances;
 extern void init();
@@ -125,6 +144,19 @@ extern void deinit();
 extern void select(const char* id);
 extern std::shared_ptr<music_source> selected_source();
 
+/* The selected source followed by the enabled fallback sources, ordered by priority */
+extern QList<std::shared_ptr<music_source>> fallback_chain();
+/* The source whose information is currently shown, this is the selected
+ * source unless a fallback source took over */
+extern std::shared_ptr<music_source> active_source();
+extern void set_active(std::shared_ptr<music_source> const& src);
+
+extern source_worker* worker(music_source const* src);
+/* Runs the command on the worker of the source, the caller doesn't wait for it */
+extern void post(std::shared_ptr<music_source> const& src, std::function<void()> command);
+/* Queues the capability on the shown source, repeated presses are merged */
+extern void execute_capability(capability c);
+
 template<class T>
 std::shared_ptr<T> get(const char* id)
 {
@@ -0,0 +1,140 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "replay_source.hpp"
+#include "../gui/widgets/replay.hpp"
+#include "../util/config.hpp"
+#include "../util/utility.hpp"
+#include "source_worker.hpp"
+#include <algorithm>
+#include <util/platform.h>
+
+replay_source::replay_source()
+    : music_source(S_SOURCE_REPLAY, T_SOURCE_REPLAY, new replay)
+{
+    /* Whatever the recorded source provided */
+    for (int i = meta::NONE + 1; i < meta::COUNT; i++)
+        m_supported_metadata[i] = true;
+    m_capabilities = CAP_PLAY_PAUSE | CAP_NEXT_SONG | CAP_PREV_SONG | CAP_STOP_SONG;
+}
+
+void replay_source::load()
+{
+    music_source::load();
+    CDEF_STR(CFG_REPLAY_FILE, "");
+    CDEF_DOUBLE(CFG_REPLAY_SPEED, 1.);
+    CDEF_BOOL(CFG_REPLAY_LOOP, true);
+
+    auto file = utf8_to_qt(CGET_STR(CFG_REPLAY_FILE));
+    m_speed = std::max(0.01, CGET_DOUBLE(CFG_REPLAY_SPEED));
+    m_loop = CGET_BOOL(CFG_REPLAY_LOOP);
+
+    if (file == m_file)
+        return;
+    m_file = file;
+    m_entries.clear();
+    if (!m_file.isEmpty() && recorder::read(m_file, m_entries)) {
+        /* Only the first source of the recording is played back, fallback
+         * sources would otherwise flip the song back and forth */
+        if (!m_entries.empty()) {
+            const auto id = m_entries.front().source;
+            m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), [&id](auto const& e) { return e.source != id; }), m_entries.end());
+            binfo("Loaded %i songs from %s recorded with source %s", int(m_entries.size()), qt_to_utf8(m_file), qt_to_utf8(id));
+        }
+    }
+    seek(0);
+}
+
+void replay_source::seek(size_t index)
+{
+    m_index = std::min(index, m_entries.empty() ? 0 : m_entries.size() - 1);
+    m_position = m_entries.empty() ? 0. : double(m_entries[m_index].time);
+}
+
+void replay_source::refresh()
+{
+    begin_refresh();
+    const auto now = os_gettime_ns();
+    if (m_last_refresh && !m_paused)
+        m_position += double(now - m_last_refresh) / 1000000. * m_speed;
+    m_last_refresh = now;
+
+    m_current.clear();
+    if (m_entries.empty())
+        return;
+
+    if (m_position > m_entries.back().time) {
+        /* The last song is held for a second of recording time before looping */
+        if (m_loop && m_position > m_entries.back().time + 1000.)
+            seek(0);
+    }
+    /* Every entry goes through the pipeline, even if several of them were
+     * due since the last refresh, so the worker refreshes again right away
+     * until the replay caught up */
+    if (m_index + 1 < m_entries.size() && m_entries[m_index + 1].time <= m_position) {
+        m_index++;
+        if (m_index + 1 < m_entries.size() && m_entries[m_index + 1].time <= m_position) {
+            if (auto* w = music_sources::worker(this))
+                w->wake();
+        }
+    }
+
+    auto const& e = m_entries[m_index];
+    m_current.set_data(e.data);
+
+    /* Entries are only recorded on changes, in between the position is
+     * extrapolated like a player would do it */
+    if (m_current.get<int>(meta::STATUS) == state_playing && m_current.has(meta::PROGRESS)) {
+        auto progress = m_current.get<int>(meta::PROGRESS) + int(m_position - e.time);
+        if (m_current.has(meta::DURATION))
+            progress = std::min(progress, m_current.get<int>(meta::DURATION));
+        m_current.set(meta::PROGRESS, progress);
+    }
+    if (m_paused && m_current.get<int>(meta::STATUS) == state_playing)
+        m_current.set(meta::STATUS, state_paused);
+}
+
+void replay_source::reset_info()
+{
+    music_source::reset_info();
+    /* Continue where it was once the source is used again, instead of
+     * skipping the time it wasn't queried */
+    m_last_refresh = 0;
+}
+
+bool replay_source::execute_capability(capability c)
+{
+    switch (c) {
+    case CAP_PLAY_PAUSE:
+        m_paused = !m_paused;
+        break;
+    case CAP_NEXT_SONG:
+        seek(m_index + 1);
+        break;
+    case CAP_PREV_SONG:
+        seek(m_index > 0 ? m_index - 1 : 0);
+        break;
+    case CAP_STOP_SONG:
+        seek(0);
+        m_paused = true;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
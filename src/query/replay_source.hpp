@@ -0,0 +1,48 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include "../util/constants.hpp"
+#include "../util/recorder.hpp"
+#include "music_source.hpp"
+
+/* Plays back a recording made with the recorder through the normal pipeline,
+ * either in real time or faster to put load on the outputs and sources */
+class replay_source : public music_source {
+    QString m_file {};
+    double m_speed = 1.;
+    bool m_loop = true;
+
+    std::vector<recorder::entry> m_entries;
+    size_t m_index = 0;
+    double m_position = 0.; /* ms into the recording */
+    uint64_t m_last_refresh = 0;
+    bool m_paused = false;
+
+    void seek(size_t index);
+
+public:
+    replay_source();
+
+    void load() override;
+    void refresh() override;
+    void reset_info() override;
+    bool execute_capability(capability c) override;
+    bool is_toggle(capability c) const override { return c == CAP_PLAY_PAUSE; }
+    bool enabled() const override { return true; }
+};
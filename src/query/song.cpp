@@ -19,11 +19,23 @@
 #include "song.hpp"
 #include "../util/config.hpp"
 #include "../util/format.hpp"
-#include "music_source.hpp"
+#include <QDateTime>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QLocale>
+#include <algorithm>
+#include <util/platform.h>
+
+/* Reported positions closer than this to the predicted one don't move the clock */
+#define CLOCK_TOLERANCE_MS 1000
+
+int32_t playback_clock::at(uint64_t now) const
+{
+    if (!valid() || now <= timestamp)
+        return position;
+    return position + int32_t(double(now - timestamp) / 1000000.0 * rate);
+}
 
 song::song()
 {
@@ -37,6 +49,33 @@ void song::clear()
     set(meta::LYRICS, QString("n/a"));
     set(meta::STATUS, state_unknown);
     m_release_precision = prec_unknown;
+    m_clock = {};
+}
+
+void song::update_clock(song const& prev, uint64_t timestamp)
+{
+    playback_clock c;
+    if (has(meta::PROGRESS)) {
+        c.position = get<int>(meta::PROGRESS);
+        c.timestamp = timestamp;
+        c.rate = get<int>(meta::STATUS) == state_playing ? 1.f : 0.f;
+
+        auto const& p = prev.m_clock;
+        const bool same_song = get(meta::TITLE) == prev.get(meta::TITLE) && get<int>(meta::DURATION) == prev.get<int>(meta::DURATION);
+        if (same_song && p.valid() && p.rate == c.rate && abs(p.at(timestamp) - c.position) < CLOCK_TOLERANCE_MS)
+            c = p;
+    }
+    m_clock = c;
+}
+
+int32_t song::progress_now() const
+{
+    if (!m_clock.valid())
+        return get<int>(meta::PROGRESS);
+    auto progress = m_clock.at(os_gettime_ns());
+    if (has(meta::DURATION))
+        progress = std::min(progress, get<int>(meta::DURATION));
+    return std::max(progress, 0);
 }
 
 bool song::has_cover_lookup_information() const
@@ -47,6 +86,12 @@ bool song::has_cover_lookup_information() const
     return has_meta && !artists.isEmpty() && !album.isEmpty();
 }
 
+void song::set_data(QJsonObject const& data)
+{
+    m_data = data;
+    update_release_precision();
+}
+
 void song::update_release_precision()
 {
     auto day = has(meta::RELEASE_DAY);
@@ -70,6 +115,15 @@ void song::update_release_precision()
     }
 }
 
+bool song::same_fields(const song& other, std::vector<meta::type> const& fields) const
+{
+    for (auto id : fields) {
+        if (m_data.value(meta::ids[id]) != other.m_data.value(meta::ids[id]))
+            return false;
+    }
+    return true;
+}
+
 bool song::operator==(const song& other) const
 {
     /* basically compare all data that shouldn't change in between
@@ -110,12 +164,26 @@ void song::to_json(QJsonObject& obj) const
     }
     obj["status"] = status;
 
-    if (config::remove_file_extensions)
-        obj["title"] = util::remove_extensions(obj["title"].toString());
+    /* Position at progress_timestamp (ms since epoch), overlays can add
+     * (now - progress_timestamp) * rate to get the current position */
+    if (m_clock.valid()) {
+        auto age = int64_t((os_gettime_ns() - m_clock.timestamp) / 1000000);
+        obj["progress"] = m_clock.position;
+        obj["progress_timestamp"] = double(QDateTime::currentMSecsSinceEpoch() - age);
+        obj["rate"] = m_clock.rate;
+    }
 
     if (has(meta::COVER)) {
         // Just points to the /cover.png end point
-        obj["cover_url"] = QString("http://localhost:%1/cover.png").arg(QString::number(config::webserver_port));
+        obj["cover_url"] = QString("http://localhost:%1/cover.png").arg(QString::number(config::get()->webserver_port));
+
+        /* Picked once when the cover was set */
+        auto cover = util::get_cover();
+        if (cover && cover->palette.valid) {
+            QJsonObject colors;
+            cover->palette.to_json(colors);
+            obj["cover_colors"] = colors;
+        }
     }
 
     // Technically deprecated, because the json object
@@ -24,6 +24,7 @@
 #include <QString>
 #include <QVariant>
 #include <array>
+#include <vector>
 #include <stdint.h>
 
 class QJsonObject;
@@ -92,6 +93,15 @@ static const char* ids[] = {
     "context_external_url",
     "playlist_name",
 
+    /* IceCast specific */
+    "listeners",
+
+    /* File tags */
+    "composer",
+
+    /* Normalization */
+    "original_title",
+
     "count"
 };
 
@@ -148,14 +158,36 @@ enum type : uint8_t {
     CONTEXT_EXTERNAL_URL,
     PLAYLIST_NAME,
 
+    /* IceCast specific */
+    LISTENERS,
+
+    /* File tags */
+    COMPOSER,
+
+    /* Normalization */
+    ORIGINAL_TITLE,
+
     COUNT
 };
 static_assert(sizeof(ids) / sizeof(char*) - 1 == COUNT, "");
 }
 
+/* Playback position as a linear model, which consumers can extrapolate
+ * on their own instead of relying on how often the source is polled */
+struct playback_clock {
+    int32_t position = 0; /* ms, at the time of timestamp */
+    uint64_t timestamp = 0; /* os_gettime_ns(), zero if the position is unknown */
+    float rate = 0.f; /* 1 while playing, 0 otherwise */
+
+    bool valid() const { return timestamp != 0; }
+    /* Extrapolated position in ms */
+    int32_t at(uint64_t now) const;
+};
+
 class song {
     date_precision m_release_precision;
     QJsonObject m_data;
+    playback_clock m_clock;
 
 public:
     song();
@@ -185,8 +217,21 @@ public:
     bool is(meta::type id) const;
 
     QJsonObject const& data() const { return m_data; }
+    /* Replaces all meta data, e.g. with what a source reported earlier */
+    void set_data(QJsonObject const& data);
+
+    playback_clock const& clock() const { return m_clock; }
+    /* Turns the progress reported by the source into a playback clock. If the
+     * report is close to what the previous clock predicts, the previous one
+     * is kept so that polling jitter doesn't make the position jump around */
+    void update_clock(song const& prev, uint64_t timestamp);
+    /* Current position in ms according to the clock, limited to the duration */
+    int32_t progress_now() const;
     date_precision release_precision() const { return m_release_precision; }
 
+    /* Compares only the given meta data */
+    bool same_fields(const song& other, std::vector<meta::type> const& fields) const;
+
     bool operator==(const song& other) const;
     bool operator!=(const song& other) const;
 
@@ -0,0 +1,321 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#include "source_worker.hpp"
+#include "../util/config.hpp"
+#include "../util/metrics.hpp"
+#include "../util/constants.hpp"
+#include "../util/normalizer.hpp"
+#include "../util/recorder.hpp"
+#include "../util/trace.hpp"
+#include "../util/tuna_thread.hpp"
+#include "../util/utility.hpp"
+#include "music_source.hpp"
+#include <algorithm>
+#include <cstring>
+#include <util/platform.h>
+
+/* Players usually take a moment to apply a command, so a second refresh
+ * follows the one that's done right after executing it */
+#define SETTLE_REFRESH_MS 300
+
+source_worker::source_worker(std::shared_ptr<music_source> source)
+    : m_source(std::move(source))
+{
+    const QString id = m_source->id();
+    m_refresh_time = metrics::get_histogram("tuna_source_refresh_seconds", "Duration of source refreshes", "source", id);
+    m_cover_time = metrics::get_histogram("tuna_cover_seconds", "Duration of cover handling", "source", id);
+    m_lyrics_time = metrics::get_histogram("tuna_lyrics_seconds", "Duration of lyrics handling", "source", id);
+}
+
+void source_worker::start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running)
+        return;
+    m_running = true;
+    m_thread = std::thread(&source_worker::run, this);
+}
+
+void source_worker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+
+    /* Commands that didn't run yet (e.g. saving renewed tokens on shutdown)
+     * must not be lost. The worker is gone, so they run on the caller, only
+     * capabilities are dropped since there's nobody left to see the result */
+    std::deque<command> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending.swap(m_commands);
+    }
+    for (auto& c : pending) {
+        if (c.count == 0 && c.run)
+            c.run();
+    }
+}
+
+void source_worker::post(std::function<void()> command)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_commands.push_back({ std::move(command) });
+    }
+    m_cv.notify_all();
+}
+
+/* Returns true if c was merged into the queued capability */
+static bool merge_capability(capability queued, int& count, capability c, bool toggle)
+{
+    switch (c) {
+    case CAP_VOLUME_UP:
+    case CAP_VOLUME_DOWN:
+        if (queued == c)
+            count++;
+        else if (queued == (c == CAP_VOLUME_UP ? CAP_VOLUME_DOWN : CAP_VOLUME_UP))
+            count--;
+        else
+            return false;
+        return true;
+    case CAP_NEXT_SONG:
+    case CAP_PREV_SONG:
+        if (queued != c)
+            return false;
+        count++;
+        return true;
+    case CAP_PLAY_PAUSE:
+    case CAP_VOLUME_MUTE:
+        if (queued != c)
+            return false;
+        /* Toggling twice changes nothing, otherwise running it once is enough */
+        if (toggle)
+            count--;
+        return true;
+    case CAP_STOP_SONG:
+        return queued == c;
+    default:
+        return false;
+    }
+}
+
+void source_worker::post_capability(capability c)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_commands.empty() && m_commands.back().count > 0) {
+            auto& queued = m_commands.back();
+            if (merge_capability(queued.cap, queued.count, c, m_source->is_toggle(c))) {
+                if (queued.count == 0)
+                    m_commands.pop_back();
+                return;
+            }
+        }
+        m_commands.push_back({ {}, c, 1 });
+    }
+    m_cv.notify_all();
+}
+
+void source_worker::set_probing(bool probing)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_probing == probing)
+            return;
+        m_probing = probing;
+        m_wake = probing;
+        m_has_snapshot = false;
+    }
+    m_cv.notify_all();
+
+    /* The source is no longer queried, so its information is outdated */
+    if (!probing) {
+        m_active = false;
+        post([this] { m_source->reset_info(); });
+    }
+}
+
+bool source_worker::probing()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_probing;
+}
+
+void source_worker::wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wake = true;
+    }
+    m_cv.notify_all();
+}
+
+void source_worker::set_active(bool active)
+{
+    if (m_active.exchange(active) == active)
+        return;
+    if (active) {
+        /* Cover and lyrics of the new source have to be fetched even if
+         * its song didn't change since the last refresh */
+        m_activated = true;
+        wake();
+    }
+}
+
+bool source_worker::snapshot(song& out)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_has_snapshot)
+        out = m_snapshot;
+    return m_has_snapshot;
+}
+
+void source_worker::normalize(song& s)
+{
+    auto engine = config::get()->normalizer;
+    if (!engine)
+        return;
+
+    const auto title = s.get(meta::TITLE);
+    const auto artists = s.get<QStringList>(meta::ARTIST);
+    auto& n = m_normalized;
+    if (engine != n.engine || title != n.raw_title || artists != n.raw_artists) {
+        n = { engine, title, artists, title, artists };
+        engine->apply(n.title, n.artists);
+    }
+
+    if (s.has(meta::TITLE) && n.title != title) {
+        s.set(meta::ORIGINAL_TITLE, title);
+        s.set(meta::TITLE, n.title);
+    }
+    if (n.artists != artists)
+        s.set(meta::ARTIST, n.artists);
+}
+
+void source_worker::refresh()
+{
+    const uint64_t start = os_gettime_ns();
+    {
+        TRACE_SCOPE("refresh");
+        m_source->refresh();
+    }
+    {
+        TRACE_SCOPE("post_refresh");
+        m_source->post_refresh();
+    }
+    const uint64_t end = os_gettime_ns();
+    m_refresh_time->observe(end - start);
+    auto s = m_source->song_info();
+    const auto raw = s;
+    normalize(s);
+
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        /* Probing might have been disabled while the refresh was running */
+        if (m_probing) {
+            /* The position was most likely taken halfway through the request */
+            s.update_clock(m_has_snapshot ? m_snapshot : song(), start + (end - start) / 2);
+            /* A new clock anchor means the user seeked */
+            changed = !m_has_snapshot || m_snapshot != s || m_snapshot.clock().timestamp != s.clock().timestamp;
+            m_snapshot = s;
+            m_has_snapshot = true;
+        }
+    }
+
+    /* Let the query thread know right away instead of waiting for its next cycle */
+    if (changed) {
+        tuna_thread::wake();
+        /* Recorded as reported, the replay normalizes it again. Replays
+         * aren't recorded, that would only duplicate the recording */
+        if (recorder::active() && strcmp(m_source->id(), S_SOURCE_REPLAY) != 0)
+            recorder::record(m_source->id(), raw, start + (end - start) / 2);
+    }
+
+    if (m_active) {
+        if (m_activated.exchange(false))
+            m_source->force_update();
+        const auto cfg = config::get();
+        if (cfg->download_cover) {
+            metrics::timer t(m_cover_time);
+            TRACE_SCOPE("handle_cover");
+            m_source->handle_cover();
+        }
+        if (cfg->download_lyrics) {
+            metrics::timer t(m_lyrics_time);
+            TRACE_SCOPE("handle_lyrics");
+            m_source->handle_lyrics();
+        }
+    }
+}
+
+void source_worker::run()
+{
+    util::set_thread_name("tuna-source");
+    bdebug("Started worker for source %s", m_source->id());
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        /* Commands come first, they were usually triggered by the user */
+        if (!m_commands.empty()) {
+            auto command = std::move(m_commands.front());
+            m_commands.pop_front();
+            lock.unlock();
+            if (command.count > 0) {
+                m_source->execute_capability_repeated(command.cap, command.count);
+            } else {
+                command.run();
+            }
+            lock.lock();
+
+            /* Show the result of the command as soon as possible */
+            if (command.count > 0) {
+                m_wake = true;
+                m_settling = true;
+            }
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (m_probing && (m_wake || now >= m_next_refresh)) {
+            m_wake = false;
+            lock.unlock();
+            refresh();
+            lock.lock();
+            auto interval = int(config::get()->refresh_rate);
+            if (m_settling)
+                interval = std::min(interval, SETTLE_REFRESH_MS);
+            m_settling = false;
+            m_next_refresh = now + std::chrono::milliseconds(interval);
+            continue;
+        }
+
+        auto ready = [this] { return !m_running || !m_commands.empty() || m_wake; };
+        if (m_probing)
+            m_cv.wait_until(lock, m_next_refresh, ready);
+        else
+            m_cv.wait(lock, [this, &ready] { return ready() || m_probing; });
+    }
+    bdebug("Stopped worker for source %s", m_source->id());
+}
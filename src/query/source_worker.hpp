@@ -0,0 +1,121 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#pragma once
+#include "song.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class music_source;
+enum capability : uint32_t;
+namespace normalize {
+class engine;
+}
+namespace metrics {
+class histogram;
+}
+
+/* Every source has one worker, which is the only thread that touches the
+ * source's state. Refreshes, capabilities and config changes are queued as
+ * commands and run one after another, so no lock is needed around the source
+ * and whoever posts a command never waits for a slow refresh to finish.
+ * While the source is part of the fallback chain the worker also refreshes it
+ * periodically and keeps the latest result around for the query thread */
+class source_worker {
+    struct command {
+        std::function<void()> run;
+        /* Capabilities are kept apart so that repeated presses can be merged */
+        capability cap {};
+        int count = 0;
+    };
+
+    std::shared_ptr<music_source> m_source;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    /* Guarded by m_mutex */
+    std::deque<command> m_commands;
+    bool m_running = false;
+    bool m_probing = false;
+    bool m_wake = false;
+    bool m_settling = false;
+    std::chrono::steady_clock::time_point m_next_refresh {};
+    song m_snapshot;
+    bool m_has_snapshot = false;
+
+    /* Only the source that is shown handles cover and lyrics */
+    std::atomic<bool> m_active { false };
+    std::atomic<bool> m_activated { false };
+
+    /* Result for the last title and artists, so the rules only run if the
+     * track or the rules change. Only used on the worker thread */
+    struct normalized {
+        std::shared_ptr<const normalize::engine> engine;
+        QString raw_title;
+        QStringList raw_artists;
+        QString title;
+        QStringList artists;
+    } m_normalized {};
+
+    metrics::histogram* m_refresh_time = nullptr;
+    metrics::histogram* m_cover_time = nullptr;
+    metrics::histogram* m_lyrics_time = nullptr;
+
+    void run();
+    void refresh();
+    void normalize(song& s);
+
+public:
+    explicit source_worker(std::shared_ptr<music_source> source);
+    ~source_worker() { stop(); }
+
+    void start();
+    void stop();
+
+    /* Queues a command, which runs on the worker thread in between refreshes */
+    void post(std::function<void()> command);
+    /* Queues a capability, if the previous queued command is the same
+     * capability both are merged, e.g. five volume up presses turn into one
+     * change of five steps and two play/pause toggles cancel each other out if
+     * the source executes them as a toggle.
+     * The source is refreshed right after the capability was executed */
+    void post_capability(capability c);
+
+    /* Periodically refresh the source, disabling it resets the source's information */
+    void set_probing(bool probing);
+    bool probing();
+
+    /* Refresh right away instead of waiting for the next interval */
+    void wake();
+    void set_active(bool active);
+    bool active() const { return m_active; }
+
+    /* Returns false if the source hasn't been refreshed since probing started */
+    bool snapshot(song& out);
+
+    std::shared_ptr<music_source> const& source() const { return m_source; }
+};
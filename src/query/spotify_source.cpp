@@ -30,20 +30,25 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QString>
+#include <algorithm>
 #include <curl/curl.h>
 #include <util/config-file.h>
 #include <util/platform.h>
 
 #define TOKEN_URL "https://accounts.spotify.com/api/token"
-#define PLAYER_URL "https://api.spotify.com/v1/me/player"
-#define PLAYER_PAUSE_URL (PLAYER_URL "/pause")
-#define PLAYER_PLAY_URL (PLAYER_URL "/play")
-#define PLAYER_NEXT_URL (PLAYER_URL "/next")
-#define PLAYER_PREVIOUS_URL (PLAYER_URL "/previous")
-#define PLAYER_VOLUME_URL (PLAYER_URL "/volume")
+#define API_URL "https://api.spotify.com/v1"
 #define CURL_DEBUG 0L
 #define REDIRECT_URI "https%3A%2F%2Funivrsal.github.io%2Fauth%2Ftoken"
 
+/* Renew the token this many seconds before it actually expires, but at
+ * most half of its lifetime before, so that short lived tokens don't
+ * get renewed in a loop */
+#define TOKEN_RENEW_MARGIN 300
+/* Minimum time between two renewal attempts in seconds */
+#define TOKEN_RENEW_MIN_DELAY 10
+/* Upper limit for the delay between failed renewal attempts in seconds */
+#define TOKEN_RETRY_MAX 600
+
 spotify_source::spotify_source()
     : music_source(S_SOURCE_SPOTIFY, T_SOURCE_SPOTIFY, new spotify)
 {
@@ -62,6 +67,7 @@ void spotify_source::build_credentials()
     auto client_id = utf8_to_qt(CGET_STR(CFG_SPOTIFY_CLIENT_ID));
     auto client_secret = utf8_to_qt(CGET_STR(CFG_SPOTIFY_CLIENT_SECRET));
 
+    std::lock_guard<std::mutex> lock(m_token_mutex);
     if (!client_id.isEmpty() && !client_secret.isEmpty()) {
         m_creds = (client_id + ":" + client_secret).toUtf8().toBase64();
     } else {
@@ -81,31 +87,116 @@ void spotify_source::load()
     CDEF_STR(CFG_SPOTIFY_CLIENT_ID, "");
     CDEF_STR(CFG_SPOTIFY_CLIENT_SECRET, "");
     CDEF_INT(CFG_SPOTIFY_REQUEST_TIMEOUT, 1000);
-
+    CDEF_STR(CFG_SPOTIFY_TOKEN_URL, TOKEN_URL);
+    CDEF_STR(CFG_SPOTIFY_API_URL, API_URL);
+
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        m_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_TOKEN));
+        m_refresh_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_REFRESH_TOKEN));
+        m_auth_code = utf8_to_qt(CGET_STR(CFG_SPOTIFY_AUTH_CODE));
+        m_token_url = utf8_to_qt(CGET_STR(CFG_SPOTIFY_TOKEN_URL));
+    }
     m_logged_in = CGET_BOOL(CFG_SPOTIFY_LOGGEDIN);
-    m_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_TOKEN));
-    m_refresh_token = utf8_to_qt(CGET_STR(CFG_SPOTIFY_REFRESH_TOKEN));
-    m_auth_code = utf8_to_qt(CGET_STR(CFG_SPOTIFY_AUTH_CODE));
     m_token_termination = CGET_INT(CFG_SPOTIFY_TOKEN_TERMINATION);
     m_curl_timeout_ms = CGET_INT(CFG_SPOTIFY_REQUEST_TIMEOUT);
+    auto api_url = utf8_to_qt(CGET_STR(CFG_SPOTIFY_API_URL));
+    while (api_url.endsWith('/'))
+        api_url.chop(1);
+    m_player_url = (api_url + "/me/player").toStdString();
 
     build_credentials();
     music_source::load();
 
-    /* Token handling */
-    if (m_logged_in) {
-        if (util::epoch() > m_token_termination) {
-            binfo("Refreshing Spotify token");
-            QString log;
-            const auto result = do_refresh_token(log);
-            if (result)
-                binfo("Successfully renewed Spotify token");
-            save();
-            music_source::load(); // Reload token stuff etc.
+    /* Token handling happens in the background, an already expired
+     * token will be renewed as soon as the renewal thread is up */
+    if (m_logged_in)
+        start_renewal();
+}
+
+void spotify_source::start_renewal()
+{
+    std::lock_guard<std::mutex> lock(m_renew_mutex);
+    if (m_renew_flag) {
+        /* Token might have changed, so the thread has to reschedule */
+        m_renew_cv.notify_one();
+        return;
+    }
+    m_renew_flag = true;
+    m_renew_thread = std::thread(&spotify_source::renewal_method, this);
+}
+
+void spotify_source::stop_renewal()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_renew_mutex);
+        m_renew_flag = false;
+    }
+    m_renew_cv.notify_all();
+    if (m_renew_thread.joinable())
+        m_renew_thread.join();
+}
+
+void spotify_source::request_renewal()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_renew_mutex);
+        m_renew_now = true;
+    }
+    m_renew_cv.notify_one();
+}
+
+void spotify_source::renewal_method()
+{
+    util::set_thread_name("tuna-spotify-token");
+    int64_t retry_delay = 0, retry_at = 0, last_attempt = 0;
+
+    std::unique_lock<std::mutex> lock(m_renew_mutex);
+    while (m_renew_flag) {
+        const auto now = util::epoch();
+        const auto margin = std::min<int64_t>(TOKEN_RENEW_MARGIN, m_token_lifetime / 2);
+        auto due = retry_at > 0 ? retry_at : m_token_termination - margin;
+        if (m_renew_now)
+            due = now;
+        due = std::max(due, last_attempt + TOKEN_RENEW_MIN_DELAY);
+
+        if (now < due) {
+            /* Wakes up early if the thread is stopped, a new token
+             * was received or the query thread got rejected */
+            m_renew_cv.wait_for(lock, std::chrono::seconds(due - now));
+            continue;
+        }
+        m_renew_now = false;
+        last_attempt = now;
+        lock.unlock();
+
+        QString log;
+        const auto start = os_gettime_ns();
+        if (do_refresh_token(log)) {
+            binfo("Renewed Spotify token in the background in %i ms", int((os_gettime_ns() - start) / 1000000));
+            retry_delay = 0;
+            retry_at = 0;
+        } else {
+            retry_delay = std::min<int64_t>(retry_delay > 0 ? retry_delay * 2 : 5, TOKEN_RETRY_MAX);
+            retry_at = util::epoch() + retry_delay;
+            bwarn("Spotify token renewal failed, trying again in %i seconds", int(retry_delay));
         }
+        lock.lock();
     }
 }
 
+void spotify_source::persist_token()
+{
+    /* Only writes into the config store and doesn't touch
+     * the settings tab, so this can be called from any thread */
+    std::lock_guard<std::mutex> lock(m_token_mutex);
+    CSET_STR(CFG_SPOTIFY_AUTH_CODE, qt_to_utf8(m_auth_code));
+    CSET_STR(CFG_SPOTIFY_TOKEN, qt_to_utf8(m_token));
+    CSET_STR(CFG_SPOTIFY_REFRESH_TOKEN, qt_to_utf8(m_refresh_token));
+    CSET_BOOL(CFG_SPOTIFY_LOGGEDIN, m_logged_in);
+    CSET_INT(CFG_SPOTIFY_TOKEN_TERMINATION, m_token_termination);
+}
+
 /* implementation further down */
 long execute_command(const char* auth_token, const char* url, std::string& response_header,
     QJsonDocument& response_json, int64_t curl_timeout, const char* custom_request_type = nullptr, const char* request_data = nullptr);
@@ -134,13 +225,11 @@ void spotify_source::refresh()
     begin_refresh();
     bdebug("[Spotify] begin refresh");
 
-    if (util::epoch() > m_token_termination) {
-        binfo("Refreshing Spotify token");
-        QString log;
-        do_refresh_token(log);
-        //        emit(get_ui<spotify>())->login_state_changed(result, log);
-        save();
-    }
+    /* The renewal thread should have swapped in a new token long before
+     * this point, unless e.g. the system was suspended. Nudge it, but
+     * don't wait for it */
+    if (util::epoch() > m_token_termination)
+        request_renewal();
 
     if (m_timout_start) {
         if (os_gettime_ns() - m_timout_start >= m_timeout_length) {
@@ -157,8 +246,8 @@ void spotify_source::refresh()
     QJsonDocument response;
     QJsonObject obj;
 
-    const auto http_code = execute_command(qt_to_utf8(m_token), PLAYER_URL, header, response, m_curl_timeout_ms);
-    bdebug("Executed %s command", PLAYER_URL);
+    const auto http_code = execute_command(qt_to_utf8(token()), m_player_url.c_str(), header, response, m_curl_timeout_ms);
+    bdebug("Executed %s command", m_player_url.c_str());
     if (response.isObject())
         obj = response.object();
 
@@ -190,6 +279,9 @@ void spotify_source::refresh()
     } else if (http_code == HTTP_NO_CONTENT) {
         /* No session running */
         m_current.clear();
+    } else if (http_code == HTTP_UNAUTHORIZED) {
+        /* Token was revoked or expired early */
+        request_renewal();
     } else {
         /* Don't reset cover or info here since
          * we're just waiting for the API to give a proper
@@ -231,7 +323,7 @@ void spotify_source::parse_track_json(const QJsonValue& response)
             QJsonObject obj;
             std::string header = "";
             const auto& url = context["href"].toString();
-            const auto http_code = execute_command(qt_to_utf8(m_token), qt_to_utf8(url), header, playlist_response, m_curl_timeout_ms);
+            const auto http_code = execute_command(qt_to_utf8(token()), qt_to_utf8(url), header, playlist_response, m_curl_timeout_ms);
 
             if (playlist_response.isObject())
                 obj = playlist_response.object();
@@ -288,12 +380,13 @@ void spotify_source::parse_track_json(const QJsonValue& response)
 
 bool spotify_source::execute_capability(capability c)
 {
-    QString const token = qt_to_utf8(m_token);
+    QString const token = this->token();
     auto const playing = m_current.get<int>(meta::STATUS);
     auto timeout = m_curl_timeout_ms;
+    auto player = m_player_url;
     // offload this into a separate thread because the request
     // can take up to one second
-    std::thread([timeout, token, playing, c] {
+    std::thread([timeout, token, playing, c, player] {
         std::string header;
         long http_code = -1;
         QJsonDocument response;
@@ -302,16 +395,16 @@ bool spotify_source::execute_capability(capability c)
         case CAP_PLAY_PAUSE:
             if (playing) {
             case CAP_STOP_SONG:
-                http_code = execute_command(qt_to_utf8(token), PLAYER_PAUSE_URL, header, response, timeout, "PUT");
+                http_code = execute_command(qt_to_utf8(token), (player + "/pause").c_str(), header, response, timeout, "PUT");
             } else {
-                http_code = execute_command(qt_to_utf8(token), PLAYER_PLAY_URL, header, response, timeout, "PUT", "{\"position_ms\": 0}");
+                http_code = execute_command(qt_to_utf8(token), (player + "/play").c_str(), header, response, timeout, "PUT", "{\"position_ms\": 0}");
             }
             break;
         case CAP_PREV_SONG:
-            http_code = execute_command(qt_to_utf8(token), PLAYER_PREVIOUS_URL, header, response, timeout, "POST");
+            http_code = execute_command(qt_to_utf8(token), (player + "/previous").c_str(), header, response, timeout, "POST");
             break;
         case CAP_NEXT_SONG:
-            http_code = execute_command(qt_to_utf8(token), PLAYER_NEXT_URL, header, response, timeout, "POST");
+            http_code = execute_command(qt_to_utf8(token), (player + "/next").c_str(), header, response, timeout, "POST");
             break;
         case CAP_VOLUME_UP:
             /* TODO? */
@@ -350,13 +443,13 @@ size_t header_callback(char* ptr, size_t size, size_t nmemb, std::string* str)
     return new_length;
 }
 
-CURL* prepare_curl(struct curl_slist* header, std::string* response, std::string* response_header,
+CURL* prepare_curl(const std::string& url, struct curl_slist* header, std::string* response, std::string* response_header,
     const std::string& request, int64_t timeout)
 {
     CURL* curl = curl_easy_init();
 
     curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_URL, TOKEN_URL);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(request.c_str()));
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.c_str());
@@ -372,8 +465,9 @@ CURL* prepare_curl(struct curl_slist* header, std::string* response, std::string
 }
 
 /* Requests an access token via request body
- * over a POST request to spotify */
-void request_token(const std::string& request, const std::string& credentials, QJsonDocument& response_json, int64_t timeout)
+ * over a POST request to spotify (or whatever endpoint is
+ * configured as the token url) */
+void request_token(const std::string& url, const std::string& request, const std::string& credentials, QJsonDocument& response_json, int64_t timeout)
 {
     if (request.empty() || credentials.empty()) {
         berr("Cannot request token without valid credentials"
@@ -386,8 +480,8 @@ void request_token(const std::string& request, const std::string& credentials, Q
     header.append(credentials);
 
     auto* list = curl_slist_append(nullptr, header.c_str());
-    CURL* curl = prepare_curl(list, &response, &response_header, request, timeout);
-    CURLcode res = curl_easy_perform(curl);
+    CURL* curl = prepare_curl(url, list, &response, &response_header, request, timeout);
+    CURLcode res = util::curl_perform(curl, "spotify_token");
 
     if (res == CURLE_OK) {
         QJsonParseError err;
@@ -413,21 +507,27 @@ void request_token(const std::string& request, const std::string& credentials, Q
     curl_easy_cleanup(curl);
 }
 
-/* Gets a new token using the refresh token */
+/* Gets a new token using the refresh token, can be called from any thread */
 bool spotify_source::do_refresh_token(QString& log)
 {
+    std::lock_guard<std::mutex> request_lock(m_request_mutex);
     build_credentials();
-    static std::string request;
+    std::string request, credentials, url;
     bool result = false;
     QJsonDocument response;
 
-    if (m_refresh_token.isEmpty()) {
-        berr("Refresh token is empty!");
-    }
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        if (m_refresh_token.isEmpty()) {
+            berr("Refresh token is empty!");
+        }
 
-    request = "grant_type=refresh_token&refresh_token=";
-    request.append(m_refresh_token.toStdString());
-    request_token(request, m_creds.toStdString(), response, m_curl_timeout_ms);
+        request = "grant_type=refresh_token&refresh_token=";
+        request.append(m_refresh_token.toStdString());
+        credentials = m_creds.toStdString();
+        url = m_token_url.toStdString();
+    }
+    request_token(url, request, credentials, response, m_curl_timeout_ms);
 
     if (response.isNull()) {
         berr("Couldn't refresh Spotify token, response was null");
@@ -440,8 +540,10 @@ bool spotify_source::do_refresh_token(QString& log)
 
         /* Dump the json into the log text */
         log = QString(response.toJson(QJsonDocument::Indented));
+        std::lock_guard<std::mutex> lock(m_token_mutex);
         if (token.isString() && expires.isDouble()) {
             m_token = token.toString();
+            m_token_lifetime = expires.toInt();
             m_token_termination = util::epoch() + expires.toInt();
             result = true;
             binfo("Successfully logged in");
@@ -463,21 +565,28 @@ bool spotify_source::do_refresh_token(QString& log)
     }
 
     m_logged_in = result;
-    save();
+    persist_token();
     return result;
 }
 
 /* Gets the first token from the access code */
 bool spotify_source::new_token(QString& log)
 {
+    std::lock_guard<std::mutex> request_lock(m_request_mutex);
     build_credentials();
-    static std::string request;
+    std::string request, credentials, url;
     bool result = false;
     QJsonDocument response;
-    request = "grant_type=authorization_code&code=";
-    request.append(m_auth_code.toStdString());
-    request.append("&redirect_uri=").append(REDIRECT_URI);
-    request_token(request, m_creds.toStdString(), response, m_curl_timeout_ms);
+
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        request = "grant_type=authorization_code&code=";
+        request.append(m_auth_code.toStdString());
+        request.append("&redirect_uri=").append(REDIRECT_URI);
+        credentials = m_creds.toStdString();
+        url = m_token_url.toStdString();
+    }
+    request_token(url, request, credentials, response, m_curl_timeout_ms);
 
     if (response.isObject()) {
         const auto& response_obj = response.object();
@@ -489,18 +598,23 @@ bool spotify_source::new_token(QString& log)
         log = QString(response.toJson(QJsonDocument::Indented));
 
         if (token.isString() && refresh.isString() && expires.isDouble()) {
+            std::lock_guard<std::mutex> lock(m_token_mutex);
             m_token = token.toString();
             m_refresh_token = refresh.toString();
+            m_token_lifetime = expires.toInt();
             m_token_termination = util::epoch() + expires.toInt();
             result = true;
         } else {
             berr("Couldn't parse json response!");
         }
-    } else {
     }
 
     m_logged_in = result;
-    save();
+    persist_token();
+
+    /* Schedule renewal for the new token */
+    if (result)
+        start_renewal();
     return result;
 }
 
@@ -553,7 +667,7 @@ long execute_command(const char* auth_token, const char* url, std::string& respo
 #ifdef DEBUG
     curl_easy_setopt(curl, CURLOPT_VERBOSE, CURL_DEBUG);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = util::curl_perform(curl, "spotify");
 
     if (res == CURLE_OK) {
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
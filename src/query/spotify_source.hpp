@@ -21,17 +21,38 @@
 #include "music_source.hpp"
 #include <QJsonValue>
 #include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 class spotify_source : public music_source {
-    bool m_logged_in = false;
+    std::atomic<bool> m_logged_in = false;
     bool m_last_state = false;
     QString m_token = "";
     QString m_creds = "";
     QString m_auth_code = "";
     QString m_refresh_token = "";
+    QString m_token_url = "";
+    std::string m_player_url = ""; /* Only used on the worker */
+
+    /* Guards the token strings, which are swapped by the renewal thread */
+    mutable std::mutex m_token_mutex;
+    /* Only one token request can be in flight at a time */
+    std::mutex m_request_mutex;
 
     /* epoch time in seconds */
-    int64_t m_token_termination = 0;
+    std::atomic<int64_t> m_token_termination = 0;
+    /* expires_in of the last token, isn't saved so it starts with Spotify's usual value */
+    std::atomic<int64_t> m_token_lifetime = 3600;
+
+    /* Background token renewal, so that the query thread never
+     * has to wait for the token endpoint */
+    std::thread m_renew_thread;
+    std::mutex m_renew_mutex;
+    std::condition_variable m_renew_cv;
+    bool m_renew_flag = false;
+    bool m_renew_now = false;
 
     int64_t m_curl_timeout_ms = 1000;
 
@@ -40,8 +61,15 @@ class spotify_source : public music_source {
     void parse_track_json(const QJsonValue& track);
     void build_credentials();
 
+    void start_renewal();
+    void stop_renewal();
+    void renewal_method();
+    void request_renewal();
+    void persist_token();
+
 public:
     spotify_source();
+    ~spotify_source() { stop_renewal(); }
 
     bool enabled() const override;
     void load() override;
@@ -49,10 +77,26 @@ public:
     bool execute_capability(capability c) override;
     bool do_refresh_token(QString& log);
     bool new_token(QString& log);
-    void set_auth_code(const QString& auth_code) { m_auth_code = auth_code; }
+    void set_auth_code(const QString& auth_code)
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        m_auth_code = auth_code;
+    }
     bool is_logged_in() const { return m_logged_in; }
-    int token_termination() const { return m_token_termination; }
-    const QString& auth_code() const { return m_auth_code; }
-    const QString& token() const { return m_token; }
-    const QString& refresh_token() const { return m_refresh_token; }
+    int token_termination() const { return int(m_token_termination); }
+    QString auth_code() const
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        return m_auth_code;
+    }
+    QString token() const
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        return m_token;
+    }
+    QString refresh_token() const
+    {
+        std::lock_guard<std::mutex> lock(m_token_mutex);
+        return m_refresh_token;
+    }
 };
@@ -20,9 +20,9 @@
 #include "../gui/tuna_gui.hpp"
 #include "../gui/widgets/vlc.hpp"
 #include "../util/constants.hpp"
-#include "../util/tuna_thread.hpp"
 #include "../util/utility.hpp"
 #include <QUrl>
+#include <cmath>
 #include <obs-frontend-api.h>
 
 vlc_obs_source::vlc_obs_source()
@@ -140,7 +140,6 @@ bool vlc_obs_source::enabled() const
 
 void vlc_obs_source::next_vlc_source()
 {
-    std::lock_guard<std::mutex> lock(tuna_thread::thread_mutex);
     auto mappings = static_cast<vlc*>(get_settings_tab())->get_mappings_for_scene(m_target_scene.c_str());
     if (mappings.empty())
         return;
@@ -149,7 +148,6 @@ void vlc_obs_source::next_vlc_source()
 
 void vlc_obs_source::prev_vlc_source()
 {
-    std::lock_guard<std::mutex> lock(tuna_thread::thread_mutex);
     auto mappings = static_cast<vlc*>(get_settings_tab())->get_mappings_for_scene(m_target_scene.c_str());
     if (mappings.empty())
         return;
@@ -341,3 +339,18 @@ bool vlc_obs_source::execute_capability(capability c)
     }
     return true;
 }
+
+bool vlc_obs_source::execute_capability_repeated(capability c, int count)
+{
+    if (c != CAP_VOLUME_UP && c != CAP_VOLUME_DOWN)
+        return music_source::execute_capability_repeated(c, count);
+
+    OBSSourceAutoRelease src = get_source();
+    if (!src)
+        return false;
+
+    /* Same as pressing repeatedly, every press changes the volume by 10% */
+    float factor = std::pow(c == CAP_VOLUME_UP ? 1.1f : 0.9f, float(count));
+    obs_source_set_volume(src, obs_source_get_volume(src) * factor);
+    return true;
+}
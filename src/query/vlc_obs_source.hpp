@@ -50,6 +50,7 @@ public:
     void load() override;
     void refresh() override;
     bool execute_capability(capability c) override;
+    bool execute_capability_repeated(capability c, int count) override;
     bool enabled() const override;
 
     void next_vlc_source();
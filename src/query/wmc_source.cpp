@@ -21,6 +21,7 @@
 #include "../util/config.hpp"
 #include "../util/constants.hpp"
 #include "../util/utility.hpp"
+#include <QBuffer>
 #include <QFile>
 
 /**
@@ -93,18 +94,13 @@ void wmc_source::update_players()
 
 void wmc_source::save_cover(QImage const& image)
 {
-    auto tmp = config::cover_path + ".tmp";
-
-    if (image.save(tmp, "png")) {
-        QFile current(config::cover_path);
-        current.remove();
-        if (!QFile::rename(tmp, config::cover_path)) {
-            util::reset_cover();
-            berr("[WMC] Failed to move cover from temporary file to %s", qt_to_utf8(config::cover_path));
-        }
-
-    } else {
-        berr("[WMC] Failed to save cover to %s", qt_to_utf8(config::cover_path));
+    QByteArray data;
+    QBuffer buffer(&data);
+    if (!image.save(&buffer, "png")) {
+        berr("[WMC] Failed to encode cover");
+        util::reset_cover();
+    } else if (!util::set_cover(data)) {
+        berr("[WMC] Failed to save cover to %s", qt_to_utf8(config::get()->cover_path));
     }
 }
 
@@ -229,13 +225,13 @@ void wmc_source::handle_media_property_change(GlobalSystemMediaTransportControls
         std::memcpy(data.get()->data(), pixel_data_detached.data(), pixel_data_detached.size());
 
         QImage image(data.get()->data(), width, height, QImage::Format_RGBA8888);
-        auto current_source = music_sources::selected_source();
+        auto current_source = music_sources::active_source();
         m_internal_mutex.lock();
         m_covers[id] = { true, image, data };
         m_internal_mutex.unlock();
 
         /* We receive cover updates regardless of whether tuna is
-         * configured to monitor WMC so if the current source isn't WMC, we
+         * configured to monitor WMC so if the shown source isn't WMC, we
          * just save the cover for when the user switches to WMC*/
         if (current_source.get() == this) {
             save_cover(image);
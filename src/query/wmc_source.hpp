@@ -61,6 +61,7 @@ public:
     void handle_timeline_property_change(GlobalSystemMediaTransportControlsSession session, TimelinePropertiesChangedEventArgs const& args);
     void update_players();
     bool execute_capability(capability c) override;
+    bool is_toggle(capability c) const override { return c == CAP_PLAY_PAUSE; }
     bool enabled() const { return true; }
     void request_manager();
     void handle_cover() override
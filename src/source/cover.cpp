@@ -0,0 +1,204 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#include "cover.hpp"
+#include "../util/constants.hpp"
+#include "../util/utility.hpp"
+#include <algorithm>
+
+namespace obs_sources {
+
+struct decode_task {
+    cover_source* source;
+    std::shared_ptr<const util::cover_image> cover;
+    uint32_t cx, cy;
+    uint64_t version;
+};
+
+cover_source::cover_source(obs_data_t* settings)
+{
+    char* path = obs_module_file("effects/cover.effect");
+    obs_enter_graphics();
+    m_effect = gs_effect_create_from_file(path, nullptr);
+    obs_leave_graphics();
+    if (!m_effect)
+        berr("Couldn't load cover effect from %s", path);
+    bfree(path);
+
+    m_decoder = os_task_queue_create();
+    update(settings);
+}
+
+cover_source::~cover_source()
+{
+    /* Waits for queued decodes, which still reference this source */
+    os_task_queue_destroy(m_decoder);
+
+    obs_enter_graphics();
+    gs_texture_destroy(m_current.tex);
+    gs_texture_destroy(m_prev.tex);
+    gs_effect_destroy(m_effect);
+    obs_leave_graphics();
+}
+
+void cover_source::decode(void* param)
+{
+    /* The cover was already decoded once when it was set, so this only has
+     * to scale it to the source size */
+    auto* task = static_cast<decode_task*>(param);
+    auto image = task->cover->image;
+    if (uint32_t(image.width()) != task->cx || uint32_t(image.height()) != task->cy)
+        image = image.scaled(int(task->cx), int(task->cy), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    image = image.convertToFormat(QImage::Format_RGBA8888);
+
+    {
+        std::lock_guard<std::mutex> lock(task->source->m_pending_mutex);
+        if (task->version >= task->source->m_pending_version) {
+            task->source->m_pending = std::move(image);
+            task->source->m_pending_version = task->version;
+        }
+    }
+    delete task;
+}
+
+void cover_source::update(obs_data_t* settings)
+{
+    m_cx = static_cast<uint32_t>(obs_data_get_int(settings, S_COVER_CX));
+    m_cy = static_cast<uint32_t>(obs_data_get_int(settings, S_COVER_CY));
+    m_fade_ms = static_cast<uint32_t>(obs_data_get_int(settings, S_COVER_FADE));
+
+    /* The video thread decodes the cover again in the new size */
+    m_resized = true;
+}
+
+void cover_source::tick(float seconds)
+{
+    const uint32_t fade_ms = m_fade_ms;
+    if (m_fade < 1.f)
+        m_fade = fade_ms > 0 ? std::min(m_fade + seconds * 1000.f / fade_ms, 1.f) : 1.f;
+
+    /* Only queue a decode if the cover or the size actually changed */
+    if (!m_resized.exchange(false) && util::cover_version() == m_version)
+        return;
+
+    auto* task = new decode_task { this, {}, m_cx, m_cy, 0 };
+    task->cover = util::get_cover(&task->version);
+    if (!task->cover || task->cover->image.isNull()) {
+        m_version = task->version;
+        delete task;
+        return;
+    }
+    m_version = task->version;
+    if (!os_task_queue_queue_task(m_decoder, decode, task))
+        delete task;
+}
+
+void cover_source::upload(QImage const& image)
+{
+    const auto cx = uint32_t(image.width()), cy = uint32_t(image.height());
+    const auto* bits = image.constBits();
+
+    /* The texture that faded out is reused for the new cover */
+    std::swap(m_prev, m_current);
+    if (m_current.tex && m_current.cx == cx && m_current.cy == cy) {
+        gs_texture_set_image(m_current.tex, bits, uint32_t(image.bytesPerLine()), false);
+    } else {
+        gs_texture_destroy(m_current.tex);
+        m_current.tex = gs_texture_create(cx, cy, GS_RGBA, 1, &bits, GS_DYNAMIC);
+        m_current.cx = cx;
+        m_current.cy = cy;
+    }
+    m_fade = m_prev.tex && m_fade_ms.load() > 0 ? 0.f : 1.f;
+}
+
+void cover_source::render(gs_effect_t* effect)
+{
+    UNUSED_PARAMETER(effect);
+    if (!m_effect)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        if (!m_pending.isNull()) {
+            upload(m_pending);
+            m_pending = {};
+        }
+    }
+
+    gs_eparam_t* image = gs_effect_get_param_by_name(m_effect, "image");
+    gs_eparam_t* opacity = gs_effect_get_param_by_name(m_effect, "opacity");
+
+    const uint32_t cx = m_cx, cy = m_cy;
+    auto draw = [&](texture const& t, float alpha) {
+        if (!t.tex || alpha <= 0.f)
+            return;
+        gs_effect_set_texture(image, t.tex);
+        gs_effect_set_float(opacity, alpha);
+
+        /* Centered, since the cover keeps its aspect ratio */
+        gs_matrix_push();
+        gs_matrix_translate3f(float(cx - std::min(t.cx, cx)) / 2, float(cy - std::min(t.cy, cy)) / 2, 0);
+        while (gs_effect_loop(m_effect, "Draw"))
+            gs_draw_sprite(t.tex, 0, t.cx, t.cy);
+        gs_matrix_pop();
+    };
+
+    if (m_fade < 1.f)
+        draw(m_prev, 1.f);
+    draw(m_current, m_fade);
+}
+
+obs_properties_t* get_properties_for_cover(void* data)
+{
+    UNUSED_PARAMETER(data);
+    auto* p = obs_properties_create();
+    obs_properties_add_int(p, S_COVER_CX, T_COVER_CX, 2, UINT16_MAX, 1);
+    obs_properties_add_int(p, S_COVER_CY, T_COVER_CY, 2, UINT16_MAX, 1);
+    auto* fade = obs_properties_add_int(p, S_COVER_FADE, T_COVER_FADE, 0, 10000, 50);
+    obs_property_int_set_suffix(fade, " ms");
+    return p;
+}
+
+void register_cover()
+{
+    obs_source_info si {};
+    si.id = S_COVER_ID;
+    si.type = OBS_SOURCE_TYPE_INPUT;
+    si.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW;
+    si.get_properties = get_properties_for_cover;
+    si.get_name = [](void*) { return T_COVER_NAME; };
+    si.create = [](obs_data_t* d, obs_source_t*) { return static_cast<void*>(new cover_source(d)); };
+    si.destroy = [](void* data) { delete reinterpret_cast<cover_source*>(data); };
+    si.get_width = [](void* data) { return reinterpret_cast<cover_source*>(data)->get_width(); };
+    si.get_height = [](void* data) { return reinterpret_cast<cover_source*>(data)->get_height(); };
+    si.get_defaults = [](obs_data_t* settings) {
+        obs_data_set_default_int(settings, S_COVER_CX, 300);
+        obs_data_set_default_int(settings, S_COVER_CY, 300);
+        obs_data_set_default_int(settings, S_COVER_FADE, 500);
+    };
+
+    si.update = [](void* data, obs_data_t* settings) { reinterpret_cast<cover_source*>(data)->update(settings); };
+    si.video_tick = [](void* data, float seconds) { reinterpret_cast<cover_source*>(data)->tick(seconds); };
+    si.video_render = [](void* data, gs_effect_t* effect) {
+        reinterpret_cast<cover_source*>(data)->render(effect);
+    };
+
+    obs_register_source(&si);
+}
+}
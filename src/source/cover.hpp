@@ -0,0 +1,70 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#pragma once
+#include <QImage>
+#include <atomic>
+#include <mutex>
+#include <obs-module.h>
+#include <util/task.h>
+
+namespace obs_sources {
+
+/* Shows the current cover, images are scaled on a task queue
+ * and only uploaded once they're done */
+class cover_source {
+    struct texture {
+        gs_texture_t* tex = nullptr;
+        uint32_t cx = 0, cy = 0;
+    };
+
+    gs_effect_t* m_effect = nullptr;
+    os_task_queue_t* m_decoder = nullptr;
+
+    /* Set on the UI thread, read on the video and graphics thread */
+    std::atomic<uint32_t> m_cx { 300 }, m_cy { 300 };
+    std::atomic<uint32_t> m_fade_ms { 500 };
+    std::atomic<bool> m_resized { true };
+
+    texture m_current {}, m_prev {};
+    float m_fade = 1.f;
+    uint64_t m_version = 0;
+
+    /* Written by the decoder */
+    std::mutex m_pending_mutex;
+    QImage m_pending {};
+    uint64_t m_pending_version = 0;
+
+    static void decode(void* param);
+    void upload(QImage const& image);
+
+public:
+    explicit cover_source(obs_data_t* settings);
+    ~cover_source();
+
+    inline void update(obs_data_t* settings);
+    inline void tick(float seconds);
+    inline void render(gs_effect_t* effect);
+
+    uint32_t get_width() const { return m_cx; }
+    uint32_t get_height() const { return m_cy; }
+};
+
+extern void register_cover();
+}
@@ -18,9 +18,34 @@
 
 #include "progress.hpp"
 #include "../util/constants.hpp"
+#include "../util/trace.hpp"
 #include "../util/tuna_thread.hpp"
+#include "../util/utility.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define ROUNDED_CAP_SEGMENTS 8
+#define CIRCLE_SEGMENTS 64
 
 namespace obs_sources {
+
+static uint32_t lerp_color(uint32_t a, uint32_t b, float t)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        const float ca = float((a >> shift) & 0xFF), cb = float((b >> shift) & 0xFF);
+        result |= uint32_t(lroundf(ca + (cb - ca) * t)) << shift;
+    }
+    return result;
+}
+
+/* OBS colors are ABGR, the alpha of the configured color is kept */
+static uint32_t to_obs_color(QRgb c, uint32_t alpha_from)
+{
+    return (alpha_from & 0xFF000000) | uint32_t(qBlue(c)) << 16 | uint32_t(qGreen(c)) << 8 | uint32_t(qRed(c));
+}
+
 progress_source::progress_source(obs_source_t* src, obs_data_t* settings)
     : m_source(src)
 {
@@ -28,43 +53,29 @@ progress_source::progress_source(obs_source_t* src, obs_data_t* settings)
     UNUSED_PARAMETER(m_source);
 }
 
-progress_source::~progress_source() { }
+progress_source::~progress_source()
+{
+    obs_enter_graphics();
+    gs_vertexbuffer_destroy(m_vb);
+    obs_leave_graphics();
+}
 
 void progress_source::tick(float seconds)
 {
-    song tmp {};
-    tuna_thread::copy_mutex.lock();
-    tmp = tuna_thread::copy;
-    tuna_thread::copy_mutex.unlock();
-    m_state = (play_state)tmp.get<int>(meta::STATUS);
-    if (m_state == state_playing && tmp.has(meta::DURATION)) {
-        seconds *= 1000; /* s -> ms */
-        if (tmp.has(meta::PROGRESS)) {
-            // Retrieve new progress, if it changed
-            // we allow difference of 3 seconds because otherwise the progress bar
-            // sometimes jumps around
-            m_synced_progress = tmp.get<int>(meta::PROGRESS);
-            auto diff = m_synced_progress - m_adjusted_progress;
-            if (abs(diff) > 3000) {
-                m_adjusted_progress = float(m_synced_progress) + seconds;
-            } else {
-                auto catchup = diff / 3000.f;
-                // basically speed up the progress bar if we are behind on the actual position
-                // or slow it down if we are ahead. Speedup/slowdown at most 2% of seconds
-                m_adjusted_progress += seconds * (1 + catchup * (seconds * 0.04));
-            }
-        } else if (m_synced_progress > 0) {
-            m_adjusted_progress += seconds;
-        }
+    const uint64_t version = tuna_thread::copy_version;
+    if (version != m_version) {
+        auto lock = trace::lock(tuna_thread::copy_mutex, "wait copy_mutex");
+        m_song = tuna_thread::copy;
+        m_version = version;
+    }
 
-        auto duration = tmp.get<int>(meta::DURATION);
-        if (duration != m_duration) { // Song changed, so we reset these values
-            m_duration = duration;
-            m_synced_progress = 0;
-            m_adjusted_progress = 0;
-        }
+    m_state = (play_state)m_song.get<int>(meta::STATUS);
+    if (m_state == state_playing && m_song.has(meta::DURATION)) {
+        /* The clock already smooths out polling jitter, so it's just
+         * extrapolated to the current frame */
+        auto duration = m_song.get<int>(meta::DURATION);
         if (duration > 0)
-            m_progress = m_adjusted_progress / float(duration);
+            m_progress = float(m_song.progress_now()) / float(duration);
         m_progress = fmaxf(fminf(1, m_progress), 0);
     } else if (m_state == state_paused) {
         float step = 0.0005f * m_cx;
@@ -76,57 +87,224 @@ void progress_source::tick(float seconds)
         if (m_bounce_progress >= 1.f || m_bounce_progress <= 0.f)
             m_bounce_up = !m_bounce_up;
     }
+
+    if (m_auto_color && util::cover_version() != m_cover_version)
+        apply_cover_colors();
+
+    auto key = mesh_key();
+    if (m_mesh_dirty || key != m_mesh_key) {
+        m_mesh_key = key;
+        build_mesh();
+    }
 }
 
-void progress_source::render(gs_effect_t* effect)
+/* Changes whenever the mesh would look different, which is at most
+ * once per pixel (or tenth of a degree for the circle) */
+int64_t progress_source::mesh_key() const
 {
-    UNUSED_PARAMETER(effect);
-    if (m_hide_paused && m_state >= state_paused)
+    const float steps = m_style == style_circular ? 3600.f : float(m_cx);
+    int64_t pos = 0;
+    if (m_state == state_playing)
+        pos = lroundf(m_progress * steps);
+    else if (m_state == state_paused)
+        pos = lroundf(m_bounce_progress * steps);
+    return (int64_t(m_state) << 32) | pos;
+}
+
+/* Bar in the vibrant, background in the muted color of the cover,
+ * the gradient goes from vibrant to dominant */
+void progress_source::apply_cover_colors()
+{
+    auto cover = util::get_cover(&m_cover_version);
+    if (!cover || !cover->palette.valid)
         return;
+    auto const& colors = cover->palette;
+    m_fg = to_obs_color(colors.vibrant, m_fg);
+    m_fg2 = to_obs_color(colors.dominant, m_fg2);
+    m_bg = to_obs_color(colors.muted, m_bg);
+    m_mesh_dirty = true;
+}
 
-    gs_effect_t* solid = obs_get_base_effect(OBS_EFFECT_SOLID);
-    gs_eparam_t* color = gs_effect_get_param_by_name(solid, "color");
-    gs_technique_t* tech = gs_effect_get_technique(solid, "Solid");
+void progress_source::add_quad(float x0, float y0, float x1, float y1, uint32_t c0, uint32_t c1)
+{
+    vec3 p[4];
+    vec3_set(&p[0], x0, y0, 0);
+    vec3_set(&p[1], x1, y0, 0);
+    vec3_set(&p[2], x0, y1, 0);
+    vec3_set(&p[3], x1, y1, 0);
+    for (int i : { 0, 1, 2, 2, 1, 3 }) {
+        m_points.emplace_back(p[i]);
+        m_colors.emplace_back(i % 2 ? c1 : c0);
+    }
+}
 
-    struct vec4 bg, fg;
-    vec4_from_rgba(&bg, m_bg);
-    vec4_from_rgba(&fg, m_fg);
+/* A bar with half ellipses as caps, which turns into an ellipse
+ * once it's narrower than it is tall */
+void progress_source::add_bar(float x0, float x1, uint32_t color)
+{
+    const float ry = m_cy / 2.f, rx = fminf(ry, (x1 - x0) / 2.f);
+    add_quad(x0 + rx, 0, x1 - rx, float(m_cy), color, color);
+
+    for (int i = 0; i < ROUNDED_CAP_SEGMENTS; i++) {
+        const float a = float(M_PI) * i / ROUNDED_CAP_SEGMENTS - float(M_PI_2);
+        const float b = float(M_PI) * (i + 1) / ROUNDED_CAP_SEGMENTS - float(M_PI_2);
+        for (int side = 0; side < 2; side++) {
+            const float cx = side ? x1 - rx : x0 + rx, dir = side ? 1.f : -1.f;
+            vec3 p[3];
+            vec3_set(&p[0], cx, ry, 0);
+            vec3_set(&p[1], cx + dir * rx * cosf(a), ry + ry * sinf(a), 0);
+            vec3_set(&p[2], cx + dir * rx * cosf(b), ry + ry * sinf(b), 0);
+            for (auto const& v : p) {
+                m_points.emplace_back(v);
+                m_colors.emplace_back(color);
+            }
+        }
+    }
+}
 
-    if (m_use_bg) {
-        gs_effect_set_vec4(color, &bg);
+/* Part of a ring, starting at the top and going clockwise */
+void progress_source::add_arc(float t0, float t1, uint32_t color)
+{
+    const float cx = m_cx / 2.f, cy = m_cy / 2.f;
+    const float outer = fminf(cx, cy), inner = fmaxf(outer - float(m_thickness), 0.f);
+    const int segments = std::max(1, int(ceilf(CIRCLE_SEGMENTS * (t1 - t0))));
 
-        gs_technique_begin(tech);
-        gs_technique_begin_pass(tech, 0);
-        gs_draw_sprite(nullptr, 0, m_cx, m_cy);
-        gs_technique_end_pass(tech);
-        gs_technique_end(tech);
+    for (int i = 0; i < segments; i++) {
+        const float a = float(2 * M_PI) * (t0 + (t1 - t0) * i / segments) - float(M_PI_2);
+        const float b = float(2 * M_PI) * (t0 + (t1 - t0) * (i + 1) / segments) - float(M_PI_2);
+        vec3 p[4];
+        vec3_set(&p[0], cx + outer * cosf(a), cy + outer * sinf(a), 0);
+        vec3_set(&p[1], cx + outer * cosf(b), cy + outer * sinf(b), 0);
+        vec3_set(&p[2], cx + inner * cosf(a), cy + inner * sinf(a), 0);
+        vec3_set(&p[3], cx + inner * cosf(b), cy + inner * sinf(b), 0);
+        for (int j : { 0, 1, 2, 2, 1, 3 }) {
+            m_points.emplace_back(p[j]);
+            m_colors.emplace_back(color);
+        }
     }
+}
 
-    gs_effect_set_vec4(color, &fg);
+void progress_source::build_mesh()
+{
+    m_points.clear();
+    m_colors.clear();
+    m_mesh_dirty = false;
+    m_mesh_changed = true;
 
+    if (m_hide_paused && m_state >= state_paused)
+        return;
+
+    /* The filled part is either the progress or the bouncing block while paused */
+    float f0 = 0, f1 = 0;
     if (m_state == state_playing) {
-        uint32_t progress = static_cast<uint32_t>(m_cx * m_progress);
-        if (progress > 0) {
-            gs_technique_begin(tech);
-            gs_technique_begin_pass(tech, 0);
-            gs_draw_sprite(nullptr, 0, progress, m_cy);
-            gs_technique_end_pass(tech);
-            gs_technique_end(tech);
-        }
+        f1 = m_progress;
     } else if (m_state == state_paused) {
-        uint32_t w = static_cast<uint32_t>(m_cx * .25);
-        uint32_t x = static_cast<uint32_t>(m_bounce_progress * (m_cx - w));
-        if (w > 0) {
-            gs_matrix_push();
-            gs_technique_begin(tech);
-            gs_technique_begin_pass(tech, 0);
-            gs_matrix_translate3f(x, 0, 0);
-            gs_draw_sprite(nullptr, 0, w, m_cy);
-            gs_technique_end_pass(tech);
-            gs_technique_end(tech);
-            gs_matrix_pop();
+        f0 = m_bounce_progress * .75f;
+        f1 = f0 + .25f;
+    }
+
+    if (m_style == style_circular) {
+        if (m_use_bg)
+            add_arc(0, 1, m_bg);
+        if (f1 > f0)
+            add_arc(f0, f1, m_fg);
+        return;
+    }
+
+    const float cx = float(m_cx), cy = float(m_cy);
+    if (m_style == style_segmented) {
+        const uint32_t count = std::max<uint32_t>(m_segments, 1);
+        const float gap = fminf(cx / count / 4.f, 4.f), width = (cx - gap * (count - 1)) / count;
+        for (uint32_t i = 0; i < count; i++) {
+            const float x0 = i * (width + gap), x1 = x0 + width;
+            if (m_use_bg)
+                add_quad(x0, 0, x1, cy, m_bg, m_bg);
+            const float s0 = fmaxf(x0, f0 * cx), s1 = fminf(x1, f1 * cx);
+            if (s1 > s0)
+                add_quad(s0, 0, s1, cy, m_fg, m_fg);
+        }
+        return;
+    }
+
+    if (m_style == style_rounded) {
+        if (m_use_bg)
+            add_bar(0, cx, m_bg);
+        if (f1 > f0)
+            add_bar(f0 * cx, f1 * cx, m_fg);
+        return;
+    }
+
+    if (m_use_bg)
+        add_quad(0, 0, cx, cy, m_bg, m_bg);
+    if (f1 > f0) {
+        /* The gradient spans the entire bar, so it's revealed by the progress */
+        const bool gradient = m_style == style_gradient;
+        add_quad(f0 * cx, 0, f1 * cx, cy, gradient ? lerp_color(m_fg, m_fg2, f0) : m_fg,
+            gradient ? lerp_color(m_fg, m_fg2, f1) : m_fg);
+    }
+}
+
+void progress_source::upload_mesh()
+{
+    m_mesh_changed = false;
+    if (m_points.empty()) {
+        m_vb_count = 0;
+        return;
+    }
+
+    if (m_points.size() > m_vb_capacity || !m_vb) {
+        gs_vertexbuffer_destroy(m_vb);
+        m_vb_capacity = std::max<size_t>(m_points.size(), 64);
+
+        auto* data = gs_vbdata_create();
+        data->num = m_vb_capacity;
+        data->points = static_cast<vec3*>(bzalloc(sizeof(vec3) * m_vb_capacity));
+        data->colors = static_cast<uint32_t*>(bzalloc(sizeof(uint32_t) * m_vb_capacity));
+        m_vb = gs_vertexbuffer_create(data, GS_DYNAMIC);
+        if (!m_vb) {
+            m_vb_capacity = 0;
+            m_vb_count = 0;
+            return;
         }
     }
+
+    auto* data = gs_vertexbuffer_get_data(m_vb);
+    memcpy(data->points, m_points.data(), sizeof(vec3) * m_points.size());
+    memcpy(data->colors, m_colors.data(), sizeof(uint32_t) * m_colors.size());
+    gs_vertexbuffer_flush(m_vb);
+    m_vb_count = m_points.size();
+}
+
+void progress_source::render(gs_effect_t* effect)
+{
+    UNUSED_PARAMETER(effect);
+    if (m_mesh_changed)
+        upload_mesh();
+    if (m_vb_count == 0)
+        return;
+
+    gs_effect_t* solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+    gs_eparam_t* color = gs_effect_get_param_by_name(solid, "color");
+    gs_technique_t* tech = gs_effect_get_technique(solid, "SolidColored");
+
+    /* Vertex colors are multiplied with this */
+    struct vec4 white;
+    vec4_set(&white, 1.f, 1.f, 1.f, 1.f);
+    gs_effect_set_vec4(color, &white);
+
+    const auto cull = gs_get_cull_mode();
+    gs_set_cull_mode(GS_NEITHER);
+    gs_load_vertexbuffer(m_vb);
+    gs_load_indexbuffer(nullptr);
+
+    gs_technique_begin(tech);
+    gs_technique_begin_pass(tech, 0);
+    gs_draw(GS_TRIS, 0, uint32_t(m_vb_count));
+    gs_technique_end_pass(tech);
+    gs_technique_end(tech);
+
+    gs_load_vertexbuffer(nullptr);
+    gs_set_cull_mode(cull);
 }
 
 void progress_source::update(obs_data_t* settings)
@@ -134,9 +312,17 @@ void progress_source::update(obs_data_t* settings)
     m_cx = static_cast<uint32_t>(obs_data_get_int(settings, S_PROGRESS_CX));
     m_cy = static_cast<uint32_t>(obs_data_get_int(settings, S_PROGRESS_CY));
     m_fg = static_cast<uint32_t>(obs_data_get_int(settings, S_PROGRESS_FG));
+    m_fg2 = static_cast<uint32_t>(obs_data_get_int(settings, S_PROGRESS_FG2));
     m_bg = static_cast<uint32_t>(obs_data_get_int(settings, S_PROGRESS_BG));
     m_use_bg = obs_data_get_bool(settings, S_PROGRESS_USE_BG);
     m_hide_paused = obs_data_get_bool(settings, S_PROGRESS_HIDE_PAUSED);
+    m_style = static_cast<progress_style>(obs_data_get_int(settings, S_PROGRESS_STYLE));
+    m_segments = static_cast<uint32_t>(obs_data_get_int(settings, S_PROGRESS_SEGMENTS));
+    m_thickness = static_cast<uint32_t>(obs_data_get_int(settings, S_PROGRESS_THICKNESS));
+    m_auto_color = obs_data_get_bool(settings, S_PROGRESS_AUTO_COLOR);
+    if (m_auto_color)
+        apply_cover_colors();
+    m_mesh_dirty = true;
 }
 
 static bool use_bg_changed(obs_properties_t* props, obs_property_t* property, obs_data_t* settings)
@@ -147,16 +333,48 @@ static bool use_bg_changed(obs_properties_t* props, obs_property_t* property, ob
     return true;
 }
 
+static bool auto_color_changed(obs_properties_t* props, obs_property_t* property, obs_data_t* settings)
+{
+    UNUSED_PARAMETER(property);
+    auto manual = !obs_data_get_bool(settings, S_PROGRESS_AUTO_COLOR);
+    obs_property_set_enabled(obs_properties_get(props, S_PROGRESS_FG), manual);
+    obs_property_set_enabled(obs_properties_get(props, S_PROGRESS_FG2), manual);
+    obs_property_set_enabled(obs_properties_get(props, S_PROGRESS_BG), manual);
+    return true;
+}
+
+static bool style_changed(obs_properties_t* props, obs_property_t* property, obs_data_t* settings)
+{
+    UNUSED_PARAMETER(property);
+    auto style = obs_data_get_int(settings, S_PROGRESS_STYLE);
+    obs_property_set_visible(obs_properties_get(props, S_PROGRESS_FG2), style == style_gradient);
+    obs_property_set_visible(obs_properties_get(props, S_PROGRESS_SEGMENTS), style == style_segmented);
+    obs_property_set_visible(obs_properties_get(props, S_PROGRESS_THICKNESS), style == style_circular);
+    return true;
+}
+
 obs_properties_t* get_properties_for_progress(void* data)
 {
     UNUSED_PARAMETER(data);
     auto* p = obs_properties_create();
+    auto* style = obs_properties_add_list(p, S_PROGRESS_STYLE, T_PROGRESS_STYLE, OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+    obs_property_list_add_int(style, T_PROGRESS_FLAT, style_flat);
+    obs_property_list_add_int(style, T_PROGRESS_ROUNDED, style_rounded);
+    obs_property_list_add_int(style, T_PROGRESS_GRADIENT, style_gradient);
+    obs_property_list_add_int(style, T_PROGRESS_SEGMENTED, style_segmented);
+    obs_property_list_add_int(style, T_PROGRESS_CIRCULAR, style_circular);
+    obs_property_set_modified_callback(style, style_changed);
+    auto* auto_color = obs_properties_add_bool(p, S_PROGRESS_AUTO_COLOR, T_PROGRESS_AUTO_COLOR);
+    obs_property_set_modified_callback(auto_color, auto_color_changed);
     obs_properties_add_color(p, S_PROGRESS_FG, T_PROGRESS_FG);
+    obs_properties_add_color(p, S_PROGRESS_FG2, T_PROGRESS_FG2);
     auto* use_bg = obs_properties_add_bool(p, S_PROGRESS_USE_BG, T_PROGRESS_USE_BG);
     obs_property_set_modified_callback(use_bg, use_bg_changed);
     obs_properties_add_color(p, S_PROGRESS_BG, T_PROGRESS_BG);
     obs_properties_add_int(p, S_PROGRESS_CX, T_PROGRESS_CX, 2, UINT16_MAX, 1);
     obs_properties_add_int(p, S_PROGRESS_CY, T_PROGRESS_CY, 2, UINT16_MAX, 1);
+    obs_properties_add_int(p, S_PROGRESS_SEGMENTS, T_PROGRESS_SEGMENTS, 1, 200, 1);
+    obs_properties_add_int(p, S_PROGRESS_THICKNESS, T_PROGRESS_THICKNESS, 1, UINT16_MAX, 1);
     obs_properties_add_bool(p, S_PROGRESS_HIDE_PAUSED, T_PROGRESS_HIDE_PAUSED);
     return p;
 }
@@ -175,10 +393,15 @@ void register_progress()
     si.get_height = [](void* data) { return reinterpret_cast<progress_source*>(data)->get_height(); };
     si.get_defaults = [](obs_data_t* settings) {
         obs_data_set_default_int(settings, S_PROGRESS_FG, 0xFF10BC40);
+        obs_data_set_default_int(settings, S_PROGRESS_FG2, 0xFFBC9410);
         obs_data_set_default_int(settings, S_PROGRESS_BG, 0xFF323232);
         obs_data_set_default_int(settings, S_PROGRESS_CX, 300);
         obs_data_set_default_int(settings, S_PROGRESS_CY, 30);
+        obs_data_set_default_int(settings, S_PROGRESS_STYLE, style_flat);
+        obs_data_set_default_int(settings, S_PROGRESS_SEGMENTS, 10);
+        obs_data_set_default_int(settings, S_PROGRESS_THICKNESS, 10);
         obs_data_set_default_bool(settings, S_PROGRESS_HIDE_PAUSED, false);
+        obs_data_set_default_bool(settings, S_PROGRESS_AUTO_COLOR, false);
     };
 
     si.update = [](void* data, obs_data_t* settings) { reinterpret_cast<progress_source*>(data)->update(settings); };
@@ -19,24 +19,56 @@
 #pragma once
 #include "../query/music_source.hpp"
 #include <obs-module.h>
+#include <vector>
 namespace obs_sources {
 
+enum progress_style {
+    style_flat,
+    style_rounded,
+    style_gradient,
+    style_segmented,
+    style_circular
+};
+
 class progress_source {
     uint32_t m_cx = 300, m_cy = 30;
-    uint32_t m_fg {}, m_bg {};
+    uint32_t m_fg {}, m_fg2 {}, m_bg {};
     obs_source_t* m_source = nullptr;
     float m_progress = 0.f;
     float m_bounce_progress = 0.f;
 
-    /* Song progress grabbed from current music source */
-    int32_t m_synced_progress = 0;
-    int32_t m_duration = 0;
-    /* Song progress adjusted with frame time */
-    float m_adjusted_progress = 0.f;
     bool m_bounce_up = true;
     play_state m_state = state_unknown;
     bool m_use_bg = true;
     bool m_hide_paused = false;
+    bool m_auto_color = false;
+    uint64_t m_cover_version = 0;
+    /* Last published song, only copied again if the query thread published
+     * a new one. The progress is extrapolated from its clock every frame */
+    song m_song {};
+    uint64_t m_version = 0;
+    progress_style m_style = style_flat;
+    uint32_t m_segments = 10;
+    uint32_t m_thickness = 10;
+
+    /* The whole bar is a single triangle list with vertex colors, it's only
+     * rebuilt if the visible geometry changes (e.g. the next pixel of
+     * progress was reached) */
+    gs_vertbuffer_t* m_vb = nullptr;
+    size_t m_vb_capacity = 0, m_vb_count = 0;
+    std::vector<vec3> m_points {};
+    std::vector<uint32_t> m_colors {};
+    int64_t m_mesh_key = -1;
+    bool m_mesh_dirty = true;
+    bool m_mesh_changed = false;
+
+    void add_quad(float x0, float y0, float x1, float y1, uint32_t c0, uint32_t c1);
+    void add_bar(float x0, float x1, uint32_t color);
+    void add_arc(float t0, float t1, uint32_t color);
+    int64_t mesh_key() const;
+    void apply_cover_colors();
+    void build_mesh();
+    void upload_mesh();
 
 public:
     progress_source(obs_source_t* src, obs_data_t* settings);
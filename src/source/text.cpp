@@ -0,0 +1,180 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#include "text.hpp"
+#include "../util/constants.hpp"
+#include "../util/trace.hpp"
+#include "../util/tuna_thread.hpp"
+#include "../util/utility.hpp"
+#include <algorithm>
+
+namespace obs_sources {
+text_source::text_source(obs_source_t*, obs_data_t* settings)
+{
+    m_text_settings = obs_data_create();
+    m_text = obs_source_create_private(S_TEXT_INTERNAL_ID, "tuna_text", m_text_settings);
+    if (!m_text)
+        bwarn("Couldn't create internal text source '%s'", S_TEXT_INTERNAL_ID);
+    m_version = tuna_thread::copy_version - 1;
+    update(settings);
+}
+
+text_source::~text_source()
+{
+    obs_source_release(m_text);
+    obs_data_release(m_text_settings);
+}
+
+void text_source::update(obs_data_t* settings)
+{
+    m_format.compile(utf8_to_qt(obs_data_get_string(settings, S_TEXT_FORMAT)));
+    m_placeholder = utf8_to_qt(obs_data_get_string(settings, S_TEXT_PLACEHOLDER));
+
+    /* Everything else belongs to the text source, the text itself is
+     * only set once it's rendered in the next tick */
+    obs_data_apply(m_text_settings, settings);
+    obs_data_set_string(m_text_settings, "text", qt_to_utf8(m_current));
+    if (m_text)
+        obs_source_update(m_text, m_text_settings);
+    m_dirty = true;
+}
+
+void text_source::refresh_text()
+{
+    QString text;
+    m_format.execute(text, m_song);
+    if (text.isEmpty() || m_song.get<int>(meta::STATUS) >= state_paused)
+        text = m_placeholder;
+
+    if (text == m_current)
+        return;
+    m_current = text;
+    obs_data_set_string(m_text_settings, "text", qt_to_utf8(m_current));
+    if (m_text)
+        obs_source_update(m_text, m_text_settings);
+}
+
+void text_source::tick(float seconds)
+{
+    UNUSED_PARAMETER(seconds);
+    auto render = m_dirty;
+
+    /* Only take the lock and compare the song if the query thread
+     * published something new */
+    const uint64_t version = tuna_thread::copy_version;
+    if (version != m_version) {
+        song tmp;
+        {
+            auto lock = trace::lock(tuna_thread::copy_mutex, "wait copy_mutex");
+            tmp = tuna_thread::copy;
+        }
+        m_version = version;
+
+        if (m_format.all_fields())
+            render |= tmp.data() != m_song.data();
+        else
+            render |= tmp.get<int>(meta::STATUS) != m_song.get<int>(meta::STATUS) || !tmp.same_fields(m_song, m_format.fields());
+        m_song = tmp;
+    }
+
+    /* The cover colors can arrive after the song itself */
+    if (util::cover_version() != m_cover_version) {
+        m_cover_version = util::cover_version();
+        auto const& fields = m_format.fields();
+        render |= m_format.all_fields() || std::find(fields.begin(), fields.end(), meta::COVER) != fields.end();
+    }
+
+    /* {progress} and {time_left} only change once per second,
+     * lyrics whenever the next line is reached */
+    if (m_format.time_dependent()) {
+        const auto progress = m_song.progress_now();
+        render |= progress / 1000 != m_second;
+        m_second = progress / 1000;
+
+        if (lyrics::version() != m_lyrics_version) {
+            m_lyrics_version = lyrics::version();
+            m_lyrics = lyrics::current();
+            render = true;
+        }
+        const int line = m_lyrics ? m_lyrics->index_at(progress) : -1;
+        render |= line != m_lyrics_line;
+        m_lyrics_line = line;
+    }
+
+    if (render)
+        refresh_text();
+    m_dirty = false;
+}
+
+void text_source::render(gs_effect_t* effect)
+{
+    UNUSED_PARAMETER(effect);
+    if (m_text)
+        obs_source_video_render(m_text);
+}
+
+obs_properties_t* text_source::get_properties()
+{
+    auto* p = obs_properties_create();
+    obs_properties_add_text(p, S_TEXT_FORMAT, T_TEXT_FORMAT, OBS_TEXT_MULTILINE);
+    obs_properties_add_text(p, S_TEXT_PLACEHOLDER, T_TEXT_PLACEHOLDER, OBS_TEXT_DEFAULT);
+
+    if (!m_text) {
+        obs_properties_add_text(p, "unavailable", T_TEXT_UNAVAILABLE, OBS_TEXT_INFO);
+        return p;
+    }
+
+    /* The settings of the text source are shown as they are, except
+     * for the ones that set the text */
+    auto* text_props = obs_source_properties(m_text);
+    obs_properties_remove_by_name(text_props, "text");
+    obs_properties_remove_by_name(text_props, "from_file");
+    obs_properties_remove_by_name(text_props, "text_file");
+    obs_properties_remove_by_name(text_props, "read_from_file");
+    obs_properties_remove_by_name(text_props, "file");
+    obs_properties_add_group(p, "appearance", T_TEXT_APPEARANCE, OBS_GROUP_NORMAL, text_props);
+    return p;
+}
+
+void register_text()
+{
+    obs_source_info si {};
+    si.id = S_TEXT_ID;
+    si.type = OBS_SOURCE_TYPE_INPUT;
+    si.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW;
+    si.get_properties = [](void* data) { return reinterpret_cast<text_source*>(data)->get_properties(); };
+    si.get_name = [](void*) { return T_TEXT_NAME; };
+    si.create = [](obs_data_t* d, obs_source_t* s) { return static_cast<void*>(new text_source(s, d)); };
+    si.destroy = [](void* data) { delete reinterpret_cast<text_source*>(data); };
+    si.get_width = [](void* data) { return reinterpret_cast<text_source*>(data)->get_width(); };
+    si.get_height = [](void* data) { return reinterpret_cast<text_source*>(data)->get_height(); };
+    si.get_defaults = [](obs_data_t* settings) {
+        obs_data_set_default_string(settings, S_TEXT_FORMAT, "{artists} - {title}");
+        obs_data_set_default_string(settings, S_TEXT_PLACEHOLDER, "");
+    };
+
+    si.update = [](void* data, obs_data_t* settings) { reinterpret_cast<text_source*>(data)->update(settings); };
+    si.video_tick = [](void* data, float seconds) { reinterpret_cast<text_source*>(data)->tick(seconds); };
+    si.video_render = [](void* data, gs_effect_t* effect) {
+        reinterpret_cast<text_source*>(data)->render(effect);
+    };
+
+    obs_register_source(&si);
+}
+}
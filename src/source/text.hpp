@@ -0,0 +1,62 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#pragma once
+#include "../query/song.hpp"
+#include "../util/format.hpp"
+#include "../util/lyrics_handler.hpp"
+#include <obs-module.h>
+
+namespace obs_sources {
+
+/* Shows a format string with the current song by using a private
+ * OBS text source, so no output file is needed */
+class text_source {
+    obs_source_t* m_text = nullptr;
+    obs_data_t* m_text_settings = nullptr;
+
+    format::compiled_format m_format {};
+    QString m_placeholder {};
+    QString m_current {};
+    song m_song {};
+    uint64_t m_version = 0;
+    int32_t m_second = -1;
+    std::shared_ptr<const lyrics::synced> m_lyrics {};
+    uint64_t m_lyrics_version = 0;
+    int m_lyrics_line = -1;
+    uint64_t m_cover_version = 0;
+    bool m_dirty = true;
+
+    void refresh_text();
+
+public:
+    text_source(obs_source_t* src, obs_data_t* settings);
+    ~text_source();
+
+    inline void update(obs_data_t* settings);
+    inline void tick(float seconds);
+    inline void render(gs_effect_t* effect);
+    obs_properties_t* get_properties();
+
+    uint32_t get_width() const { return m_text ? obs_source_get_width(m_text) : 0; }
+    uint32_t get_height() const { return m_text ? obs_source_get_height(m_text) : 0; }
+};
+
+extern void register_text();
+}
@@ -20,10 +20,14 @@
 #include "gui/tuna_gui.hpp"
 #include "gui/widgets/lastfm.hpp"
 #include "query/vlc_obs_source.hpp"
+#include "source/cover.hpp"
 #include "source/progress.hpp"
+#include "source/text.hpp"
 #include "util/config.hpp"
 #include "util/constants.hpp"
+#include "util/cover_tag_handler.hpp"
 #include "util/format.hpp"
+#include "util/history.hpp"
 #include "util/tuna_thread.hpp"
 #include "util/utility.hpp"
 #include <QAction>
@@ -99,11 +103,15 @@ bool obs_module_load()
     binfo("Loading v%s-%s-%s (build time %s). Qt version: compile-time: %s, run-time: %s. libobs: compile-time: %i.%i.%i, run-time: %s",
         TUNA_VERSION, GIT_BRANCH, GIT_COMMIT_HASH, BUILD_TIME, QT_VERSION_STR, qVersion(), LIBOBS_API_MAJOR_VER, LIBOBS_API_MINOR_VER, LIBOBS_API_PATCH_VER, obs_get_version_string());
     config::init();
+    cover::init_index();
     register_gui();
     music_sources::init();
     config::load();
+    history::load(util::get_config_file_path(HISTORY_FILE));
     format::init();
     obs_sources::register_progress();
+    obs_sources::register_cover();
+    obs_sources::register_text();
     obs_frontend_add_save_callback(&tuna_save_cb, nullptr);
 
     obs_frontend_add_event_callback([](enum obs_frontend_event event, void*) {
@@ -120,7 +128,7 @@ void vlc_next_cb(void*, obs_hotkey_id id, obs_hotkey_t*, bool pressed)
         return;
     auto src = music_sources::get<vlc_obs_source>(S_SOURCE_VLC);
     if (src && src->enabled())
-        src->next_vlc_source();
+        music_sources::post(src, [src] { src->next_vlc_source(); });
 }
 
 void vlc_prev_cb(void*, obs_hotkey_id id, obs_hotkey_t*, bool pressed)
@@ -129,7 +137,7 @@ void vlc_prev_cb(void*, obs_hotkey_id id, obs_hotkey_t*, bool pressed)
         return;
     auto src = music_sources::get<vlc_obs_source>(S_SOURCE_VLC);
     if (src && src->enabled())
-        src->prev_vlc_source();
+        music_sources::post(src, [src] { src->prev_vlc_source(); });
 }
 
 void obs_module_post_load()
@@ -152,4 +160,6 @@ void obs_module_unload()
 {
     bdebug("Shutting down...");
     config::close();
+    history::close();
+    cover::free_index();
 }
@@ -19,6 +19,8 @@
 #include "config.hpp"
 #include "../query/music_source.hpp"
 #include "constants.hpp"
+#include "cover_tag_handler.hpp"
+#include "normalizer.hpp"
 #include "tuna_thread.hpp"
 #include "utility.hpp"
 #include "web_server.hpp"
@@ -36,22 +38,9 @@
 namespace config {
 
 bool post_load = false;
-QList<output> outputs;
 config_t* instance = nullptr;
-uint16_t refresh_rate = 1000;
-uint16_t webserver_port = 1608;
-uint16_t cover_size = 256;
-QString placeholder = {};
-QString cover_path = {};
-QString lyrics_path = {};
-QString cover_placeholder = {};
-QString selected_source = {};
-bool webserver_enabled = false;
-bool download_cover = true;
-bool download_lyrics = false;
-bool download_missing_cover = true;
-bool placeholder_when_paused = true;
-bool remove_file_extensions = true;
+
+static QString cover_placeholder_file {};
 
 void init()
 {
@@ -63,6 +52,7 @@ void init()
     QString path_song_file = QDir::toNativeSeparators(home.absoluteFilePath("song.txt"));
     QString path_cover_art = QDir::toNativeSeparators(home.absoluteFilePath("cover.png"));
     QString path_lyrics = QDir::toNativeSeparators(home.absoluteFilePath("lyrics.txt"));
+    const snapshot defaults;
 
     CDEF_STR(CFG_SONG_PATH, qt_to_utf8(path_song_file));
     CDEF_STR(CFG_COVER_PATH, qt_to_utf8(path_cover_art));
@@ -70,15 +60,23 @@ void init()
     CDEF_STR(CFG_SELECTED_SOURCE, S_SOURCE_SPOTIFY);
     CDEF_STR(CFG_SPOTIFY_CLIENT_ID, "847d7cf0c5dc4ff185161d1f000a9d0e");
 
-    CDEF_BOOL(CFG_REMOVE_EXTENSIONS, config::remove_file_extensions);
-    CDEF_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED, config::placeholder_when_paused);
+    CDEF_BOOL(CFG_REMOVE_EXTENSIONS, defaults.remove_file_extensions);
+    CDEF_BOOL(CFG_REMOVE_TITLE_CLUTTER, defaults.remove_title_clutter);
+    CDEF_BOOL(CFG_SPLIT_FEATURED, defaults.split_featured);
+    CDEF_STR(CFG_TITLE_RULES, "[]");
+    CDEF_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED, defaults.placeholder_when_paused);
     CDEF_BOOL(CFG_RUNNING, false);
-    CDEF_BOOL(CFG_DOWNLOAD_LYRICS, config::download_lyrics);
-    CDEF_BOOL(CFG_DOWNLOAD_COVER, config::download_cover);
-    CDEF_BOOL(CFG_DOWNLOAD_MISSING_COVER, config::download_missing_cover);
-    CDEF_UINT(CFG_COVER_SIZE, config::cover_size);
-    CDEF_UINT(CFG_REFRESH_RATE, config::refresh_rate);
-    CDEF_UINT(CFG_SERVER_PORT, config::webserver_port);
+    CDEF_BOOL(CFG_DOWNLOAD_LYRICS, defaults.download_lyrics);
+    CDEF_BOOL(CFG_DOWNLOAD_COVER, defaults.download_cover);
+    CDEF_BOOL(CFG_DOWNLOAD_MISSING_COVER, defaults.download_missing_cover);
+    CDEF_UINT(CFG_COVER_SIZE, defaults.cover_size);
+    CDEF_STR(CFG_COVER_NAMES, qt_to_utf8(defaults.cover_names.join(',')));
+    CDEF_STR(CFG_ITUNES_SEARCH_URL, qt_to_utf8(defaults.itunes_search_url));
+    CDEF_UINT(CFG_REFRESH_RATE, defaults.refresh_rate);
+    CDEF_BOOL(CFG_FALLBACK_ENABLED, defaults.fallback_enabled);
+    CDEF_STR(CFG_FALLBACK_SOURCES, "");
+    CDEF_UINT(CFG_FALLBACK_HOLD, defaults.fallback_hold);
+    CDEF_UINT(CFG_SERVER_PORT, defaults.webserver_port);
     CDEF_STR(CFG_SONG_PLACEHOLDER, T_PLACEHOLDER);
 
     CDEF_BOOL(CFG_DOCK_VISIBLE, false);
@@ -87,8 +85,13 @@ void init()
     CDEF_BOOL(CFG_SERVER_ENABLED, false);
 
     auto tmp = obs_module_file("placeholder.png");
-    cover_placeholder = tmp;
+    cover_placeholder_file = tmp;
     bfree((void*)tmp);
+
+    /* Until the settings are loaded the defaults are used */
+    auto initial = *get();
+    initial.cover_placeholder = cover_placeholder_file;
+    publish(std::move(initial));
 }
 
 void load()
@@ -96,23 +99,50 @@ void load()
     if (!instance)
         init();
 
-    tuna_thread::thread_mutex.lock();
-    load_outputs();
-    cover_path = CGET_STR(CFG_COVER_PATH);
-    lyrics_path = CGET_STR(CFG_LYRICS_PATH);
-    refresh_rate = CGET_UINT(CFG_REFRESH_RATE);
-    placeholder = CGET_STR(CFG_SONG_PLACEHOLDER);
-    download_lyrics = CGET_BOOL(CFG_DOWNLOAD_LYRICS);
-    download_cover = CGET_BOOL(CFG_DOWNLOAD_COVER);
-    download_missing_cover = CGET_BOOL(CFG_DOWNLOAD_MISSING_COVER);
-    placeholder_when_paused = CGET_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED);
-    remove_file_extensions = CGET_BOOL(CFG_REMOVE_EXTENSIONS);
-    webserver_enabled = CGET_BOOL(CFG_SERVER_ENABLED);
-    webserver_port = CGET_UINT(CFG_SERVER_PORT);
-    selected_source = CGET_STR(CFG_SELECTED_SOURCE);
-    cover_size = CGET_UINT(CFG_COVER_SIZE);
+    /* Threads keep running with the previous snapshot until this one is published */
+    snapshot s;
+    load_outputs(s.outputs);
+    s.cover_path = CGET_STR(CFG_COVER_PATH);
+    s.lyrics_path = CGET_STR(CFG_LYRICS_PATH);
+    s.cover_placeholder = cover_placeholder_file;
+    s.refresh_rate = CGET_UINT(CFG_REFRESH_RATE);
+    s.placeholder = CGET_STR(CFG_SONG_PLACEHOLDER);
+    s.download_lyrics = CGET_BOOL(CFG_DOWNLOAD_LYRICS);
+    s.download_cover = CGET_BOOL(CFG_DOWNLOAD_COVER);
+    s.download_missing_cover = CGET_BOOL(CFG_DOWNLOAD_MISSING_COVER);
+    s.placeholder_when_paused = CGET_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED);
+    s.remove_file_extensions = CGET_BOOL(CFG_REMOVE_EXTENSIONS);
+    s.remove_title_clutter = CGET_BOOL(CFG_REMOVE_TITLE_CLUTTER);
+    s.split_featured = CGET_BOOL(CFG_SPLIT_FEATURED);
+    s.title_rules = normalize::rules_from_config(utf8_to_qt(CGET_STR(CFG_TITLE_RULES)));
+    s.webserver_enabled = CGET_BOOL(CFG_SERVER_ENABLED);
+    s.webserver_port = CGET_UINT(CFG_SERVER_PORT);
+    s.selected_source = CGET_STR(CFG_SELECTED_SOURCE);
+    s.cover_size = CGET_UINT(CFG_COVER_SIZE);
+    s.cover_names = utf8_to_qt(CGET_STR(CFG_COVER_NAMES)).toLower().split(',', Qt::SkipEmptyParts);
+    for (auto& name : s.cover_names)
+        name = name.trimmed();
+    s.fallback_enabled = CGET_BOOL(CFG_FALLBACK_ENABLED);
+    s.fallback_sources = utf8_to_qt(CGET_STR(CFG_FALLBACK_SOURCES)).split(',', Qt::SkipEmptyParts);
+    s.fallback_hold = CGET_UINT(CFG_FALLBACK_HOLD);
+    s.itunes_search_url = utf8_to_qt(CGET_STR(CFG_ITUNES_SEARCH_URL));
+
+    normalize::rules rules;
+    rules.remove_extensions = s.remove_file_extensions;
+    rules.remove_clutter = s.remove_title_clutter;
+    rules.split_featured = s.split_featured;
+    rules.user_patterns = s.title_rules;
+    s.normalizer = std::make_shared<const normalize::engine>(rules);
+
+    const auto webserver_enabled = s.webserver_enabled;
+    const auto selected_source = s.selected_source;
+    publish(std::move(s));
+
+    /* The cover names might have changed */
+    cover::clear_index();
+
+    /* Sources load their settings on their own worker */
     music_sources::load();
-    tuna_thread::thread_mutex.unlock();
 
     auto run = CGET_BOOL(CFG_RUNNING);
     if (run && !tuna_thread::start())
@@ -128,29 +158,34 @@ void load()
     music_sources::select(qt_to_utf8(selected_source));
 }
 
-void save()
+void save(snapshot const& s)
 {
     bdebug("Saving config...");
-    tuna_thread::thread_mutex.lock();
-    CSET_STR(CFG_COVER_PATH, qt_to_utf8(cover_path));
-    CSET_STR(CFG_LYRICS_PATH, qt_to_utf8(lyrics_path));
-    CSET_UINT(CFG_REFRESH_RATE, refresh_rate);
-    CSET_STR(CFG_SONG_PLACEHOLDER, qt_to_utf8(placeholder));
-    CSET_BOOL(CFG_DOWNLOAD_LYRICS, download_lyrics);
-    CSET_BOOL(CFG_DOWNLOAD_COVER, download_cover);
-    CSET_BOOL(CFG_DOWNLOAD_MISSING_COVER, download_missing_cover);
-    CSET_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED, placeholder_when_paused);
-    CSET_BOOL(CFG_REMOVE_EXTENSIONS, remove_file_extensions);
-    CSET_BOOL(CFG_SERVER_ENABLED, webserver_enabled);
-    CSET_UINT(CFG_SERVER_PORT, webserver_port);
-    CSET_STR(CFG_SELECTED_SOURCE, qt_to_utf8(selected_source));
-    CSET_UINT(CFG_COVER_SIZE, cover_size);
-    save_outputs();
-    tuna_thread::thread_mutex.unlock();
+    CSET_STR(CFG_COVER_PATH, qt_to_utf8(s.cover_path));
+    CSET_STR(CFG_LYRICS_PATH, qt_to_utf8(s.lyrics_path));
+    CSET_UINT(CFG_REFRESH_RATE, s.refresh_rate);
+    CSET_STR(CFG_SONG_PLACEHOLDER, qt_to_utf8(s.placeholder));
+    CSET_BOOL(CFG_DOWNLOAD_LYRICS, s.download_lyrics);
+    CSET_BOOL(CFG_DOWNLOAD_COVER, s.download_cover);
+    CSET_BOOL(CFG_DOWNLOAD_MISSING_COVER, s.download_missing_cover);
+    CSET_BOOL(CFG_PLACEHOLDER_WHEN_PAUSED, s.placeholder_when_paused);
+    CSET_BOOL(CFG_REMOVE_EXTENSIONS, s.remove_file_extensions);
+    CSET_BOOL(CFG_REMOVE_TITLE_CLUTTER, s.remove_title_clutter);
+    CSET_BOOL(CFG_SPLIT_FEATURED, s.split_featured);
+    CSET_STR(CFG_TITLE_RULES, qt_to_utf8(normalize::rules_to_config(s.title_rules)));
+    CSET_BOOL(CFG_SERVER_ENABLED, s.webserver_enabled);
+    CSET_UINT(CFG_SERVER_PORT, s.webserver_port);
+    CSET_STR(CFG_SELECTED_SOURCE, qt_to_utf8(s.selected_source));
+    CSET_UINT(CFG_COVER_SIZE, s.cover_size);
+    CSET_STR(CFG_COVER_NAMES, qt_to_utf8(s.cover_names.join(',')));
+    CSET_BOOL(CFG_FALLBACK_ENABLED, s.fallback_enabled);
+    CSET_STR(CFG_FALLBACK_SOURCES, qt_to_utf8(s.fallback_sources.join(',')));
+    CSET_UINT(CFG_FALLBACK_HOLD, s.fallback_hold);
+    save_outputs(s.outputs);
     bdebug("Saved config.");
 }
 
-void load_outputs()
+void load_outputs(QList<output>& outputs)
 {
     auto legacy_convert = [](const QString& old) -> QString {
         static std::vector<std::tuple<QString, QString>> conversions = {
@@ -203,7 +238,7 @@ void load_outputs()
     }
 }
 
-void save_outputs()
+void save_outputs(QList<output> const& outputs)
 {
     QJsonArray output_array;
     for (const auto& o : std::as_const(outputs)) {
@@ -211,7 +246,7 @@ void save_outputs()
         output[JSON_FORMAT_ID] = o.format;
         output[JSON_OUTPUT_PATH_ID] = QDir::toNativeSeparators(o.path);
         output[JSON_FORMAT_LOG_MODE] = o.log_mode;
-        output[JSON_LAST_OUTPUT] = o.last_output;
+        output[JSON_LAST_OUTPUT] = util::last_output(o);
         output_array.append(output);
     }
     util::save_config(OUTPUT_FILE, QJsonDocument(output_array));
@@ -219,7 +254,7 @@ void save_outputs()
 
 void close()
 {
-    save();
+    save(*get());
     tuna_thread::stop();
     web_thread::stop();
     util::reset_cover();
@@ -20,6 +20,8 @@
 
 #include <QList>
 #include <QString>
+#include <QStringList>
+#include <memory>
 #include <util/config-file.h>
 
 /* Config macros */
@@ -27,16 +29,19 @@
 #define CDEF_INT(id, value) config_set_default_int(config::instance, CFG_REGION, id, value)
 #define CDEF_UINT(id, value) config_set_default_uint(config::instance, CFG_REGION, id, value)
 #define CDEF_BOOL(id, value) config_set_default_bool(config::instance, CFG_REGION, id, value)
+#define CDEF_DOUBLE(id, value) config_set_default_double(config::instance, CFG_REGION, id, value)
 
 #define CGET_STR(id) config_get_string(config::instance, CFG_REGION, id)
 #define CGET_INT(id) config_get_int(config::instance, CFG_REGION, id)
 #define CGET_UINT(id) config_get_uint(config::instance, CFG_REGION, id)
 #define CGET_BOOL(id) config_get_bool(config::instance, CFG_REGION, id)
+#define CGET_DOUBLE(id) config_get_double(config::instance, CFG_REGION, id)
 
 #define CSET_STR(id, value) config_set_string(config::instance, CFG_REGION, id, value)
 #define CSET_INT(id, value) config_set_int(config::instance, CFG_REGION, id, value)
 #define CSET_UINT(id, value) config_set_uint(config::instance, CFG_REGION, id, value)
 #define CSET_BOOL(id, value) config_set_bool(config::instance, CFG_REGION, id, value)
+#define CSET_DOUBLE(id, value) config_set_double(config::instance, CFG_REGION, id, value)
 
 /* clang-format off */
 
@@ -58,7 +63,14 @@
 #define CFG_DOWNLOAD_COVER              "download_cover"
 #define CFG_DOWNLOAD_MISSING_COVER      "download_missing_cover"
 #define CFG_COVER_SIZE                  "cover_size"
+#define CFG_COVER_NAMES                 "cover_names"
 #define CFG_REMOVE_EXTENSIONS           "removeextensions"
+#define CFG_REMOVE_TITLE_CLUTTER        "remove_title_clutter"
+#define CFG_SPLIT_FEATURED              "split_featured"
+#define CFG_TITLE_RULES                 "title_rules"
+#define CFG_FALLBACK_ENABLED            "fallback.enabled"
+#define CFG_FALLBACK_SOURCES            "fallback.sources"
+#define CFG_FALLBACK_HOLD               "fallback.hold"
 
 #define CFG_SPOTIFY_LOGGEDIN            "spotify.login"
 #define CFG_SPOTIFY_TOKEN               "spotify.token"
@@ -68,6 +80,8 @@
 #define CFG_SPOTIFY_CLIENT_ID           "spotify.client_id"
 #define CFG_SPOTIFY_CLIENT_SECRET       "spotify.client_secret"
 #define CFG_SPOTIFY_REQUEST_TIMEOUT     "spotify.request_timeout"
+#define CFG_SPOTIFY_TOKEN_URL           "spotify.token_url"
+#define CFG_SPOTIFY_API_URL             "spotify.api_url"
 
 #define CFG_DEEZER_CLIENT_ID            "deezer.client.id"
 #define CFG_DEEZER_CLIENT_SECRET        "deezer.client.secret"
@@ -82,12 +96,22 @@
 
 #define CFG_LASTFM_USERNAME             "lastfm.username"
 #define CFG_LASTFM_API_KEY              "lastfm.apikey"
+#define CFG_LASTFM_API_URL              "lastfm.api_url"
+
+#define CFG_ITUNES_SEARCH_URL           "itunes.search_url"
 
 #define CFG_WMC_PLAYER                  "wmc.player"
 
 #define CFG_MPRIS_PLAYER                "mpris.player"
 
 #define CFG_ICECAST_URL                 "icecast.url"
+#define CFG_ICECAST_MOUNT               "icecast.mount"
+#define CFG_ICECAST_USE_ICY             "icecast.use_icy"
+
+#define CFG_REPLAY_FILE                 "replay.file"
+#define CFG_REPLAY_SPEED                "replay.speed"
+#define CFG_REPLAY_LOOP                 "replay.loop"
+#define CFG_RECORD_FILE                 "record.file"
 
 #define CFG_WINDOW_TITLE                "window.title"
 #define CFG_WINDOW_PAUSE                "window.title.pause"
@@ -106,44 +130,70 @@
 #define CFG_DOCK_SOURCE_VISIBLE         "dock_source_visible"
 /* clang-format on */
 
+namespace normalize {
+class engine;
+}
+
 namespace config {
 struct output {
     QString format;
     QString path;
-    QString last_output;
+    QString last_output; /* Only as it was loaded, see util::last_output */
     bool log_mode;
 };
 
+/* Every setting the query, web and render threads use. A snapshot is never
+ * modified once it's published, changes publish a new one instead */
+struct snapshot {
+    uint16_t refresh_rate = 1000;
+    uint16_t webserver_port = 1608;
+
+    QString selected_source {};
+    QString placeholder {};
+    QString cover_path {};
+    QString lyrics_path {};
+    QString cover_placeholder {};
+
+    QList<output> outputs {};
+    bool webserver_enabled = false;
+    bool download_cover = true;
+    bool download_lyrics = false;
+    bool download_missing_cover = true;
+    bool remove_file_extensions = true;
+    bool remove_title_clutter = false;
+    bool split_featured = false;
+    QStringList title_rules {}; /* Patterns that are removed from titles */
+    std::shared_ptr<const normalize::engine> normalizer {}; /* Built from the options above */
+    bool placeholder_when_paused = true;
+    uint16_t cover_size = 256;
+    QStringList cover_names { "cover", "folder", "front", "album" }; /* Local cover file names by priority, lower case */
+    QString itunes_search_url { "https://itunes.apple.com/search" }; /* Only changed for testing */
+    bool fallback_enabled = false;
+    QStringList fallback_sources {}; /* Source ids ordered by priority */
+    uint16_t fallback_hold = 3000;
+};
+
 extern config_t* instance;
 extern bool post_load;
 
-/* Temp storage for config values */
-extern uint16_t refresh_rate;
-extern uint16_t webserver_port;
-
-extern QString selected_source;
-extern QString placeholder;
-extern QString cover_path;
-extern QString lyrics_path;
-extern QString cover_placeholder;
-
-extern QList<output> outputs;
-extern bool webserver_enabled;
-extern bool download_cover;
-extern bool download_lyrics;
-extern bool download_missing_cover;
-extern bool remove_file_extensions;
-extern bool placeholder_when_paused;
-extern uint16_t cover_size;
+/* The current settings. Only the first call on a thread after a change
+ * takes a lock, otherwise this is a single atomic read */
+extern std::shared_ptr<const snapshot> get();
+
+/* Replaces the current settings, threads pick them up on their next get() */
+extern void publish(snapshot s);
 
 void init();
 
+/* Reads the settings from the OBS config, publishes them and
+ * starts/stops threads accordingly */
 void load();
 
-void save();
+/* Writes the settings to the OBS config */
+void save(snapshot const& s);
 void close();
 
-void load_outputs();
+void load_outputs(QList<output>& outputs);
 
-void save_outputs();
+void save_outputs(QList<output> const& outputs);
 } // namespace config
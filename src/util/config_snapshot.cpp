@@ -0,0 +1,53 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "config.hpp"
+#include "normalizer.hpp"
+#include <atomic>
+#include <mutex>
+
+/* Kept apart from config.cpp, which reads and writes the OBS config,
+ * so that the core library doesn't depend on the frontend */
+namespace config {
+
+static std::mutex publish_mutex;
+static std::shared_ptr<const snapshot> current = std::make_shared<const snapshot>();
+static std::atomic<uint64_t> current_version { 1 };
+
+std::shared_ptr<const snapshot> get()
+{
+    /* Each thread holds on to the last snapshot it saw, so the lock is
+     * only taken once per change */
+    thread_local std::shared_ptr<const snapshot> local;
+    thread_local uint64_t local_version = 0;
+    if (current_version.load(std::memory_order_acquire) != local_version) {
+        std::lock_guard<std::mutex> lock(publish_mutex);
+        local = current;
+        local_version = current_version;
+    }
+    return local;
+}
+
+void publish(snapshot s)
+{
+    auto next = std::make_shared<const snapshot>(std::move(s));
+    std::lock_guard<std::mutex> lock(publish_mutex);
+    current = std::move(next);
+    current_version.fetch_add(1, std::memory_order_release);
+}
+}
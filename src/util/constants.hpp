@@ -34,6 +34,7 @@
 #define S_SOURCE_WEB            "web"
 #define S_SOURCE_DEEZER         "deezer"
 #define S_SOURCE_ICECAST        "icecast"
+#define S_SOURCE_REPLAY         "replay"
 
 #define S_PROGRESS_FG           "fg"
 #define S_PROGRESS_BG           "bg"
@@ -42,6 +43,25 @@
 #define S_PROGRESS_ID           "progress_bar"
 #define S_PROGRESS_USE_BG       "use_bg"
 #define S_PROGRESS_HIDE_PAUSED  "hide_paused"
+#define S_PROGRESS_STYLE        "style"
+#define S_PROGRESS_FG2          "fg2"
+#define S_PROGRESS_SEGMENTS     "segments"
+#define S_PROGRESS_THICKNESS    "thickness"
+#define S_PROGRESS_AUTO_COLOR   "auto_color"
+
+#define S_COVER_ID              "song_cover"
+#define S_COVER_CX              "cx"
+#define S_COVER_CY              "cy"
+#define S_COVER_FADE            "fade"
+
+#define S_TEXT_ID               "song_text"
+#define S_TEXT_FORMAT           "tuna_format"
+#define S_TEXT_PLACEHOLDER      "tuna_placeholder"
+#ifdef _WIN32
+#define S_TEXT_INTERNAL_ID      "text_gdiplus_v2"
+#else
+#define S_TEXT_INTERNAL_ID      "text_ft2_source_v2"
+#endif
 
 #define S_HOTKEY_NEXT           "tuna.hotkey.vlc.next"
 #define S_HOTKEY_PREV           "tuna.hotkey.vlc.prev"
@@ -66,6 +86,7 @@
 #define T_SOURCE_WEB            T_("tuna.gui.tab.web")
 #define T_SOURCE_DEEZER         T_("tuna.gui.tab.deezer")
 #define T_SOURCE_MPRIS          T_("tuna.gui.tab.mpris")
+#define T_SOURCE_REPLAY         T_("tuna.gui.tab.replay")
 
 #define T_PLACEHOLDER           T_("tuna.config.song.placeholder")
 #define T_FORMAT                T_("tuna.config.song.format")
@@ -73,7 +94,21 @@
 #define T_SELECT_COVER_FILE     T_("tuna.gui.select.cover.file")
 #define T_SELECT_LYRICS_FILE    T_("tuna.gui.select.lyrics.file")
 #define T_SELECT_MPD_FOLDER     T_("tuna.gui.select.mpd.folder")
+#define T_SELECT_RECORDING_FILE T_("tuna.gui.select.recording.file")
+#define T_RECORD_START          T_("tuna.gui.tab.replay.record.start")
+#define T_RECORD_STOP           T_("tuna.gui.tab.replay.record.stop")
 #define T_LARGEST_COVER         T_("tuna.gui.tab.basics.song.cover.largest")
+#define T_METRICS               T_("tuna.gui.tab.metrics")
+#define T_METRICS_NAME          T_("tuna.gui.tab.metrics.name")
+#define T_METRICS_LABEL         T_("tuna.gui.tab.metrics.label")
+#define T_METRICS_COUNT         T_("tuna.gui.tab.metrics.count")
+#define T_METRICS_AVG           T_("tuna.gui.tab.metrics.avg")
+#define T_METRICS_P95           T_("tuna.gui.tab.metrics.p95")
+#define T_METRICS_MAX           T_("tuna.gui.tab.metrics.max")
+#define T_TRACE_RECORD          T_("tuna.gui.tab.metrics.trace.record")
+#define T_TRACE_RECORD_TOOLTIP  T_("tuna.gui.tab.metrics.trace.record.tooltip")
+#define T_TRACE_SAVE            T_("tuna.gui.tab.metrics.trace.save")
+#define T_TRACE_SAVE_FILE       T_("tuna.gui.tab.metrics.trace.save.file")
 
 #define T_SONG_PATH             T_("tuna.gui.tab.basics.song.info")
 #define T_SONG_FORMAT           T_("tuna.gui.tab.basics.song.format")
@@ -96,12 +131,35 @@
 #define T_PROGRESS_NAME         T_("tuna.source.progress.name")
 #define T_PROGRESS_USE_BG       T_("tuna.source.progress.use.bg")
 #define T_PROGRESS_HIDE_PAUSED  T_("tuna.source.progress.hide.paused")
+#define T_PROGRESS_STYLE        T_("tuna.source.progress.style")
+#define T_PROGRESS_FLAT         T_("tuna.source.progress.style.flat")
+#define T_PROGRESS_ROUNDED      T_("tuna.source.progress.style.rounded")
+#define T_PROGRESS_GRADIENT     T_("tuna.source.progress.style.gradient")
+#define T_PROGRESS_SEGMENTED    T_("tuna.source.progress.style.segmented")
+#define T_PROGRESS_CIRCULAR     T_("tuna.source.progress.style.circular")
+#define T_PROGRESS_FG2          T_("tuna.source.progress.color.fg2")
+#define T_PROGRESS_SEGMENTS     T_("tuna.source.progress.segments")
+#define T_PROGRESS_THICKNESS    T_("tuna.source.progress.thickness")
+#define T_PROGRESS_AUTO_COLOR   T_("tuna.source.progress.auto.color")
+
+#define T_COVER_NAME            T_("tuna.source.cover.name")
+#define T_COVER_CX              T_("tuna.source.cover.cx")
+#define T_COVER_CY              T_("tuna.source.cover.cy")
+#define T_COVER_FADE            T_("tuna.source.cover.fade")
+
+#define T_TEXT_NAME             T_("tuna.source.text.name")
+#define T_TEXT_FORMAT           T_("tuna.source.text.format")
+#define T_TEXT_PLACEHOLDER      T_("tuna.source.text.placeholder")
+#define T_TEXT_APPEARANCE       T_("tuna.source.text.appearance")
+#define T_TEXT_UNAVAILABLE      T_("tuna.source.text.unavailable")
 
 #define T_DOCK_MENU_TITLE       T_("tuna.dock.menu.title")
 #define T_DOCK_TOGGLE_VOLUME    T_("tuna.dock.menu.toggle.volume")
 #define T_DOCK_TOGGLE_SOURCE    T_("tuna.dock.menu.toggle.source")
 #define T_DOCK_TOGGLE_INFO      T_("tuna.dock.menu.toggle.info")
 #define T_DOCK_SONG_INFO        T_("tuna.dock.label.song")
+#define T_DOCK_EXPORT_SETLIST   T_("tuna.dock.menu.export.setlist")
+#define T_DOCK_SETLIST_FILE     T_("tuna.dock.menu.export.setlist.file")
 #define FILTER(name, type)         name " (" type ");;All Files(*)"
 
 /* Outputs are saved into config folder on linux, but on windows
@@ -110,6 +168,7 @@
 #define CONFIG_FOLDER ".config/"
 #define OUTPUT_FILE "outputs.json"
 #define VLC_SCENE_MAPPING "tuna_vlc_mappings.json"
+#define HISTORY_FILE "history.bin"
 
 #define JSON_OUTPUT_PATH_ID     "output"
 #define JSON_FORMAT_ID             "format"
@@ -118,6 +177,7 @@
 
 #define STATUS_RETRY_AFTER         429
 #define HTTP_NO_CONTENT            204
+#define HTTP_UNAUTHORIZED          401
 #define HTTP_OK                    200
 
 /* clang-format on */
@@ -16,215 +16,172 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *************************************************************************/
 
-/* Parts of this file are taken from Rainmeter
- *  https://github.com/rainmeter/rainmeter/blob/master/Library/NowPlaying/Cover.cpp
- *  https://github.com/rainmeter/rainmeter/blob/39c2ed8bf0eefe411dbb8d94a8d82659dac341ab/Library/NowPlaying/Player.cpp
- */
-
 #include "cover_tag_handler.hpp"
 #include "../query/song.hpp"
 #include "config.hpp"
+#include "tag_reader.hpp"
 #include "utility.hpp"
+#include <QDateTime>
 #include <QDir>
-#include <QDirIterator>
 #include <QFile>
 #include <QFileInfo>
-#include <taglib/apefile.h>
-#include <taglib/apeitem.h>
-#include <taglib/apetag.h>
-#include <taglib/asffile.h>
-#include <taglib/attachedpictureframe.h>
-#include <taglib/fileref.h>
-#include <taglib/flacfile.h>
-#include <taglib/id3v2frame.h>
-#include <taglib/id3v2tag.h>
-#include <taglib/mp4file.h>
-#include <taglib/mpcfile.h>
-#include <taglib/mpegfile.h>
-#include <taglib/opusfile.h>
-#include <taglib/tlist.h>
-#include <taglib/tmap.h>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QImageReader>
+#include <climits>
+#include <mutex>
+
+#define MAX_INDEXED_FOLDERS 256
+#define MAX_ASPECT_CHECKS 16
 
 namespace cover {
 
-bool write_bytes_to_file(const TagLib::ByteVector& data)
+bool find_embedded_cover(const QString& path, uint32_t parts)
 {
-    if (data.isEmpty())
-        return false;
-    QFile f(config::cover_path);
-    bool success = true;
-    if (f.open(QIODevice::WriteOnly)) {
-        success = f.write(data.data(), data.size()) == data.size();
-        f.close();
-    } else {
-        success = false;
-    }
-
-    return success;
+    auto t = tags::read(path, parts | tags::PART_COVER);
+    return t && util::set_cover(t->cover);
 }
 
-bool extract_ape(TagLib::APE::Tag* tag)
+static std::mutex index_mutex;
+static QHash<QString, QString> index; /* Folder -> best cover, empty if there's none */
+static QStringList index_order;       /* Oldest first */
+static QFileSystemWatcher* watcher = nullptr;
+
+void init_index()
 {
-    const TagLib::APE::ItemListMap& listMap = tag->itemListMap();
-    if (listMap.contains("COVER ART (FRONT)")) {
-        const TagLib::ByteVector nullStringTerminator(1, 0);
-        TagLib::ByteVector item = listMap["COVER ART (FRONT)"].value();
-        const int pos = item.find(nullStringTerminator); // Skip the filename.
-        if (pos != -1) {
-            const TagLib::ByteVector& pic = item.mid(pos + 1);
-            return write_bytes_to_file(pic);
+    watcher = new QFileSystemWatcher();
+    QObject::connect(watcher, &QFileSystemWatcher::directoryChanged, watcher, [](QString const& folder) {
+        {
+            std::lock_guard<std::mutex> lock(index_mutex);
+            index.remove(folder);
+            index_order.removeOne(folder);
         }
-    }
-
-    return false;
+        /* Watched again once it's indexed the next time */
+        watcher->removePath(folder);
+    });
 }
 
-bool extract_id3(TagLib::ID3v2::Tag* tag)
+void free_index()
 {
-    const TagLib::ID3v2::FrameList& frameList = tag->frameList("APIC");
-    if (!frameList.isEmpty()) {
-        const auto* frame = (TagLib::ID3v2::AttachedPictureFrame*)frameList.front();
-        return write_bytes_to_file(frame->picture());
-    }
-    return false;
+    clear_index();
+    delete watcher;
+    watcher = nullptr;
 }
 
-bool extract_asf(TagLib::ASF::File* file)
+void clear_index()
 {
-    const TagLib::ASF::AttributeListMap& attrListMap = file->tag()->attributeListMap();
-    if (attrListMap.contains("WM/Picture")) {
-        const TagLib::ASF::AttributeList& attrList = attrListMap["WM/Picture"];
-        if (!attrList.isEmpty()) {
-            // Let's grab the first cover. TODO: Check/loop for correct type.
-            const TagLib::ASF::Picture& wmpic = attrList[0].toPicture();
-            if (wmpic.isValid()) {
-                return write_bytes_to_file(wmpic.picture());
-            }
-        }
+    std::lock_guard<std::mutex> lock(index_mutex);
+    index.clear();
+    index_order.clear();
+    if (watcher) {
+        QMetaObject::invokeMethod(watcher, [] {
+            if (!watcher->directories().isEmpty())
+                watcher->removePaths(watcher->directories());
+        });
     }
-
-    return false;
 }
 
-bool extract_flac(TagLib::FLAC::File* file)
+/* Lower is better, images without any of the names come last */
+static int name_rank(QString const& base_name, QStringList const& names)
 {
-    const TagLib::List<TagLib::FLAC::Picture*>& picList = file->pictureList();
-    if (!picList.isEmpty()) {
-        // Just grab the first image.
-        const TagLib::FLAC::Picture* pic = picList[0];
-        return write_bytes_to_file(pic->data());
+    const auto lower = base_name.toLower();
+    for (int i = 0; i < names.size(); i++) {
+        if (lower.contains(names[i]))
+            return i;
     }
-
-    return false;
+    return names.size();
 }
 
-bool extract_mp4(TagLib::MP4::File* file)
+static QString pick_cover(QString const& folder)
 {
-    TagLib::MP4::Tag* tag = file->tag();
-    const TagLib::MP4::ItemMap& itemListMap = tag->itemMap();
-    if (itemListMap.contains("covr")) {
-        const TagLib::MP4::CoverArtList& coverArtList = itemListMap["covr"].toCoverArtList();
-        if (!coverArtList.isEmpty()) {
-            const TagLib::MP4::CoverArt* pic = &(coverArtList.front());
-            return write_bytes_to_file(pic->data());
+    static const QStringList exts = { "*.jpg", "*.jpeg", "*.png", "*.bmp" };
+    const auto names = config::get()->cover_names;
+
+    /* The listing already contains the file sizes */
+    QFileInfoList candidates;
+    int best_rank = INT_MAX;
+    for (auto const& info : QDir(folder).entryInfoList(exts, QDir::Files)) {
+        const int rank = name_rank(info.completeBaseName(), names);
+        if (rank < best_rank) {
+            best_rank = rank;
+            candidates.clear();
         }
+        if (rank == best_rank)
+            candidates.append(info);
     }
 
-    return false;
-}
-
-bool extract_opus(TagLib::Ogg::Opus::File* file)
-{
-    auto* tag = file->tag();
-    auto pictures = tag->pictureList();
-    if (!pictures.isEmpty()) {
-        /* I'll just assume that the last image is the one with the biggest size */
-        return write_bytes_to_file(pictures[pictures.size() - 1]->data());
-    }
-    return false;
-}
-
-bool get_embedded(TagLib::FileRef fr)
-{
-    bool found = false;
+    /* Prefer roughly square images (covers rather than scans of the booklet
+     * or the back), then the biggest one. Checking the aspect ratio reads the
+     * image headers, so it's skipped for folders full of images */
+    const bool check_aspect = candidates.size() <= MAX_ASPECT_CHECKS;
+    QString best;
+    bool best_square = false;
+    qint64 best_size = -1;
+    for (auto const& info : std::as_const(candidates)) {
+        bool square = false;
+        if (check_aspect) {
+            const auto size = QImageReader(info.filePath()).size();
+            if (size.isValid() && size.height() > 0) {
+                const auto ratio = double(size.width()) / size.height();
+                square = ratio > 0.8 && ratio < 1.25;
+            }
+        }
 
-    if (TagLib::MPEG::File* mpeg = dynamic_cast<TagLib::MPEG::File*>(fr.file())) {
-        if (mpeg->hasID3v2Tag()) {
-            found = extract_id3(mpeg->ID3v2Tag());
-        } else if (mpeg->hasAPETag()) {
-            found = extract_ape(mpeg->APETag());
+        if ((square && !best_square) || (square == best_square && info.size() > best_size)) {
+            best = info.filePath();
+            best_square = square;
+            best_size = info.size();
         }
-    } else if (TagLib::FLAC::File* flac = dynamic_cast<TagLib::FLAC::File*>(fr.file())) {
-        found = extract_flac(flac);
-        if (!found && flac->ID3v2Tag())
-            found = extract_id3(flac->ID3v2Tag());
-    } else if (TagLib::MP4::File* mp4 = dynamic_cast<TagLib::MP4::File*>(fr.file())) {
-        found = extract_mp4(mp4);
-    } else if (TagLib::ASF::File* asf = dynamic_cast<TagLib::ASF::File*>(fr.file())) {
-        found = extract_asf(asf);
-    } else if (TagLib::APE::File* ape = dynamic_cast<TagLib::APE::File*>(fr.file())) {
-        if (ape->APETag())
-            found = extract_ape(ape->APETag());
-    } else if (TagLib::MPC::File* mpc = dynamic_cast<TagLib::MPC::File*>(fr.file())) {
-        if (mpc->APETag())
-            found = extract_ape(mpc->APETag());
-    } else if (TagLib::Ogg::Opus::File* ogg = dynamic_cast<TagLib::Ogg::Opus::File*>(fr.file())) {
-        if (ogg->tag())
-            found = extract_opus(ogg);
     }
-
-    return found;
-}
-
-bool find_embedded_cover(const QString& path)
-{
-    bool result = false;
-#ifdef _WIN32
-    // Windoze can't into utf8
-    const auto wstr = path.toStdWString();
-    const TagLib::FileRef fr(wstr.c_str(), false);
-#else
-    const TagLib::FileRef fr(qt_to_utf8(path), false);
-#endif
-
-    if (!fr.isNull())
-        result = get_embedded(fr);
-    return result;
+    return best;
 }
 
 bool find_local_cover(const QString& folder, QString& out)
 {
-    static QStringList exts = { "*.jpg", "*.jpeg", "*.png", "*.bmp" };
-    QList<QString> OtherFiles;
-    QDirIterator it(folder, exts, QDir::Files, QDirIterator::NoIteratorFlags);
-    while (it.hasNext()) {
-        if (it.next().contains("cover", Qt::CaseInsensitive)) {
-            out = it.filePath();
-            return true;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        auto it = index.constFind(folder);
+        if (it != index.constEnd()) {
+            out = it.value();
+            return !out.isEmpty();
         }
-        OtherFiles.append(it.filePath());
     }
 
-    /* If we couldn't find a file named cover, we resort to picking the largest
-     * image file in the folder
-     */
-    qint64 biggest_image_size = 0;
-    QString biggest_image = "";
-
-    for (const auto& file : OtherFiles) {
-        QFileInfo info(file);
-        if (info.size() > biggest_image_size) {
-            biggest_image = file;
-            biggest_image_size = info.size();
+    /* Taken before listing, so that a change in between can be noticed once
+     * the folder is watched */
+    const auto modified = QFileInfo(folder).lastModified();
+    auto best = pick_cover(folder);
+
+    QString evicted;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        if (!index.contains(folder))
+            index_order.append(folder);
+        index[folder] = best;
+        if (index_order.size() > MAX_INDEXED_FOLDERS) {
+            evicted = index_order.takeFirst();
+            index.remove(evicted);
         }
     }
 
-    if (!biggest_image.isEmpty()) {
-        out = biggest_image;
-        return true;
+    if (watcher) {
+        QMetaObject::invokeMethod(watcher, [folder, evicted, modified] {
+            if (!evicted.isEmpty())
+                watcher->removePath(evicted);
+            watcher->addPath(folder);
+
+            /* Covers added or removed before the watch was in place */
+            if (QFileInfo(folder).lastModified() != modified) {
+                std::lock_guard<std::mutex> lock(index_mutex);
+                index.remove(folder);
+                index_order.removeOne(folder);
+                watcher->removePath(folder);
+            }
+        });
     }
 
-    return false;
+    out = best;
+    return !out.isEmpty();
 }
 
 void get_file_folder(QString& path)
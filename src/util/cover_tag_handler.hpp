@@ -18,14 +18,22 @@
 
 #pragma once
 #include <QString>
+#include <stdint.h>
 
 namespace cover {
-/* Tries to get the song embbeded in the file */
-extern bool find_embedded_cover(const QString& path);
+/* Tries to get the song embbeded in the file, other parts of the tags
+ * that will be needed later can be read at the same time */
+extern bool find_embedded_cover(const QString& path, uint32_t parts = 0);
 
-/* Tries to find the cover in the folder that the file is located in */
+/* Tries to find the cover in the folder that the file is located in,
+ * the result is kept until the folder changes */
 extern bool find_local_cover(const QString& path, QString& cover_out);
 
+/* Has to be called on the UI thread, the index watches folders for changes */
+extern void init_index();
+extern void free_index();
+extern void clear_index();
+
 /* Turns /home/usr/file.flac into /home/usr/ */
 extern void get_file_folder(QString& path);
 }
@@ -17,16 +17,20 @@
  *************************************************************************/
 
 #include "format.hpp"
-#include "../query/music_source.hpp"
 #include "../query/song.hpp"
 #include "../util/config.hpp"
-#include "../util/tuna_thread.hpp"
+#include "../util/history.hpp"
+#include "../util/lyrics_handler.hpp"
+#include <QHash>
 #include <QJsonDocument>
 #include <QLocale>
+#include <algorithm>
+#include <mutex>
 
 namespace format {
 
 std::vector<std::unique_ptr<specifier>> specifiers;
+static metadata_check provides_metadata = nullptr;
 
 const specifier* get_specifier_by_id(QString const& id, bool& upper)
 {
@@ -49,6 +53,23 @@ QString time_format(int32_t ms)
     return t.toString(hour > 0 ? "h:mm:ss" : "m:ss");
 }
 
+/* Color of the current cover, empty if there's none */
+static QString cover_color(QRgb palette::colors::*color)
+{
+    auto cover = util::get_cover();
+    return cover && cover->palette.valid ? palette::to_hex(cover->palette.*color) : "";
+}
+
+/* Synced lyrics line relative to the one at the current position */
+static QString lyrics_line(song const& s, int offset)
+{
+    auto l = lyrics::current();
+    if (!l)
+        return "";
+    auto i = l->index_at(s.progress_now()) + offset;
+    return i >= 0 && i < l->size() ? (*l)[i].text : "";
+}
+
 void init()
 {
 #define int_specifier(name, meta)                                                    \
@@ -57,12 +78,7 @@ void init()
     }));
 
     /* Register format specifiers with their data */
-    specifiers.emplace_back(new specifier("title", meta::TITLE, [](song const& s) -> QString {
-        auto title = s.get(meta::TITLE);
-        if (config::remove_file_extensions)
-            title = util::remove_extensions(title);
-        return title;
-    }));
+    specifiers.emplace_back(new specifier("title", meta::TITLE));
     specifiers.emplace_back(new specifier("album", meta::ALBUM));
     specifiers.emplace_back(new specifier("label", meta::LABEL));
     specifiers.emplace_back(new specifier("file_name", meta::FILE_NAME));
@@ -75,13 +91,20 @@ void init()
     int_specifier("disc_number", meta::DISC_NUMBER);
 
     specifiers.emplace_back(new specifier("progress", meta::PROGRESS, [](song const& s) -> QString {
-        return time_format(s.get<int>(meta::PROGRESS));
+        return time_format(s.progress_now());
     }));
     specifiers.emplace_back(new specifier("duration", meta::DURATION, [](song const& s) -> QString {
         return time_format(s.get<int>(meta::DURATION));
     }));
     specifiers.emplace_back(new specifier("time_left", { meta::PROGRESS, meta::DURATION }, [](song const& s) -> QString {
-        return time_format(s.get<int>(meta::DURATION) - s.get<int>(meta::PROGRESS));
+        return time_format(s.get<int>(meta::DURATION) - s.progress_now());
+    }));
+
+    specifiers.emplace_back(new specifier("lyrics_line", meta::PROGRESS, [](song const& s) -> QString {
+        return lyrics_line(s, 0);
+    }));
+    specifiers.emplace_back(new specifier("lyrics_next", meta::PROGRESS, [](song const& s) -> QString {
+        return lyrics_line(s, 1);
     }));
 
     specifiers.emplace_back(new specifier("release_date", meta::RELEASE, [](song const& s) -> QString {
@@ -156,82 +179,165 @@ void init()
     int_specifier("disc_total", meta::DISC_TOTAL);
     int_specifier("track_total", meta::TRACK_TOTAL);
 
+    /* IceCast */
+    int_specifier("listeners", meta::LISTENERS);
+
+    /* File tags */
+    specifiers.emplace_back(new specifier("composer", meta::COMPOSER));
+
+    /* Title as reported by the source, before normalization */
+    specifiers.emplace_back(new specifier("original_title", meta::TITLE, [](song const& s) -> QString {
+        return s.get(meta::ORIGINAL_TITLE, s.get(meta::TITLE));
+    }));
+
+    /* Cover palette */
+    specifiers.emplace_back(new specifier("cover_color_dominant", meta::COVER, [](song const&) -> QString {
+        return cover_color(&palette::colors::dominant);
+    }));
+    specifiers.emplace_back(new specifier("cover_color_vibrant", meta::COVER, [](song const&) -> QString {
+        return cover_color(&palette::colors::vibrant);
+    }));
+    specifiers.emplace_back(new specifier("cover_color_muted", meta::COVER, [](song const&) -> QString {
+        return cover_color(&palette::colors::muted);
+    }));
+    specifiers.emplace_back(new specifier("cover_color_text", meta::COVER, [](song const&) -> QString {
+        return cover_color(&palette::colors::text);
+    }));
+
+    /* Play history */
+    specifiers.emplace_back(new static_specifier("prev_title", [](song const& s) -> QString {
+        history::entry e;
+        return history::previous(s, e) ? e.track.get(meta::TITLE) : "";
+    }));
+    specifiers.emplace_back(new static_specifier("prev_artists", [](song const& s) -> QString {
+        history::entry e;
+        return history::previous(s, e) ? e.track.get<QStringList>(meta::ARTIST).join(", ") : "";
+    }));
+    specifiers.emplace_back(new static_specifier("prev_album", [](song const& s) -> QString {
+        history::entry e;
+        return history::previous(s, e) ? e.track.get(meta::ALBUM) : "";
+    }));
+
     std::sort(specifiers.begin(), specifiers.end(), [](auto const& a, auto const& b) {
         return a->get_id()[0] < b->get_id()[0];
     });
 }
 
-bool execute(QString& q)
+/* Formats of the outputs rarely change, so they're only compiled once. Old
+ * ones are dropped all at once, there are only ever a handful in use */
+#define MAX_CACHED_FORMATS 64
+static std::mutex cache_mutex;
+static QHash<QString, std::shared_ptr<const compiled_format>> cache;
+
+bool execute(QString& q, song const& s)
+{
+    std::shared_ptr<const compiled_format> compiled;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = cache.constFind(q);
+        if (it != cache.constEnd()) {
+            compiled = it.value();
+        } else {
+            if (cache.size() >= MAX_CACHED_FORMATS)
+                cache.clear();
+            compiled = std::make_shared<const compiled_format>(q);
+            cache.insert(q, compiled);
+        }
+    }
+    return compiled->execute(q, s);
+}
+
+void set_metadata_check(metadata_check check)
 {
-    auto src_ref = music_sources::selected_source();
-    auto copy = q;
-    auto result = true;
-    q = "";
+    provides_metadata = check;
+}
 
-    auto handle_specifier = [&copy](QString::Iterator& it, int& truncate, bool& uppercase, bool& proper_formatting) -> specifier const* {
-        QString id = "";
+void compiled_format::compile(QString const& format)
+{
+    m_tokens.clear();
+    m_fields.clear();
+    m_valid = true;
+    m_all_fields = false;
+    m_time_dependent = false;
 
-        while (it != copy.end() && *it != '}' && *it != ':') {
-            id += *it;
-            ++it;
+    token text;
+    auto flush_text = [&] {
+        if (!text.text.isEmpty())
+            m_tokens.emplace_back(std::move(text));
+        text = {};
+    };
+
+    auto it = format.begin();
+    while (it != format.end()) {
+        if (*it == '\\') {
+            if (++it == format.end())
+                break;
+            text.text += *it++;
+            continue;
         }
 
-        if (*it == ':') {
-            ++it;
-            QString tr = "";
-            while (it != copy.end() && *it != '}') {
+        if (*it != '{') {
+            text.text += *it++;
+            continue;
+        }
+
+        /* {id} or {id:truncate}, an unterminated specifier drops
+         * the remaining text */
+        QString id, tr;
+        for (++it; it != format.end() && *it != '}' && *it != ':'; ++it)
+            id += *it;
+        if (it != format.end() && *it == ':') {
+            for (++it; it != format.end() && *it != '}'; ++it)
                 tr += *it;
-                ++it;
-            }
-            truncate = tr.toInt();
         }
+        if (it == format.end())
+            break;
+        ++it;
 
-        if (*it == '}') {
-            proper_formatting = true;
-            return get_specifier_by_id(id, uppercase);
+        token t;
+        t.spec = get_specifier_by_id(id, t.uppercase);
+        t.truncate = tr.toInt();
+        if (!t.spec) {
+            /* Only well formed specifiers like {test} are reported as unsupported */
+            m_valid = false;
+            continue;
         }
-        return nullptr;
-    };
 
-    for (auto it = copy.begin();; ++it) {
-        if (*it == '\\') {
-            ++it;
-            if (it == copy.end())
-                break;
-            q += *it;
+        for (auto cap : t.spec->get_required_caps()) {
+            if (cap == meta::NONE)
+                m_all_fields = true;
+            else if (std::find(m_fields.begin(), m_fields.end(), cap) == m_fields.end())
+                m_fields.emplace_back(cap);
+            if (cap == meta::PROGRESS)
+                m_time_dependent = true;
+        }
+        flush_text();
+        m_tokens.emplace_back(std::move(t));
+    }
+    flush_text();
+}
+
+bool compiled_format::execute(QString& out, song const& s) const
+{
+    /* m_fields contains the meta data of every specifier, so the source
+     * only has to be asked once */
+    auto result = m_valid && (!provides_metadata || provides_metadata(m_fields));
+    out = "";
+
+    for (auto const& t : m_tokens) {
+        if (!t.spec) {
+            out += t.text;
             continue;
         }
 
-        if (*it == '{') {
-            ++it;
-            if (it == copy.end())
-                return result;
-            int truncate = 0;
-            bool uppercase = false;
-            bool formatting = false;
-            if (auto* spec = handle_specifier(it, truncate, uppercase, formatting)) {
-                auto data = spec->get_data(src_ref->song_info());
-                if (!src_ref->provides_metadata(spec->get_required_caps()))
-                    result = false;
-                if (truncate > 0 && data.length() > truncate) {
-                    data.truncate(truncate);
-                    data.append("...");
-                }
-                if (uppercase)
-                    data = data.toUpper();
-                q += data;
-            } else if (formatting) {
-                // We only tell the user that the selected formatting specifier
-                // isn't supported if the formatting is correct eg. {test}
-                // but not with {test
-                result = false;
-            }
-        } else {
-            if (it != copy.end())
-                q += *it;
+        auto data = t.spec->get_data(s);
+        if (t.truncate > 0 && data.length() > t.truncate) {
+            data.truncate(t.truncate);
+            data.append("...");
         }
-        if (it == copy.end())
-            return result;
+        if (t.uppercase)
+            data = data.toUpper();
+        out += data;
     }
     return result;
 }
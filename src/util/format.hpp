@@ -29,7 +29,13 @@ class song;
 namespace format {
 
 void init();
-bool execute(QString& out);
+/* Fills in the specifiers of the format with information from the song */
+bool execute(QString& out, song const& s);
+
+/* Tells whether the active source provides the given meta data, set by the
+ * music sources so that formats can be executed without any of them */
+using metadata_check = bool (*)(std::vector<meta::type> const& fields);
+void set_metadata_check(metadata_check check);
 
 class specifier {
 protected:
@@ -92,4 +98,36 @@ public:
 
 extern const std::vector<std::unique_ptr<specifier>>& get_specifiers();
 
+/* A format string that was split into text and specifiers once, so that it
+ * can be executed repeatedly without parsing it again */
+class compiled_format {
+    struct token {
+        QString text {};
+        specifier const* spec = nullptr;
+        int truncate = 0;
+        bool uppercase = false;
+    };
+    std::vector<token> m_tokens {};
+    std::vector<meta::type> m_fields {};
+    bool m_valid = true;
+    bool m_all_fields = false;
+    bool m_time_dependent = false;
+
+public:
+    compiled_format() = default;
+    explicit compiled_format(QString const& format) { compile(format); }
+
+    void compile(QString const& format);
+    /* Returns false if a specifier is unknown or not provided by the active source */
+    bool execute(QString& out, song const& s) const;
+
+    /* Meta data the output depends on, if all_fields() is true it depends
+     * on the entire song (e.g. {json_compact}) */
+    std::vector<meta::type> const& fields() const { return m_fields; }
+    bool all_fields() const { return m_all_fields; }
+    /* Output changes with the playback position ({progress}, {time_left}) */
+    bool time_dependent() const { return m_time_dependent; }
+};
+
+
 }
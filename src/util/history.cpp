@@ -0,0 +1,227 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#include "history.hpp"
+#include "utility.hpp"
+#include <QCborValue>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#define HISTORY_MAGIC "TUNAHIST"
+#define HISTORY_VERSION 1
+/* Songs kept in memory, the log is compacted once it holds this many times more */
+#define HISTORY_SIZE 500
+#define HISTORY_COMPACT_FACTOR 4
+
+namespace history {
+
+static std::mutex history_mutex;
+static std::deque<entry> entries;
+static QFile file;
+static size_t logged = 0;
+static int64_t session_start = 0;
+static song last;
+
+static const std::vector<meta::type> identity = { meta::TITLE, meta::ARTIST, meta::ALBUM };
+
+static void setup_stream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream.setByteOrder(QDataStream::LittleEndian);
+}
+
+static void write_entry(QDataStream& stream, entry const& e)
+{
+    stream << qint64(e.time) << e.source.toUtf8() << QCborValue::fromJsonValue(e.track.data()).toCbor();
+}
+
+static song without_progress(QJsonObject data)
+{
+    data.remove(meta::ids[meta::PROGRESS]);
+    song result;
+    result.set_data(data);
+    return result;
+}
+
+static void push(entry&& e)
+{
+    entries.emplace_back(std::move(e));
+    while (entries.size() > HISTORY_SIZE)
+        entries.pop_front();
+}
+
+/* Rewrites the log with only the songs in memory and keeps it open for appending */
+static bool compact()
+{
+    const auto path = file.fileName();
+    file.close();
+
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly)) {
+        berr("Couldn't write play history to %s", qt_to_utf8(path));
+        return false;
+    }
+    QDataStream stream(&out);
+    setup_stream(stream);
+    stream.writeRawData(HISTORY_MAGIC, int(strlen(HISTORY_MAGIC)));
+    stream << quint8(HISTORY_VERSION);
+    for (auto const& e : entries)
+        write_entry(stream, e);
+    if (stream.status() != QDataStream::Ok || !out.commit()) {
+        berr("Couldn't write play history to %s", qt_to_utf8(path));
+        return false;
+    }
+    logged = entries.size();
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        berr("Couldn't open play history %s", qt_to_utf8(path));
+        return false;
+    }
+    return true;
+}
+
+bool load(QString const& path)
+{
+    std::lock_guard<std::mutex> lock(history_mutex);
+    file.close();
+    file.setFileName(path);
+    entries.clear();
+    logged = 0;
+    last = song();
+    session_start = util::epoch();
+
+    QFile f(path);
+    if (f.open(QIODevice::ReadOnly)) {
+        QDataStream stream(&f);
+        setup_stream(stream);
+        char magic[sizeof(HISTORY_MAGIC) - 1];
+        quint8 version = 0;
+        if (stream.readRawData(magic, int(sizeof(magic))) == int(sizeof(magic)) && memcmp(magic, HISTORY_MAGIC, sizeof(magic)) == 0)
+            stream >> version;
+
+        if (version == HISTORY_VERSION) {
+            while (!stream.atEnd()) {
+                qint64 time;
+                QByteArray id, cbor;
+                stream >> time >> id >> cbor;
+                if (stream.status() != QDataStream::Ok) {
+                    bwarn("Play history %s ends with an incomplete entry", qt_to_utf8(path));
+                    break;
+                }
+                entry e { time, QString::fromUtf8(id), without_progress(QCborValue::fromCbor(cbor).toJsonValue().toObject()) };
+                push(std::move(e));
+                logged++;
+            }
+        } else {
+            bwarn("%s is not a play history, starting a new one", qt_to_utf8(path));
+        }
+        f.close();
+    }
+
+    /* Also writes the header of a new log and drops an incomplete entry at the end */
+    return compact();
+}
+
+void close()
+{
+    std::lock_guard<std::mutex> lock(history_mutex);
+    file.close();
+}
+
+void observe(song const& s, const char* source)
+{
+    if (s.get<int>(meta::STATUS) != state_playing || s.get(meta::TITLE).isEmpty())
+        return;
+
+    std::lock_guard<std::mutex> lock(history_mutex);
+    if (last.same_fields(s, identity))
+        return;
+    last = s;
+    push({ util::epoch(), QString::fromUtf8(source), without_progress(s.data()) });
+
+    if (!file.isOpen())
+        return;
+    QDataStream stream(&file);
+    setup_stream(stream);
+    write_entry(stream, entries.back());
+    if (stream.status() != QDataStream::Ok || !file.flush()) {
+        berr("Couldn't write to play history %s", qt_to_utf8(file.fileName()));
+        file.close();
+        return;
+    }
+
+    if (++logged > HISTORY_SIZE * HISTORY_COMPACT_FACTOR)
+        compact();
+}
+
+std::vector<entry> recent(size_t limit)
+{
+    std::lock_guard<std::mutex> lock(history_mutex);
+    std::vector<entry> result;
+    result.reserve(std::min(limit, entries.size()));
+    for (auto it = entries.rbegin(); it != entries.rend() && result.size() < limit; ++it)
+        result.push_back(*it);
+    return result;
+}
+
+bool previous(song const& current, entry& out)
+{
+    std::lock_guard<std::mutex> lock(history_mutex);
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (!it->track.same_fields(current, identity)) {
+            out = *it;
+            return true;
+        }
+    }
+    return false;
+}
+
+void to_json(entry const& e, QJsonObject& obj)
+{
+    obj = e.track.data();
+    obj["played_at"] = qint64(e.time);
+    obj["source"] = e.source;
+}
+
+QString setlist()
+{
+    std::lock_guard<std::mutex> lock(history_mutex);
+    QString result;
+    int64_t first = -1;
+    for (auto const& e : entries) {
+        if (e.time < session_start)
+            continue;
+        if (first < 0)
+            first = e.time;
+
+        const auto secs = e.time - first;
+        result += QString("%1:%2:%3 ").arg(secs / 3600).arg(secs / 60 % 60, 2, 10, QChar('0')).arg(secs % 60, 2, 10, QChar('0'));
+        const auto artists = e.track.get<QStringList>(meta::ARTIST).join(", ");
+        if (!artists.isEmpty())
+            result += artists + " - ";
+        result += e.track.get(meta::TITLE) + "\n";
+    }
+    return result;
+}
+}
@@ -0,0 +1,67 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#pragma once
+#include "../query/song.hpp"
+#include <QString>
+#include <stdint.h>
+#include <vector>
+
+/* Songs that were played, newest last. The most recent ones are kept in memory
+ * and every new song is appended to a log in the config folder:
+ *
+ *   qint64   unix time when the song started
+ *   bytes    source id (utf8)
+ *   bytes    meta data of the song (CBOR)
+ *
+ * written with QDataStream like recordings, so entries are length prefixed and
+ * one that was cut off by a crash is dropped when loading. Once the log holds
+ * a lot more songs than are kept in memory it is rewritten with only those */
+namespace history {
+
+struct entry {
+    int64_t time = 0;
+    QString source {};
+    /* Only the meta data without progress, the clock of a song that was
+     * played earlier has no meaning */
+    song track {};
+};
+
+/* Loads the log, songs from now on belong to a new session */
+extern bool load(QString const& path);
+extern void close();
+
+/* Called with the shown song whenever it changes, it's only added if it's
+ * playing and a different song than the last one */
+extern void observe(song const& s, const char* source);
+
+/* Up to limit songs, newest first */
+extern std::vector<entry> recent(size_t limit);
+
+/* The last song that isn't the given one, false if there's none */
+extern bool previous(song const& current, entry& out);
+
+/* Meta data of the entry as it was played, including its own cover path
+ * instead of the current cover, with played_at and source */
+extern void to_json(entry const& e, QJsonObject& obj);
+
+/* Songs of this session as "h:mm:ss Artists - Title" lines, with the time
+ * relative to the first one, e.g. for video chapters */
+extern QString setlist();
+}
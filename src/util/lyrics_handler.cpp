@@ -17,46 +17,186 @@
  *************************************************************************/
 
 #include "lyrics_handler.hpp"
+#include "tag_reader.hpp"
 #include "utility.hpp"
-#include <taglib/fileref.h>
-#include <taglib/tpropertymap.h>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 namespace lyrics {
 
-bool download_missing_lyrics(const song&)
+static std::mutex current_mutex;
+static std::shared_ptr<const synced> current_lyrics;
+static std::atomic<uint64_t> current_version { 0 };
+
+void set_current(std::shared_ptr<const synced> lyrics)
 {
-    /* TODO */
-    return false;
+    std::lock_guard<std::mutex> lock(current_mutex);
+    if (lyrics == current_lyrics)
+        return;
+    current_lyrics = std::move(lyrics);
+    current_version++;
+}
+
+std::shared_ptr<const synced> current()
+{
+    std::lock_guard<std::mutex> lock(current_mutex);
+    return current_lyrics;
+}
+
+uint64_t version()
+{
+    return current_version;
+}
+
+/* [mm:ss], [mm:ss.x], [mm:ss.xx] or [mm:ss.xxx], some files use a colon
+ * instead of the dot */
+static bool parse_time(QString const& tag, int32_t& ms)
+{
+    auto colon = tag.indexOf(':');
+    if (colon < 1)
+        return false;
+
+    bool ok_min = false, ok_sec = true;
+    auto minutes = tag.left(colon).toInt(&ok_min);
+    auto rest = tag.mid(colon + 1);
+    auto sep = rest.indexOf('.');
+    if (sep < 0)
+        sep = rest.indexOf(':');
+    auto seconds = (sep < 0 ? rest : rest.left(sep)).toInt(&ok_sec);
+    if (!ok_min || !ok_sec || minutes < 0 || seconds < 0 || seconds > 59)
+        return false;
+
+    int32_t fraction = 0;
+    if (sep >= 0) {
+        auto digits = rest.mid(sep + 1);
+        bool ok = false;
+        fraction = digits.toInt(&ok);
+        if (!ok || digits.isEmpty() || digits.length() > 3)
+            return false;
+        for (auto i = digits.length(); i < 3; i++)
+            fraction *= 10;
+    }
+    ms = (minutes * 60 + seconds) * 1000 + fraction;
+    return true;
 }
 
-bool get_embedded(TagLib::FileRef fr)
+bool synced::parse_lrc(QString const& text)
 {
-    bool found = false;
-    TagLib::PropertyMap tags = fr.file()->properties();
+    m_lines.clear();
+    int32_t offset = 0;
 
-    for (TagLib::PropertyMap::ConstIterator i = tags.begin(); i != tags.end(); ++i) {
-        for (TagLib::StringList::ConstIterator j = i->second.begin(); j != i->second.end(); ++j) {
-            if (utf8_to_qt(i->first.toCString(true)).toLower().contains("lyrics")) {
-                return util::write_lyrics(utf8_to_qt((*j).toCString(true)));
+    for (auto l : text.split('\n')) {
+        l = l.trimmed();
+        std::vector<int32_t> times;
+        int pos = 0;
+
+        /* A line can have multiple timestamps if it's repeated */
+        while (pos < l.length() && l[pos] == '[') {
+            auto close = l.indexOf(']', pos);
+            if (close < 0)
+                break;
+            auto tag = l.mid(pos + 1, close - pos - 1);
+            int32_t time = 0;
+            if (parse_time(tag, time))
+                times.push_back(time);
+            else if (tag.startsWith(QLatin1String("offset:")))
+                offset = tag.mid(7).trimmed().toInt();
+            pos = close + 1;
+        }
+
+        if (times.empty())
+            continue;
+
+        /* Enhanced LRC has timestamps for every word, which are dropped */
+        QString line;
+        auto rest = l.mid(pos);
+        for (int i = 0; i < rest.length(); i++) {
+            int32_t word_time = 0;
+            auto close = rest[i] == '<' ? rest.indexOf('>', i) : -1;
+            if (close > 0 && parse_time(rest.mid(i + 1, close - i - 1), word_time)) {
+                i = close;
+                continue;
             }
+            line += rest[i];
         }
+        line = line.trimmed();
+
+        for (auto t : times)
+            add(t, line);
     }
-    return found;
+
+    /* A positive offset makes the lyrics show up earlier */
+    for (auto& l : m_lines)
+        l.time = std::max(l.time - offset, 0);
+    sort();
+    return !m_lines.empty();
 }
 
-bool find_embedded_lyrics(const QString& path)
+void synced::sort()
 {
-#ifdef _WIN32
-    // Windoze can't into utf8
-    const auto wstr = path.toStdWString();
-    const TagLib::FileRef fr(wstr.c_str(), false);
-#else
-    const TagLib::FileRef fr(qt_to_utf8(path), false);
-#endif
+    std::stable_sort(m_lines.begin(), m_lines.end(), [](line const& a, line const& b) {
+        return a.time < b.time;
+    });
+}
+
+int synced::index_at(int32_t ms) const
+{
+    auto it = std::upper_bound(m_lines.begin(), m_lines.end(), ms, [](int32_t t, line const& l) {
+        return t < l.time;
+    });
+    return int(it - m_lines.begin()) - 1;
+}
+
+QString synced::text() const
+{
+    QStringList l;
+    for (auto const& line : m_lines)
+        l.append(line.text);
+    return l.join('\n');
+}
 
-    if (fr.isNull())
+bool download_missing_lyrics(const song&)
+{
+    /* TODO */
+    return false;
+}
+
+/* Writes the plain text for the lyrics file and keeps the
+ * timestamps around if there are any */
+static bool use_lyrics(QString const& text, std::shared_ptr<synced> timed = nullptr)
+{
+    if (!timed) {
+        timed = std::make_shared<synced>();
+        if (!timed->parse_lrc(text))
+            timed = nullptr;
+    }
+
+    set_current(timed);
+    return util::write_lyrics(timed ? timed->text() : text);
+}
+
+bool find_embedded_lyrics(const QString& path, uint32_t parts)
+{
+    auto t = tags::read(path, parts | tags::PART_LYRICS);
+    if (!t)
         return false;
+    if (t->synced_lyrics)
+        return use_lyrics({}, t->synced_lyrics);
+    if (!t->lyrics.isEmpty())
+        return use_lyrics(t->lyrics);
+    return false;
+}
 
-    return get_embedded(fr);
+bool find_local_lyrics(const QString& path)
+{
+    QFileInfo info(path);
+    QFile f(info.dir().filePath(info.completeBaseName() + ".lrc"));
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    return use_lyrics(QString::fromUtf8(f.readAll()));
 }
 
 }
@@ -18,12 +18,55 @@
 
 #pragma once
 #include <QString>
+#include <memory>
+#include <stdint.h>
+#include <vector>
 
 class song;
 
 namespace lyrics {
 
+/* A line of synced lyrics, time is in ms */
+struct line {
+    int32_t time;
+    QString text;
+};
+
+/* Lyrics with timestamps, sorted by time so that the current line can be
+ * looked up with a binary search */
+class synced {
+    std::vector<line> m_lines {};
+
+public:
+    /* Reads LRC lyrics, returns false if there aren't any timed lines */
+    bool parse_lrc(QString const& text);
+
+    void add(int32_t time, QString const& text) { m_lines.push_back({ time, text }); }
+    /* Has to be called once all lines were added */
+    void sort();
+
+    bool empty() const { return m_lines.empty(); }
+    int size() const { return int(m_lines.size()); }
+    line const& operator[](int i) const { return m_lines[size_t(i)]; }
+    std::vector<line> const& lines() const { return m_lines; }
+
+    /* Index of the line at the given position, -1 before the first line */
+    int index_at(int32_t ms) const;
+    /* Lyrics without timestamps */
+    QString text() const;
+};
+
+/* Synced lyrics of the current song, shared with the format specifiers
+ * and the web server. Null if there are none */
+extern void set_current(std::shared_ptr<const synced> lyrics);
+extern std::shared_ptr<const synced> current();
+/* Incremented whenever the current lyrics change */
+extern uint64_t version();
+
 extern bool download_missing_lyrics(song const&);
 
-extern bool find_embedded_lyrics(QString const&);
+extern bool find_embedded_lyrics(QString const&, uint32_t parts = 0);
+
+/* Looks for an .lrc file with the same name as the song file */
+extern bool find_local_lyrics(QString const&);
 }
@@ -0,0 +1,190 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "metrics.hpp"
+#include <QMap>
+#include <memory>
+#include <locale>
+#include <mutex>
+#include <sstream>
+#include <util/platform.h>
+
+namespace metrics {
+
+struct family {
+    std::string help;
+    bool is_histogram;
+    /* Keyed by the formatted label, e.g. source="mpd" */
+    QMap<QString, std::shared_ptr<void>> metrics;
+};
+
+/* Only taken when a metric is registered or exported */
+static std::mutex registry_mutex;
+static QMap<QString, family> registry;
+
+void histogram::observe(uint64_t ns)
+{
+    const double ms = ns / 1000000.0;
+    size_t i = 0;
+    while (i < bucket_bounds.size() && ms > bucket_bounds[i])
+        i++;
+    m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    m_sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+
+    auto max = m_max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !m_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) { }
+}
+
+histogram::values histogram::read() const
+{
+    values v;
+    for (size_t i = 0; i < m_buckets.size(); i++)
+        v.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    v.sum_ns = m_sum_ns.load(std::memory_order_relaxed);
+    v.count = m_count.load(std::memory_order_relaxed);
+    v.max_ns = m_max_ns.load(std::memory_order_relaxed);
+    return v;
+}
+
+double histogram::values::quantile(double q) const
+{
+    uint64_t total = 0;
+    for (auto b : buckets)
+        total += b;
+    if (total == 0)
+        return 0;
+
+    const auto target = uint64_t(q * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_bounds.size(); i++) {
+        seen += buckets[i];
+        if (seen > target)
+            return bucket_bounds[i];
+    }
+    /* Above the last bound, the maximum is the best guess */
+    return max_ns / 1000000.0;
+}
+
+timer::timer(histogram* h)
+    : m_histogram(h)
+    , m_start(os_gettime_ns())
+{
+}
+
+timer::~timer()
+{
+    if (m_histogram)
+        m_histogram->observe(os_gettime_ns() - m_start);
+}
+
+static QString format_label(const char* label, QString const& value)
+{
+    if (!label)
+        return {};
+    auto escaped = value;
+    escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    return QString("%1=\"%2\"").arg(label, escaped);
+}
+
+template<class T>
+static T* get(const char* name, const char* help, bool is_histogram, const char* label, QString const& value)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto& f = registry[name];
+    if (f.help.empty()) {
+        f.help = help;
+        f.is_histogram = is_histogram;
+    }
+
+    auto& m = f.metrics[format_label(label, value)];
+    if (!m)
+        m = std::make_shared<T>();
+    return static_cast<T*>(m.get());
+}
+
+histogram* get_histogram(const char* name, const char* help, const char* label, QString const& value)
+{
+    return get<histogram>(name, help, true, label, value);
+}
+
+counter* get_counter(const char* name, const char* help, const char* label, QString const& value)
+{
+    return get<counter>(name, help, false, label, value);
+}
+
+std::string to_prometheus()
+{
+    std::ostringstream out;
+    out.imbue(std::locale::classic());
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto it = registry.cbegin(); it != registry.cend(); ++it) {
+        const auto name = it.key().toStdString();
+        auto const& f = it.value();
+        out << "# HELP " << name << " " << f.help << "\n";
+        out << "# TYPE " << name << (f.is_histogram ? " histogram\n" : " counter\n");
+
+        for (auto m = f.metrics.cbegin(); m != f.metrics.cend(); ++m) {
+            const auto label = m.key().toStdString();
+            if (!f.is_histogram) {
+                out << name << (label.empty() ? "" : "{" + label + "}") << " "
+                    << static_cast<counter*>(m.value().get())->value() << "\n";
+                continue;
+            }
+
+            const auto v = static_cast<histogram*>(m.value().get())->read();
+            const auto prefix = label.empty() ? std::string() : label + ",";
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < bucket_bounds.size(); i++) {
+                cumulative += v.buckets[i];
+                out << name << "_bucket{" << prefix << "le=\"" << bucket_bounds[i] / 1000.0 << "\"} " << cumulative << "\n";
+            }
+            cumulative += v.buckets.back();
+            out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << cumulative << "\n";
+
+            const auto braces = label.empty() ? std::string() : "{" + label + "}";
+            out << name << "_sum" << braces << " " << v.sum_ns / 1e9 << "\n";
+            out << name << "_count" << braces << " " << v.count << "\n";
+        }
+    }
+    return out.str();
+}
+
+std::vector<row> rows()
+{
+    std::vector<row> result;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto it = registry.cbegin(); it != registry.cend(); ++it) {
+        for (auto m = it.value().metrics.cbegin(); m != it.value().metrics.cend(); ++m) {
+            row r { it.key(), m.key(), it.value().is_histogram, 0, 0, 0, 0 };
+            if (r.is_histogram) {
+                const auto v = static_cast<histogram*>(m.value().get())->read();
+                r.count = v.count;
+                r.avg_ms = v.count ? v.sum_ns / 1e6 / v.count : 0;
+                r.p95_ms = v.quantile(0.95);
+                r.max_ms = v.max_ns / 1e6;
+            } else {
+                r.count = static_cast<counter*>(m.value().get())->value();
+            }
+            result.emplace_back(std::move(r));
+        }
+    }
+    return result;
+}
+}
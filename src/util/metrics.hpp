@@ -0,0 +1,92 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QString>
+#include <array>
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Always on counters and latency histograms for the stages of the pipeline.
+ * Metrics are registered once and never freed, so callers keep the pointer
+ * around and recording is a few relaxed atomic increments */
+namespace metrics {
+
+class counter {
+    std::atomic<uint64_t> m_value { 0 };
+
+public:
+    void add(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+};
+
+/* Upper bounds of the buckets in ms, the last bucket is everything above */
+constexpr std::array<double, 12> bucket_bounds = { 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 };
+
+class histogram {
+    std::array<std::atomic<uint64_t>, bucket_bounds.size() + 1> m_buckets {};
+    std::atomic<uint64_t> m_sum_ns { 0 };
+    std::atomic<uint64_t> m_count { 0 };
+    std::atomic<uint64_t> m_max_ns { 0 };
+
+public:
+    void observe(uint64_t ns);
+
+    struct values {
+        std::array<uint64_t, bucket_bounds.size() + 1> buckets {}; /* Not cumulative */
+        uint64_t sum_ns = 0, count = 0, max_ns = 0;
+
+        /* Upper bound of the bucket the quantile falls into, in ms */
+        double quantile(double q) const;
+    };
+    values read() const;
+};
+
+/* Measures the time until it goes out of scope */
+class timer {
+    histogram* m_histogram;
+    uint64_t m_start;
+
+public:
+    explicit timer(histogram* h);
+    ~timer();
+    timer(timer const&) = delete;
+    timer& operator=(timer const&) = delete;
+};
+
+/* name is the Prometheus metric name, label an optional single label,
+ * e.g. get_histogram("tuna_source_refresh_seconds", "...", "source", "mpd").
+ * Returns the same metric for the same name and label */
+extern histogram* get_histogram(const char* name, const char* help, const char* label = nullptr, QString const& value = {});
+extern counter* get_counter(const char* name, const char* help, const char* label = nullptr, QString const& value = {});
+
+/* All metrics in the Prometheus text format */
+extern std::string to_prometheus();
+
+/* Summary for the settings dialog */
+struct row {
+    QString name;
+    QString label;
+    bool is_histogram;
+    uint64_t count;
+    double avg_ms, p95_ms, max_ms;
+};
+extern std::vector<row> rows();
+}
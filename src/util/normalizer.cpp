@@ -0,0 +1,215 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "normalizer.hpp"
+#include "utility.hpp"
+#include <QJsonArray>
+#include <QJsonDocument>
+
+namespace normalize {
+
+/* that's every single format supported by vlc, i think */
+static const char* extensions[] = { ".aac", ".ac3", ".adts", ".aif", ".aifc", ".aiff", ".amr", ".amv",
+    ".aob", ".aqt", ".asf", ".ass", ".asx", ".au", ".avc", ".avchd",
+    ".avi", ".ax", ".b4s", ".bdmv", ".cda", ".cdg", ".clpi", ".cue",
+    ".dash", ".div", ".divx", ".dts", ".dv", ".dvdmedia", ".f4v", ".flac",
+    ".flh", ".flv", ".gsm", ".gvi", ".gvp", ".h264", ".hdmov", ".ifo",
+    ".iso", ".it", ".jss", ".kmv", ".lrv", ".m1v", ".m2a", ".m2p",
+    ".m2t", ".m2ts", ".m3u", ".m3u8", ".m4a", ".m4b", ".m4p", ".m4v",
+    ".mid", ".mka", ".mkv", ".mlp", ".mod", ".moi", ".moov", ".mov",
+    ".mp1", ".mp2", /* yeah, as if anybody still uses mp2 */
+    ".mp2v", ".mp3", ".mp4", ".mp4.infovid", ".mp4v", ".mpa", ".mpc", ".mpe",
+    ".mpeg", ".mpeg1", ".mpeg4", ".mpg", ".mpg2", ".mpls", ".mpsub", ".mpv",
+    ".mpv2", ".mts", ".mxf", ".nsv", ".nuv", ".oga", ".ogg", ".ogm",
+    ".ogv", ".ogx", ".oma", ".opus", ".pjs", ".pss", ".ra", ".ram",
+    ".rec", ".rm", ".rmi", ".rmvb", ".rt", ".s3m", ".s3z", ".smi",
+    ".snd", ".spx", ".srt", ".sub", ".svi", ".tod", ".trp", ".ts",
+    ".tta", ".usf", ".vlc", ".vlt", ".vob", ".voc", ".vp6", ".vqf",
+    ".vro", ".vse", ".w64", ".wav", ".webm", ".wma", ".wmv", ".wv",
+    ".xa", ".xm", ".xspf", ".xvid", ".3g2", ".3ga", ".3gp", ".3gp2",
+    ".3gpp", ".3p2", ".261", ".3gp_128x96", ".axa", ".axv", ".cache-2", ".cache-3",
+    ".eac3", ".flvat", ".h260", ".mbv", ".mks", ".ml20", ".mp3a", ".mp4a",
+    ".mpeg2", ".mpg4", ".mpgv", ".thd", ".vfo", ".xavc", ".xwm", ".zab" };
+
+/* Added in round and square brackets */
+static const char* title_clutter[] = { "official video", "official music video", "official audio",
+    "official lyric video", "official lyrics video", "official visualizer", "official hd video",
+    "official 4k video", "music video", "lyric video", "lyrics video", "lyrics", "audio", "video",
+    "visualizer", "hd", "hq", "4k" };
+
+static const char* artist_clutter[] = { "- topic", "vevo" };
+
+void suffix_trie::add(QString const& suffix)
+{
+    uint32_t n = 0;
+    for (auto it = suffix.crbegin(); it != suffix.crend(); ++it) {
+        const char16_t c = it->toLower().unicode();
+        auto next = m_nodes[n].next.find(c);
+        if (next == m_nodes[n].next.end()) {
+            m_nodes.emplace_back();
+            next = m_nodes[n].next.emplace(c, uint32_t(m_nodes.size() - 1)).first;
+        }
+        n = next->second;
+    }
+    m_nodes[n].terminal = true;
+}
+
+int suffix_trie::match(QString const& text, int end) const
+{
+    uint32_t n = 0;
+    int best = 0;
+    for (int i = end - 1; i > 0; i--) {
+        auto next = m_nodes[n].next.find(text[i].toLower().unicode());
+        if (next == m_nodes[n].next.end())
+            break;
+        n = next->second;
+        if (m_nodes[n].terminal)
+            best = end - i;
+    }
+    return best;
+}
+
+engine::engine(rules const& r)
+    : m_rules(r)
+{
+    if (m_rules.remove_extensions) {
+        for (auto const* ext : extensions)
+            m_title_suffixes.add(ext);
+    }
+
+    if (m_rules.remove_clutter) {
+        for (auto const* c : title_clutter) {
+            m_title_suffixes.add(QString("(%1)").arg(c));
+            m_title_suffixes.add(QString("[%1]").arg(c));
+        }
+        for (auto const* c : artist_clutter)
+            m_artist_suffixes.add(c);
+    }
+
+    /* "Title (feat. A & B)" anywhere or "Title feat. A, B" at the end */
+    if (m_rules.split_featured) {
+        m_featured.setPattern(R"(\s*[\(\[]\s*(?:feat\.?|ft\.|featuring)\s+([^\)\]]+)[\)\]]|\s+(?:feat\.|ft\.|featuring)\s+(.+)$)");
+        m_featured.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+        m_artist_separator.setPattern(R"(\s*[,&]\s*)");
+    }
+
+    /* User patterns are checked one by one, so a broken one doesn't
+     * disable the others */
+    /* They're compiled on their own instead of being joined into one
+     * alternation, which would renumber the groups of backreferences */
+    for (auto const& p : std::as_const(m_rules.user_patterns)) {
+        QRegularExpression e(p, QRegularExpression::CaseInsensitiveOption);
+        if (e.isValid()) {
+            e.optimize();
+            m_patterns.emplace_back(std::move(e));
+        } else {
+            bwarn("Ignoring invalid title rule '%s': %s", qt_to_utf8(p), qt_to_utf8(e.errorString()));
+        }
+    }
+    if (!m_featured.pattern().isEmpty())
+        m_featured.optimize();
+}
+
+QString engine::strip_suffixes(QString const& text, suffix_trie const& trie) const
+{
+    int end = text.length();
+    for (;;) {
+        while (end > 0 && text[end - 1].isSpace())
+            end--;
+        const int n = trie.match(text, end);
+        if (n == 0)
+            break;
+        end -= n;
+    }
+    return text.left(end).trimmed();
+}
+
+QString engine::title(QString const& title, QStringList* featured) const
+{
+    auto result = title;
+    for (auto const& p : m_patterns)
+        result.remove(p);
+    result = strip_suffixes(result, m_title_suffixes);
+
+    if (!m_featured.pattern().isEmpty()) {
+        auto match = m_featured.match(result);
+        if (match.hasMatch()) {
+            if (featured) {
+                auto names = match.captured(1).isEmpty() ? match.captured(2) : match.captured(1);
+                for (auto const& name : names.split(m_artist_separator, Qt::SkipEmptyParts))
+                    featured->append(name.trimmed());
+            }
+            result.remove(match.capturedStart(), match.capturedLength());
+            result = strip_suffixes(result, m_title_suffixes);
+        }
+    }
+    return result;
+}
+
+QString engine::artist(QString const& artist, QStringList* featured) const
+{
+    auto result = strip_suffixes(artist, m_artist_suffixes);
+    if (!m_featured.pattern().isEmpty()) {
+        auto match = m_featured.match(result);
+        if (match.hasMatch()) {
+            if (featured) {
+                auto names = match.captured(1).isEmpty() ? match.captured(2) : match.captured(1);
+                for (auto const& name : names.split(m_artist_separator, Qt::SkipEmptyParts))
+                    featured->append(name.trimmed());
+            }
+            result.remove(match.capturedStart(), match.capturedLength());
+            result = result.trimmed();
+        }
+    }
+    return result;
+}
+
+void engine::apply(QString& title, QStringList& artists) const
+{
+    QStringList featured;
+    title = this->title(title, &featured);
+
+    QStringList result;
+    for (auto const& a : std::as_const(artists)) {
+        auto normalized = artist(a, &featured);
+        if (!normalized.isEmpty())
+            result.append(normalized);
+    }
+    for (auto const& f : std::as_const(featured)) {
+        if (!f.isEmpty() && !result.contains(f, Qt::CaseInsensitive))
+            result.append(f);
+    }
+    artists = result;
+}
+
+QString rules_to_config(QStringList const& patterns)
+{
+    return QJsonDocument(QJsonArray::fromStringList(patterns)).toJson(QJsonDocument::Compact);
+}
+
+QStringList rules_from_config(QString const& value)
+{
+    QStringList result;
+    auto doc = QJsonDocument::fromJson(value.toUtf8());
+    for (auto const& v : doc.array()) {
+        if (v.isString() && !v.toString().isEmpty())
+            result.append(v.toString());
+    }
+    return result;
+}
+}
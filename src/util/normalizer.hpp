@@ -0,0 +1,78 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QRegularExpression>
+#include <QStringList>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace normalize {
+
+/* Finds the longest of a set of strings at the end of a text, case
+ * insensitive. The strings are stored reversed, so a lookup only walks
+ * back from the end of the text once, no matter how many there are */
+class suffix_trie {
+    struct node {
+        std::unordered_map<char16_t, uint32_t> next {};
+        bool terminal = false;
+    };
+    std::vector<node> m_nodes { node() };
+
+public:
+    void add(QString const& suffix);
+    /* Length of the longest match that ends at end and doesn't cover
+     * the whole text, zero if there's none */
+    int match(QString const& text, int end) const;
+};
+
+struct rules {
+    bool remove_extensions = true;
+    bool remove_clutter = false; /* (Official Video), [HD], Artist - Topic, ... */
+    bool split_featured = false; /* Title (feat. B) -> artists A, B */
+    QStringList user_patterns {}; /* Removed from the title */
+};
+
+/* All enabled rules compiled into one suffix trie for the title, one for the
+ * artists and a regular expression for each pattern. Built once per
+ * config change and used by the source workers whenever the song changes */
+class engine {
+    rules m_rules;
+    suffix_trie m_title_suffixes {}, m_artist_suffixes {};
+    std::vector<QRegularExpression> m_patterns {};
+    QRegularExpression m_featured {};
+    QRegularExpression m_artist_separator {};
+
+    QString strip_suffixes(QString const& text, suffix_trie const& trie) const;
+
+public:
+    explicit engine(rules const& r);
+
+    QString title(QString const& title, QStringList* featured = nullptr) const;
+    QString artist(QString const& artist, QStringList* featured = nullptr) const;
+
+    /* Normalizes both in place, featured artists found in the
+     * title are appended to the artists */
+    void apply(QString& title, QStringList& artists) const;
+};
+
+/* Converts the rules between the config file and the settings dialog */
+extern QString rules_to_config(QStringList const& patterns);
+extern QStringList rules_from_config(QString const& value);
+}
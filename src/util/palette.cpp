@@ -0,0 +1,137 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "palette.hpp"
+#include <QColor>
+#include <cmath>
+#include <vector>
+
+/* Every image is reduced to at most this many pixels per side */
+#define SAMPLE_SIZE 64
+
+/* Colors are sorted into 16 buckets per channel */
+#define BUCKET_BITS 4
+#define BUCKET_COUNT (1 << (BUCKET_BITS * 3))
+
+namespace palette {
+
+struct bucket {
+    uint32_t count = 0;
+    uint32_t r = 0, g = 0, b = 0;
+
+    QRgb average() const { return qRgb(int(r / count), int(g / count), int(b / count)); }
+};
+
+static double luminance(QRgb c)
+{
+    auto channel = [](int v) {
+        const double c = v / 255.0;
+        return c <= 0.03928 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+    };
+    return 0.2126 * channel(qRed(c)) + 0.7152 * channel(qGreen(c)) + 0.0722 * channel(qBlue(c));
+}
+
+static double contrast(QRgb a, QRgb b)
+{
+    const auto la = luminance(a), lb = luminance(b);
+    return (std::max(la, lb) + 0.05) / (std::min(la, lb) + 0.05);
+}
+
+colors extract(QImage const& image)
+{
+    colors result;
+    if (image.isNull())
+        return result;
+
+    auto sample = image;
+    if (sample.width() > SAMPLE_SIZE || sample.height() > SAMPLE_SIZE)
+        sample = sample.scaled(SAMPLE_SIZE, SAMPLE_SIZE, Qt::KeepAspectRatio, Qt::FastTransformation);
+    sample = sample.convertToFormat(QImage::Format_ARGB32);
+
+    std::vector<bucket> buckets(BUCKET_COUNT);
+    const int shift = 8 - BUCKET_BITS;
+    for (int y = 0; y < sample.height(); y++) {
+        const auto* line = reinterpret_cast<const QRgb*>(sample.constScanLine(y));
+        for (int x = 0; x < sample.width(); x++) {
+            const auto px = line[x];
+            /* Transparent parts of the cover aren't visible */
+            if (qAlpha(px) < 128)
+                continue;
+            const int r = qRed(px), g = qGreen(px), b = qBlue(px);
+            auto& bk = buckets[(r >> shift) << (BUCKET_BITS * 2) | (g >> shift) << BUCKET_BITS | b >> shift];
+            bk.count++;
+            bk.r += uint32_t(r);
+            bk.g += uint32_t(g);
+            bk.b += uint32_t(b);
+        }
+    }
+
+    const bucket *dominant = nullptr, *vibrant = nullptr, *muted = nullptr;
+    double vibrant_score = 0, muted_score = 0;
+    for (auto const& bk : buckets) {
+        if (bk.count == 0)
+            continue;
+        if (!dominant || bk.count > dominant->count)
+            dominant = &bk;
+
+        const QColor c(bk.average());
+        const double s = c.hslSaturationF(), l = c.lightnessF();
+
+        /* Vibrant: saturated and neither too dark nor too bright, muted: the opposite
+         * in saturation. Both are weighted by how much of the cover they cover */
+        if (s >= 0.35 && l >= 0.3 && l <= 0.8) {
+            const double score = bk.count * s * s;
+            if (score > vibrant_score) {
+                vibrant_score = score;
+                vibrant = &bk;
+            }
+        } else if (s < 0.35 && l >= 0.2 && l <= 0.8) {
+            const double score = bk.count * (1.0 - s);
+            if (score > muted_score) {
+                muted_score = score;
+                muted = &bk;
+            }
+        }
+    }
+
+    if (!dominant)
+        return result;
+
+    result.dominant = dominant->average();
+    result.vibrant = vibrant ? vibrant->average() : result.dominant;
+    result.muted = muted ? muted->average() : result.dominant;
+    result.text = contrast(result.dominant, qRgb(255, 255, 255)) >= contrast(result.dominant, qRgb(0, 0, 0))
+        ? qRgb(255, 255, 255)
+        : qRgb(0, 0, 0);
+    result.valid = true;
+    return result;
+}
+
+QString to_hex(QRgb color)
+{
+    return QColor(color).name(QColor::HexRgb);
+}
+
+void colors::to_json(QJsonObject& obj) const
+{
+    obj["dominant"] = to_hex(dominant);
+    obj["vibrant"] = to_hex(vibrant);
+    obj["muted"] = to_hex(muted);
+    obj["text"] = to_hex(text);
+}
+}
@@ -0,0 +1,42 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QImage>
+#include <QJsonObject>
+
+namespace palette {
+
+/* A few colors picked from the cover, so overlays don't have to
+ * analyze the cover themselves */
+struct colors {
+    QRgb dominant = 0xFF000000;
+    QRgb vibrant = 0xFF000000;
+    QRgb muted = 0xFF000000;
+    QRgb text = 0xFFFFFFFF; /* Black or white, whichever is readable on the dominant color */
+    bool valid = false;
+
+    void to_json(QJsonObject& obj) const;
+};
+
+/* Analyzes a downsampled copy of the image */
+extern colors extract(QImage const& image);
+
+/* #rrggbb */
+extern QString to_hex(QRgb color);
+}
@@ -0,0 +1,144 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "recorder.hpp"
+#include "../query/song.hpp"
+#include "utility.hpp"
+#include <QCborValue>
+#include <QDataStream>
+#include <QFile>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <util/platform.h>
+
+#define RECORDER_MAGIC "TUNAREC"
+#define RECORDER_VERSION 1
+
+namespace recorder {
+
+static std::mutex file_mutex;
+static std::atomic<bool> recording { false };
+static QFile file;
+static uint64_t started_at = 0;
+
+/* Pinned, so that recordings stay readable with newer Qt versions */
+static void setup_stream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream.setByteOrder(QDataStream::LittleEndian);
+}
+
+bool start(QString const& path)
+{
+    stop();
+    std::lock_guard<std::mutex> lock(file_mutex);
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        berr("Couldn't open recording %s", qt_to_utf8(path));
+        return false;
+    }
+
+    QDataStream stream(&file);
+    setup_stream(stream);
+    stream.writeRawData(RECORDER_MAGIC, int(strlen(RECORDER_MAGIC)));
+    stream << quint8(RECORDER_VERSION);
+    file.flush();
+
+    started_at = os_gettime_ns();
+    recording = true;
+    binfo("Recording songs to %s", qt_to_utf8(path));
+    return true;
+}
+
+void stop()
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (!recording)
+        return;
+    recording = false;
+    file.close();
+    binfo("Stopped recording songs");
+}
+
+bool active()
+{
+    return recording;
+}
+
+void record(const char* source, song const& s, uint64_t timestamp)
+{
+    if (!recording)
+        return;
+
+    /* Encoded before taking the lock, several workers might record at once */
+    const auto cbor = QCborValue::fromJsonValue(s.data()).toCbor();
+    const QByteArray id(source);
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (!recording)
+        return;
+    QDataStream stream(&file);
+    setup_stream(stream);
+    const auto ms = timestamp > started_at ? (timestamp - started_at) / 1000000 : 0;
+    stream << quint32(ms) << id << cbor;
+
+    /* Changes are rare, so every entry goes to disk right away and survives a crash */
+    if (stream.status() != QDataStream::Ok || !file.flush()) {
+        berr("Couldn't write to recording %s, stopping", qt_to_utf8(file.fileName()));
+        recording = false;
+        file.close();
+    }
+}
+
+bool read(QString const& path, std::vector<entry>& out)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        berr("Couldn't open recording %s", qt_to_utf8(path));
+        return false;
+    }
+
+    QDataStream stream(&f);
+    setup_stream(stream);
+    char magic[sizeof(RECORDER_MAGIC) - 1];
+    quint8 version = 0;
+    if (stream.readRawData(magic, int(sizeof(magic))) != int(sizeof(magic)) || memcmp(magic, RECORDER_MAGIC, sizeof(magic)) != 0) {
+        berr("%s is not a tuna recording", qt_to_utf8(path));
+        return false;
+    }
+    stream >> version;
+    if (version != RECORDER_VERSION) {
+        berr("Recording %s has unsupported version %i", qt_to_utf8(path), int(version));
+        return false;
+    }
+
+    out.clear();
+    while (!stream.atEnd()) {
+        quint32 time;
+        QByteArray id, cbor;
+        stream >> time >> id >> cbor;
+        if (stream.status() != QDataStream::Ok) {
+            bwarn("Recording %s ends with an incomplete entry", qt_to_utf8(path));
+            break;
+        }
+        out.push_back({ time, QString::fromUtf8(id), QCborValue::fromCbor(cbor).toJsonValue().toObject() });
+    }
+    return true;
+}
+}
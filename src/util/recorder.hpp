@@ -0,0 +1,56 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <QJsonObject>
+#include <QString>
+#include <stdint.h>
+#include <vector>
+
+class song;
+
+/* Records the songs reported by the sources, so that a session can be played
+ * back later with the replay source. Recordings are append-only files that
+ * start with a short header, followed by one entry per change:
+ *
+ *   quint32  ms since the recording started
+ *   bytes    source id (utf8)
+ *   bytes    meta data of the song (CBOR)
+ *
+ * all written with QDataStream, so byte arrays are length prefixed and an
+ * entry that was cut off by a crash is simply dropped when reading */
+namespace recorder {
+
+struct entry {
+    uint32_t time = 0;
+    QString source {};
+    QJsonObject data {};
+};
+
+/* Truncates the file and records from now on */
+extern bool start(QString const& path);
+extern void stop();
+extern bool active();
+
+/* Appends the song if a recording is running, timestamp is os_gettime_ns()
+ * at the time the source reported it */
+extern void record(const char* source, song const& s, uint64_t timestamp);
+
+/* Reads all complete entries of a recording */
+extern bool read(QString const& path, std::vector<entry>& out);
+}
@@ -0,0 +1,321 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+/* Parts of this file are taken from Rainmeter
+ *  https://github.com/rainmeter/rainmeter/blob/master/Library/NowPlaying/Cover.cpp
+ *  https://github.com/rainmeter/rainmeter/blob/39c2ed8bf0eefe411dbb8d94a8d82659dac341ab/Library/NowPlaying/Player.cpp
+ */
+
+#include "tag_reader.hpp"
+#include "utility.hpp"
+#include <mutex>
+#include <taglib/apefile.h>
+#include <taglib/apeitem.h>
+#include <taglib/apetag.h>
+#include <taglib/asffile.h>
+#include <taglib/attachedpictureframe.h>
+#include <taglib/fileref.h>
+#include <taglib/flacfile.h>
+#include <taglib/id3v2frame.h>
+#include <taglib/id3v2tag.h>
+#include <taglib/mp4file.h>
+#include <taglib/mpcfile.h>
+#include <taglib/mpegfile.h>
+#include <taglib/opusfile.h>
+#include <taglib/synchronizedlyricsframe.h>
+#include <taglib/tlist.h>
+#include <taglib/tmap.h>
+#include <taglib/tpropertymap.h>
+#include <taglib/unsynchronizedlyricsframe.h>
+#include <taglib/vorbisfile.h>
+#include <taglib/xiphcomment.h>
+
+namespace tags {
+
+static std::mutex cache_mutex;
+static std::shared_ptr<const file_tags> last;
+
+static inline QString qstr(TagLib::String const& s)
+{
+    return utf8_to_qt(s.toCString(true)).trimmed();
+}
+
+static inline QByteArray bytes(TagLib::ByteVector const& data)
+{
+    return QByteArray(data.data(), int(data.size()));
+}
+
+static inline void set_if_empty(QString& target, QString const& value)
+{
+    if (target.isEmpty())
+        target = value;
+}
+
+static void read_id3(TagLib::ID3v2::Tag* tag, file_tags& t, uint32_t parts)
+{
+    if (!tag)
+        return;
+    auto first_frame = [tag](const char* id) -> QString {
+        auto const& frames = tag->frameList(id);
+        return frames.isEmpty() ? QString() : qstr(frames.front()->toString());
+    };
+
+    if (parts & PART_COVER && t.cover.isEmpty()) {
+        auto const& frames = tag->frameList("APIC");
+        if (!frames.isEmpty())
+            t.cover = bytes(static_cast<TagLib::ID3v2::AttachedPictureFrame*>(frames.front())->picture());
+    }
+
+    if (parts & PART_LYRICS) {
+        for (auto* f : tag->frameList("SYLT")) {
+            auto* frame = dynamic_cast<TagLib::ID3v2::SynchronizedLyricsFrame*>(f);
+            if (!frame || frame->timestampFormat() != TagLib::ID3v2::SynchronizedLyricsFrame::AbsoluteMilliseconds)
+                continue;
+            auto synced = std::make_shared<lyrics::synced>();
+            for (auto const& line : frame->synchedText())
+                synced->add(int32_t(line.time), qstr(line.text));
+            synced->sort();
+            if (!synced->empty()) {
+                t.synced_lyrics = synced;
+                break;
+            }
+        }
+
+        auto const& uslt = tag->frameList("USLT");
+        if (!uslt.isEmpty() && t.lyrics.isEmpty()) {
+            if (auto* frame = dynamic_cast<TagLib::ID3v2::UnsynchronizedLyricsFrame*>(uslt.front()))
+                t.lyrics = qstr(frame->text());
+        }
+    }
+
+    if (parts & PART_META) {
+        set_if_empty(t.genre, qstr(tag->genre()));
+        set_if_empty(t.composer, first_frame("TCOM"));
+        set_if_empty(t.album_artist, first_frame("TPE2"));
+    }
+}
+
+static void read_ape(TagLib::APE::Tag* tag, file_tags& t, uint32_t parts)
+{
+    if (!tag)
+        return;
+    const TagLib::APE::ItemListMap& items = tag->itemListMap();
+    auto item = [&items](const char* key) -> QString {
+        return items.contains(key) ? qstr(items[key].toString()) : QString();
+    };
+
+    if (parts & PART_COVER && t.cover.isEmpty() && items.contains("COVER ART (FRONT)")) {
+        const TagLib::ByteVector nullStringTerminator(1, 0);
+        TagLib::ByteVector data = items["COVER ART (FRONT)"].value();
+        const int pos = data.find(nullStringTerminator); // Skip the filename.
+        if (pos != -1)
+            t.cover = bytes(data.mid(pos + 1));
+    }
+
+    if (parts & PART_LYRICS)
+        set_if_empty(t.lyrics, item("LYRICS"));
+
+    if (parts & PART_META) {
+        set_if_empty(t.genre, item("GENRE"));
+        set_if_empty(t.composer, item("COMPOSER"));
+        set_if_empty(t.album_artist, item("ALBUM ARTIST"));
+    }
+}
+
+/* Vorbis comments, used by FLAC, Opus and Vorbis */
+static void read_xiph(TagLib::Ogg::XiphComment* tag, file_tags& t, uint32_t parts)
+{
+    if (!tag)
+        return;
+    const auto& fields = tag->fieldListMap();
+    auto field = [&fields](const char* key) -> QString {
+        auto it = fields.find(key);
+        return it != fields.end() && !it->second.isEmpty() ? qstr(it->second.front()) : QString();
+    };
+
+    if (parts & PART_COVER && t.cover.isEmpty()) {
+        auto pictures = tag->pictureList();
+        if (!pictures.isEmpty()) {
+            /* I'll just assume that the last image is the one with the biggest size */
+            t.cover = bytes(pictures[pictures.size() - 1]->data());
+        }
+    }
+
+    if (parts & PART_LYRICS) {
+        set_if_empty(t.lyrics, field("LYRICS"));
+        set_if_empty(t.lyrics, field("UNSYNCEDLYRICS"));
+    }
+
+    if (parts & PART_META) {
+        set_if_empty(t.genre, field("GENRE"));
+        set_if_empty(t.composer, field("COMPOSER"));
+        set_if_empty(t.album_artist, field("ALBUMARTIST"));
+    }
+}
+
+static void read_mp4(TagLib::MP4::File* file, file_tags& t, uint32_t parts)
+{
+    TagLib::MP4::Tag* tag = file->tag();
+    if (!tag)
+        return;
+    const TagLib::MP4::ItemMap& items = tag->itemMap();
+    auto item = [&items](const char* key) -> QString {
+        if (!items.contains(key))
+            return {};
+        auto const& l = items[key].toStringList();
+        return l.isEmpty() ? QString() : qstr(l.front());
+    };
+
+    if (parts & PART_COVER && items.contains("covr")) {
+        const TagLib::MP4::CoverArtList& covers = items["covr"].toCoverArtList();
+        if (!covers.isEmpty())
+            t.cover = bytes(covers.front().data());
+    }
+
+    if (parts & PART_LYRICS)
+        t.lyrics = item("\251lyr");
+
+    if (parts & PART_META) {
+        t.genre = item("\251gen");
+        t.composer = item("\251wrt");
+        t.album_artist = item("aART");
+    }
+}
+
+static void read_asf(TagLib::ASF::File* file, file_tags& t, uint32_t parts)
+{
+    if (!file->tag())
+        return;
+    const TagLib::ASF::AttributeListMap& attributes = file->tag()->attributeListMap();
+    auto attribute = [&attributes](const char* key) -> QString {
+        if (!attributes.contains(key) || attributes[key].isEmpty())
+            return {};
+        return qstr(attributes[key][0].toString());
+    };
+
+    if (parts & PART_COVER && attributes.contains("WM/Picture")) {
+        const TagLib::ASF::AttributeList& pictures = attributes["WM/Picture"];
+        if (!pictures.isEmpty()) {
+            // Let's grab the first cover. TODO: Check/loop for correct type.
+            const TagLib::ASF::Picture& wmpic = pictures[0].toPicture();
+            if (wmpic.isValid())
+                t.cover = bytes(wmpic.picture());
+        }
+    }
+
+    if (parts & PART_LYRICS)
+        t.lyrics = attribute("WM/Lyrics");
+
+    if (parts & PART_META) {
+        t.genre = attribute("WM/Genre");
+        t.composer = attribute("WM/Composer");
+        t.album_artist = attribute("WM/AlbumArtist");
+    }
+}
+
+/* Formats that aren't handled above are searched the slow way */
+static void read_generic(TagLib::FileRef const& fr, file_tags& t, uint32_t parts)
+{
+    if (parts & PART_LYRICS) {
+        const TagLib::PropertyMap tags = fr.file()->properties();
+        for (auto i = tags.begin(); i != tags.end() && t.lyrics.isEmpty(); ++i) {
+            if (!i->second.isEmpty() && utf8_to_qt(i->first.toCString(true)).toLower().contains("lyrics"))
+                t.lyrics = qstr(i->second.front());
+        }
+    }
+
+    if (parts & PART_META && fr.tag())
+        t.genre = qstr(fr.tag()->genre());
+}
+
+static void read_file(TagLib::FileRef const& fr, file_tags& t, uint32_t parts)
+{
+    if (auto* mpeg = dynamic_cast<TagLib::MPEG::File*>(fr.file())) {
+        if (mpeg->hasID3v2Tag())
+            read_id3(mpeg->ID3v2Tag(), t, parts);
+        if (mpeg->hasAPETag())
+            read_ape(mpeg->APETag(), t, parts);
+    } else if (auto* flac = dynamic_cast<TagLib::FLAC::File*>(fr.file())) {
+        if (parts & PART_COVER) {
+            const TagLib::List<TagLib::FLAC::Picture*>& pictures = flac->pictureList();
+            if (!pictures.isEmpty()) // Just grab the first image.
+                t.cover = bytes(pictures[0]->data());
+        }
+        if (flac->hasXiphComment())
+            read_xiph(flac->xiphComment(), t, parts & ~PART_COVER);
+        if (flac->hasID3v2Tag())
+            read_id3(flac->ID3v2Tag(), t, parts);
+    } else if (auto* mp4 = dynamic_cast<TagLib::MP4::File*>(fr.file())) {
+        read_mp4(mp4, t, parts);
+    } else if (auto* asf = dynamic_cast<TagLib::ASF::File*>(fr.file())) {
+        read_asf(asf, t, parts);
+    } else if (auto* ape = dynamic_cast<TagLib::APE::File*>(fr.file())) {
+        read_ape(ape->APETag(), t, parts);
+    } else if (auto* mpc = dynamic_cast<TagLib::MPC::File*>(fr.file())) {
+        read_ape(mpc->APETag(), t, parts);
+    } else if (auto* opus = dynamic_cast<TagLib::Ogg::Opus::File*>(fr.file())) {
+        read_xiph(opus->tag(), t, parts);
+    } else if (auto* vorbis = dynamic_cast<TagLib::Ogg::Vorbis::File*>(fr.file())) {
+        read_xiph(vorbis->tag(), t, parts);
+    } else {
+        read_generic(fr, t, parts);
+    }
+}
+
+std::shared_ptr<const file_tags> cached(QString const& path)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (last && last->path == path)
+        return last;
+    return nullptr;
+}
+
+std::shared_ptr<const file_tags> read(QString const& path, uint32_t parts)
+{
+    if (path.isEmpty())
+        return nullptr;
+
+    auto prev = cached(path);
+    if (prev && (prev->parts & parts) == parts)
+        return prev;
+
+#ifdef _WIN32
+    // Windoze can't into utf8
+    const auto wstr = path.toStdWString();
+    const TagLib::FileRef fr(wstr.c_str(), false);
+#else
+    const TagLib::FileRef fr(qt_to_utf8(path), false);
+#endif
+    if (fr.isNull())
+        return nullptr;
+
+    /* Everything that was already read for this file is read again anyway,
+     * since the file had to be opened */
+    if (prev)
+        parts |= prev->parts;
+    auto result = std::make_shared<file_tags>();
+    result->path = path;
+    result->parts = parts;
+    read_file(fr, *result, parts);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    last = result;
+    return result;
+}
+}
@@ -0,0 +1,54 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#pragma once
+#include "lyrics_handler.hpp"
+#include <QByteArray>
+#include <QString>
+#include <memory>
+#include <stdint.h>
+
+namespace tags {
+
+/* Parts of the tags that should be read */
+enum part : uint32_t {
+    PART_COVER = 1 << 0,
+    PART_LYRICS = 1 << 1,
+    PART_META = 1 << 2,
+};
+
+struct file_tags {
+    QString path {};
+    uint32_t parts = 0; /* What was read */
+
+    QByteArray cover {};
+    QString lyrics {};
+    std::shared_ptr<lyrics::synced> synced_lyrics {};
+
+    QString genre {}, composer {}, album_artist {};
+};
+
+/* Reads the requested parts with a single open of the file, only the frames
+ * that are needed are looked at. The result of the last file is kept, so that
+ * the cover, lyrics and meta data of a song don't open it again */
+extern std::shared_ptr<const file_tags> read(QString const& path, uint32_t parts);
+
+/* The last result if it's for this file, doesn't touch the file itself */
+extern std::shared_ptr<const file_tags> cached(QString const& path);
+}
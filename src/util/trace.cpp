@@ -0,0 +1,178 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "trace.hpp"
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <locale>
+#include <memory>
+#include <sstream>
+#include <util/platform.h>
+#include <vector>
+
+/* Events per thread, about 256 KiB each */
+#define RING_SIZE 8192
+
+namespace trace {
+
+std::atomic<bool> enabled { false };
+
+/* Each slot is a tiny seqlock: odd while it's written, so the exporter
+ * can skip slots that are overwritten while it reads them */
+struct slot {
+    std::atomic<uint64_t> seq { 0 };
+    std::atomic<const char*> name { nullptr };
+    std::atomic<uint64_t> start { 0 }, end { 0 };
+};
+
+struct ring {
+    std::array<slot, RING_SIZE> slots;
+    std::atomic<uint64_t> head { 0 }; /* Only written by the owning thread */
+    uint32_t tid = 0;
+    std::mutex name_mutex;
+    std::string name;
+};
+
+static std::mutex rings_mutex;
+static std::vector<std::shared_ptr<ring>> rings;
+static std::atomic<uint32_t> next_tid { 1 };
+static std::atomic<uint64_t> cleared_at { 0 };
+
+static thread_local std::shared_ptr<ring> local;
+static thread_local std::string local_name;
+
+/* Rings are only created once a thread records something while enabled */
+static ring* local_ring()
+{
+    if (!local) {
+        local = std::make_shared<ring>();
+        local->tid = next_tid++;
+        local->name = local_name;
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(local);
+    }
+    return local.get();
+}
+
+void record(const char* name, uint64_t start_ns, uint64_t end_ns)
+{
+    if (!enabled.load(std::memory_order_relaxed))
+        return;
+
+    auto* r = local_ring();
+    const auto h = r->head.load(std::memory_order_relaxed);
+    auto& s = r->slots[h % RING_SIZE];
+    s.seq.store(h * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.name.store(name, std::memory_order_relaxed);
+    s.start.store(start_ns, std::memory_order_relaxed);
+    s.end.store(end_ns, std::memory_order_relaxed);
+    s.seq.store(h * 2 + 2, std::memory_order_release);
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+void set_thread_name(const char* name)
+{
+    local_name = name;
+    if (local) {
+        std::lock_guard<std::mutex> lock(local->name_mutex);
+        local->name = name;
+    }
+}
+
+void clear()
+{
+    cleared_at = os_gettime_ns();
+
+    /* Rings of threads that ended are only referenced here */
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.erase(std::remove_if(rings.begin(), rings.end(), [](auto const& r) { return r.use_count() == 1; }), rings.end());
+}
+
+static std::string escape(std::string const& str)
+{
+    std::string result;
+    for (auto c : str) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            result += c;
+    }
+    return result;
+}
+
+std::string to_json()
+{
+    std::ostringstream out;
+    out.imbue(std::locale::classic());
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    const auto since = cleared_at.load();
+    bool first = true;
+    auto separator = [&] {
+        if (!first)
+            out << ",";
+        first = false;
+    };
+
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (auto const& r : rings) {
+        {
+            std::lock_guard<std::mutex> name_lock(r->name_mutex);
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << r->tid
+                << ",\"args\":{\"name\":\"" << escape(r->name.empty() ? "thread " + std::to_string(r->tid) : r->name) << "\"}}";
+        }
+
+        const auto head = r->head.load(std::memory_order_acquire);
+        const auto count = std::min<uint64_t>(head, RING_SIZE);
+        for (uint64_t i = head - count; i < head; i++) {
+            auto const& s = r->slots[i % RING_SIZE];
+            const auto seq = s.seq.load(std::memory_order_acquire);
+            if (seq != i * 2 + 2)
+                continue;
+            const auto* name = s.name.load(std::memory_order_relaxed);
+            const auto start = s.start.load(std::memory_order_relaxed);
+            const auto end = s.end.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) != seq || !name || start < since)
+                continue;
+
+            separator();
+            out << "{\"name\":\"" << escape(name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << r->tid
+                << ",\"ts\":" << start / 1000.0 << ",\"dur\":" << (end - start) / 1000.0 << "}";
+        }
+    }
+    out << "]}";
+    return out.str();
+}
+
+scope::scope(const char* name)
+    : m_name(name)
+    , m_start(enabled.load(std::memory_order_relaxed) ? os_gettime_ns() : 0)
+{
+}
+
+scope::~scope()
+{
+    if (m_start)
+        record(m_name, m_start, os_gettime_ns());
+}
+}
@@ -0,0 +1,76 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+/* Opt-in timeline of what the tuna threads are doing, exported in the Chrome
+ * trace event format (chrome://tracing, ui.perfetto.dev). Every thread writes
+ * into its own ring buffer, so recording never waits for another thread, and
+ * the oldest events are overwritten once a ring is full */
+namespace trace {
+
+extern std::atomic<bool> enabled;
+
+/* Records a complete event. name has to be a string literal or otherwise
+ * outlive the trace */
+extern void record(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+/* Name shown for the calling thread */
+extern void set_thread_name(const char* name);
+
+/* Discards all events, e.g. right before recording something specific */
+extern void clear();
+
+/* {"traceEvents": [...]} with all events that are still in the rings */
+extern std::string to_json();
+
+class scope {
+    const char* m_name;
+    uint64_t m_start;
+
+public:
+    explicit scope(const char* name);
+    ~scope();
+    scope(scope const&) = delete;
+    scope& operator=(scope const&) = delete;
+};
+
+/* Locks the mutex, if it was already held the wait is recorded as an event called name */
+template<class M>
+std::unique_lock<M> lock(M& m, const char* name)
+{
+    std::unique_lock<M> l(m, std::try_to_lock);
+    if (!l.owns_lock()) {
+        if (enabled.load(std::memory_order_relaxed)) {
+            scope s(name);
+            l.lock();
+        } else {
+            l.lock();
+        }
+    }
+    return l;
+}
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace::scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
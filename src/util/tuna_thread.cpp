@@ -17,27 +17,47 @@
  *************************************************************************/
 
 #include "tuna_thread.hpp"
+#include "../gui/music_control.hpp"
 #include "../query/music_source.hpp"
+#include "../query/source_worker.hpp"
 #include "config.hpp"
+#include "history.hpp"
+#include "lyrics_handler.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include "utility.hpp"
 #include <algorithm>
+#include <condition_variable>
 #include <obs-module.h>
 #include <util/platform.h>
+#include <vector>
 
 namespace tuna_thread {
 std::atomic<bool> thread_flag { false };
 song copy;
+std::atomic<uint64_t> copy_version { 0 };
 std::mutex thread_mutex;
 std::mutex copy_mutex;
 std::thread thread_handle;
 
+/* What the dock and the play history look at */
+static const std::vector<meta::type> notify_fields = { meta::STATUS, meta::TITLE, meta::ARTIST, meta::ALBUM, meta::COVER };
+
+static std::mutex wake_mutex;
+static std::condition_variable wake_cv;
+static bool wake_flag = false;
+
 bool start()
 {
     if (thread_flag)
         return true;
     std::lock_guard<std::mutex> lock(thread_mutex);
+    thread_flag = true;
     thread_handle = std::thread(thread_method);
-    return thread_flag = thread_handle.native_handle();
+    thread_flag = thread_handle.native_handle();
+    if (music_dock)
+        music_dock->notify();
+    return thread_flag;
 }
 
 void stop()
@@ -46,68 +66,180 @@ void stop()
         return;
     bdebug("Stopping query thread...");
     thread_flag = false;
+    wake();
     thread_handle.join();
     bdebug("Query thread stopped.");
 
     bdebug("Resetting song information...");
-    /* Set status to nothing before stopping */
-    auto src = music_sources::selected_source();
-    src->reset_info();
-    util::handle_outputs(src->song_info());
+    /* Set status to nothing before stopping, the sources themselves
+     * are reset by their workers */
+    music_sources::set_active(nullptr);
+    copy_mutex.lock();
+    copy = song();
+    copy_version++;
+    copy_mutex.unlock();
+    util::handle_outputs(song());
+    if (music_dock)
+        music_dock->notify();
     bdebug("Song information reset.");
 }
 
+void wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake_flag = true;
+    }
+    wake_cv.notify_all();
+}
+
+/* Starts probing new candidates, stops the ones that were removed from
+ * the chain and orders the workers by their priority */
+static void sync_workers(std::vector<source_worker*>& workers)
+{
+    auto chain = music_sources::fallback_chain();
+
+    std::vector<source_worker*> synced;
+    for (auto const& src : std::as_const(chain)) {
+        if (auto* w = music_sources::worker(src.get())) {
+            w->set_probing(true);
+            synced.push_back(w);
+        }
+    }
+
+    for (auto* w : workers) {
+        if (std::find(synced.begin(), synced.end(), w) == synced.end())
+            w->set_probing(false);
+    }
+    workers = std::move(synced);
+}
+
+/* The first playing source of the chain wins, a higher priority source takes
+ * over immediately once it starts playing. To prevent flapping between sources
+ * (e.g. during the short pause between two songs) the shown source is only
+ * replaced by a lower priority one after it wasn't playing for the configured
+ * amount of time */
+static source_worker* pick_active(std::vector<source_worker*> const& workers,
+    std::vector<bool> const& playing, source_worker* current, uint64_t& idle_since, uint64_t now)
+{
+    if (workers.empty())
+        return nullptr;
+
+    int best = -1, current_index = -1;
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (best < 0 && playing[i])
+            best = int(i);
+        if (workers[i] == current)
+            current_index = int(i);
+    }
+
+    if (current_index < 0)
+        return workers[best >= 0 ? best : 0];
+
+    if (best >= 0 && best < current_index) {
+        idle_since = 0;
+        return workers[best];
+    }
+
+    if (playing[current_index]) {
+        idle_since = 0;
+        return current;
+    }
+
+    if (idle_since == 0)
+        idle_since = now;
+    if (now - idle_since < config::get()->fallback_hold)
+        return current;
+
+    idle_since = 0;
+    return workers[best >= 0 ? best : 0];
+}
+
 void thread_method()
 {
     util::set_thread_name("tuna-query");
+    std::vector<source_worker*> workers;
+    source_worker* active = nullptr;
+    uint64_t idle_since = 0;
+    auto* cycle_time = metrics::get_histogram("tuna_query_cycle_seconds", "Duration of query thread cycles, without waiting");
 
     while (thread_flag) {
-        const uint64_t start = os_gettime_ns() / 1000000;
-        {
-            auto ref = music_sources::selected_source();
-            if (ref) {
-                {
-                    // We don't want to hold the lock while waiting
-                    std::lock_guard<std::mutex> lock(thread_mutex);
-                    ref->refresh();
-                    ref->post_refresh();
-                }
-                auto s = ref->song_info();
-
-                /* Make a copy for the progress bar source, because it can't
-                 * wait for the other processes to finish, otherwise it'll block
-                 * the video thread
-                 */
-                copy_mutex.lock();
-                copy = s;
-                copy_mutex.unlock();
-
-                /* Process song data */
-                util::handle_outputs(s);
-                if (config::download_cover)
-                    ref->handle_cover();
-                if (config::download_lyrics)
-                    ref->handle_lyrics();
+        const uint64_t start_ns = os_gettime_ns();
+        const uint64_t start = start_ns / 1000000;
+        sync_workers(workers);
+        if (std::find(workers.begin(), workers.end(), active) == workers.end())
+            active = nullptr;
+
+        std::vector<song> results(workers.size());
+        std::vector<bool> playing(workers.size());
+        for (size_t i = 0; i < workers.size(); i++)
+            playing[i] = workers[i]->snapshot(results[i]) && results[i].get<int>(meta::STATUS) == state_playing;
+
+        auto* next = pick_active(workers, playing, active, idle_since, start);
+        bool changed = next != active;
+        if (changed) {
+            if (active)
+                active->set_active(false);
+            if (next) {
+                if (active)
+                    binfo("Switching to source %s", next->source()->id());
+                next->set_active(true);
             }
+            music_sources::set_active(next ? next->source() : nullptr);
+            active = next;
+            /* Ensure that cover is set to place holder on switch */
+            util::reset_cover();
+            lyrics::set_current(nullptr);
         }
 
-        /* Calculate how long refresh took and only wait the remaining time
-         * but we wait at least 10 ms otherwise we will immediately lock the mutex
-         * again which can stall other threads that are waiting to lock it
-         */
-        const uint64_t end = os_gettime_ns() / 1000000;
-        uint64_t delta = std::clamp<uint64_t>(end - start, 10ul, config::refresh_rate - 10);
-        int64_t wait = config::refresh_rate - delta;
-        const int64_t step = 50;
-
-        bdebug("Query thread sleeping for %ims", int(wait)); // macOS doesn't like %lu so we'll just cast to int, who cares
-
-        // We only wait int 50 ms steps so we can catch the thread stopping faster
-        while (wait > 0 && thread_flag) {
-            os_sleep_ms(step);
-            wait -= step;
+        if (active) {
+            song s;
+            for (size_t i = 0; i < workers.size(); i++) {
+                if (workers[i] == active)
+                    s = results[i];
+            }
+
+            /* Make a copy for the progress bar source, because it can't
+             * wait for the other processes to finish, otherwise it'll block
+             * the video thread
+             */
+            {
+                auto lock = trace::lock(copy_mutex, "wait copy_mutex");
+                if (copy.data() != s.data() || copy.clock().timestamp != s.clock().timestamp) {
+                    /* The data includes the progress, which changes on every refresh */
+                    changed |= !copy.same_fields(s, notify_fields);
+                    copy = s;
+                    copy_version++;
+                }
+            }
+
+            if (changed)
+                history::observe(s, active->source()->id());
+
+            /* Process song data */
+            TRACE_SCOPE("handle_outputs");
+            util::handle_outputs(s);
         }
+
+        if (changed && music_dock)
+            music_dock->notify();
+
+        /* Workers refresh on their own, so this only has to run once per
+         * refresh interval unless one of them reports a change earlier */
+        const uint64_t end_ns = os_gettime_ns();
+        const uint64_t end = end_ns / 1000000;
+        cycle_time->observe(end_ns - start_ns);
+        trace::record("query cycle", start_ns, end_ns);
+        const uint64_t refresh_rate = config::get()->refresh_rate;
+        const int64_t wait = int64_t(refresh_rate) - int64_t(std::min<uint64_t>(end - start, refresh_rate));
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.wait_for(lock, std::chrono::milliseconds(std::max<int64_t>(wait, 10)), [] { return wake_flag || !thread_flag; });
+        wake_flag = false;
     }
+
+    for (auto* w : workers)
+        w->set_probing(false);
     binfo("Query thread stopped.");
 }
 }
@@ -20,19 +20,27 @@
 
 #include "../query/song.hpp"
 #include <QString>
+#include <atomic>
 #include <mutex>
 #include <thread>
 
 namespace tuna_thread {
 extern std::atomic<bool> thread_flag;
+/* Guards the global config values, sources are synchronized by their workers */
 extern std::mutex thread_mutex;
 extern std::mutex copy_mutex;
 extern std::thread thread_handle;
 extern song copy;
+/* Incremented whenever copy changes, so that sources on the video
+ * thread only have to take the lock if there's something new */
+extern std::atomic<uint64_t> copy_version;
 
 bool start();
 
 void stop();
 
+/* Makes the query thread process results right away */
+void wake();
+
 void thread_method();
 } // namespace thread
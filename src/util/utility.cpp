@@ -17,20 +17,28 @@
  *************************************************************************/
 
 #include "utility.hpp"
-#include "../query/music_source.hpp"
 #include "config.hpp"
 #include "constants.hpp"
 #include "format.hpp"
+#include "lyrics_handler.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include <QGuiApplication>
 #include <QScreen>
 
+#include <QBuffer>
 #include <QDir>
 #include <QFile>
+#include <QHash>
+#include <QImageReader>
+#include <QImageWriter>
 #include <QJsonDocument>
 #include <QTextStream>
+#include <atomic>
 #include <ctime>
 #include <curl/curl.h>
 #include <obs-module.h>
+#include <mutex>
 #include <sstream>
 #include <stdio.h>
 #include <util/platform.h>
@@ -68,6 +76,16 @@ namespace util {
 
 bool have_vlc_source = false;
 
+static std::mutex cover_mutex;
+static std::shared_ptr<const cover_image> cover;
+static std::atomic<uint64_t> cover_data_version { 0 };
+/* Incremented for every set_cover call, guarded by cover_mutex. A cover that
+ * finished normalizing after a newer call started is dropped */
+static uint64_t cover_request = 0;
+/* Only one thread writes the cover file, guards cover_file_version */
+static std::mutex cover_file_mutex;
+static uint64_t cover_file_version = 0;
+
 size_t write_data(void* ptr, size_t size, size_t nmemb, FILE* stream)
 {
     size_t written;
@@ -75,6 +93,25 @@ size_t write_data(void* ptr, size_t size, size_t nmemb, FILE* stream)
     return written;
 }
 
+CURLcode curl_perform(CURL* curl, const char* target)
+{
+    auto* latency = metrics::get_histogram("tuna_http_request_seconds", "Duration of HTTP requests", "target", target);
+    auto* errors = metrics::get_counter("tuna_http_errors_total", "HTTP requests that failed or returned an error status", "target", target);
+
+    CURLcode res;
+    {
+        metrics::timer t(latency);
+        res = curl_easy_perform(curl);
+    }
+
+    /* Write callbacks stop some transfers on purpose once they have what they need */
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if ((res != CURLE_OK && res != CURLE_WRITE_ERROR && res != CURLE_ABORTED_BY_CALLBACK) || status >= 400)
+        errors->add();
+    return res;
+}
+
 bool curl_download(const char* url, const char* path)
 {
     CURL* curl = curl_easy_init();
@@ -96,7 +133,7 @@ bool curl_download(const char* url, const char* path)
 #ifdef DEBUG
         curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
 #endif
-        CURLcode res = curl_easy_perform(curl);
+        CURLcode res = curl_perform(curl, "download");
 
         if (res != CURLE_OK) {
             berr("Couldn't fetch file from %s to %s, curl error: %s (%i)", url, path, curl_easy_strerror(res), res);
@@ -121,8 +158,9 @@ void download_lyrics(const song& song)
     auto l = song.get(meta::LYRICS);
     if (!l.isEmpty() && l != last_lyrics) {
         last_lyrics = l;
-        if (!curl_download(qt_to_utf8(l), qt_to_utf8(config::lyrics_path))) {
-            berr("Couldn't dowload lyrics from '%s' to '%s'", qt_to_utf8(l), qt_to_utf8(config::lyrics_path));
+        auto path = config::get()->lyrics_path;
+        if (!curl_download(qt_to_utf8(l), qt_to_utf8(path))) {
+            berr("Couldn't dowload lyrics from '%s' to '%s'", qt_to_utf8(l), qt_to_utf8(path));
         }
     }
 }
@@ -131,9 +169,6 @@ bool download_cover(const QString& url)
 {
     if (url == "n/a")
         return false;
-    bool result = false;
-    auto output_path = config::cover_path;
-    auto tmp = output_path + ".tmp";
 
     static const int prefix_length =
 #if _WIN32
@@ -145,46 +180,203 @@ bool download_cover(const QString& url)
         // Don't use curl for local files
         QString new_cover_path = QUrl::fromPercentEncoding(url.mid(prefix_length).toUtf8());
         QFile cover(new_cover_path);
-        if (cover.exists()) {
-            QFile current(output_path);
-            current.remove();
-            if (QFile::copy(new_cover_path, output_path))
-                return true;
-            berr("Couldn't copy cover file from '%s' to '%s'", qt_to_utf8(new_cover_path), qt_to_utf8(output_path));
-            return false;
-        }
+        if (cover.open(QIODevice::ReadOnly))
+            return set_cover(cover.readAll());
         berr("Cover file '%s' does not exist", qt_to_utf8(new_cover_path));
         return false;
     }
 
-    result = curl_download(qt_to_utf8(url), qt_to_utf8(tmp));
+    CURL* curl = curl_easy_init();
+    if (!curl)
+        return false;
 
-    /* Replace cover only after download is done */
-    QFile current(output_path);
-    current.remove();
+    std::string response {};
+    curl_easy_setopt(curl, CURLOPT_URL, qt_to_utf8(url));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+#ifdef DEBUG
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+#endif
+    CURLcode res = curl_perform(curl, "cover");
+    curl_easy_cleanup(curl);
 
-    if (result && !QFile::rename(tmp, output_path)) {
-        berr("Couldn't rename temporary cover file");
-        result = false;
+    if (res != CURLE_OK || response.empty()) {
+        berr("Couldn't fetch cover from %s, curl error: %s (%i)", qt_to_utf8(url), curl_easy_strerror(res), res);
+        return false;
     }
-    return result;
+    return set_cover(QByteArray(response.data(), int(response.size())));
 }
 
 void reset_cover()
 {
-    auto path = config::cover_path;
-    QFile current(path);
-    current.remove();
-    if (!QFile::copy(config::cover_placeholder, path))
-        berr("Couldn't move placeholder cover");
+    static QByteArray placeholder;
+    static QString placeholder_path;
+
+    auto path = config::get()->cover_placeholder;
+    if (path != placeholder_path || placeholder.isEmpty()) {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) {
+            berr("Couldn't move placeholder cover");
+            return;
+        }
+        placeholder = f.readAll();
+        placeholder_path = path;
+    }
+    set_cover(placeholder);
+}
+
+/* Decodes the cover once, scales it down to the configured size and picks its
+ * colors. JPEGs are already scaled while decoding, which is a lot faster for
+ * huge embedded covers */
+static std::shared_ptr<cover_image> normalize_cover(QByteArray const& data, int size)
+{
+    QBuffer buffer;
+    buffer.setData(data);
+    QImageReader reader(&buffer);
+    const auto original = reader.size();
+    if (size > 0 && original.isValid() && (original.width() > size || original.height() > size))
+        reader.setScaledSize(original.scaled(size, size, Qt::KeepAspectRatio));
+
+    auto result = std::make_shared<cover_image>();
+    if (!reader.read(&result->image)) {
+        berr("Couldn't decode cover: %s", qt_to_utf8(reader.errorString()));
+        return nullptr;
+    }
+
+    /* Not every image plugin supports scaled decoding */
+    if (size > 0 && (result->image.width() > size || result->image.height() > size))
+        result->image = result->image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    QBuffer png(&result->png);
+    png.open(QIODevice::WriteOnly);
+    if (!result->image.save(&png, "png")) {
+        berr("Couldn't encode cover");
+        return nullptr;
+    }
+
+    static const bool have_webp = QImageWriter::supportedImageFormats().contains("webp");
+    if (have_webp) {
+        QBuffer webp(&result->webp);
+        webp.open(QIODevice::WriteOnly);
+        if (!result->image.save(&webp, "webp", 90))
+            result->webp.clear();
+    }
+
+    result->palette = palette::extract(result->image);
+    return result;
+}
+
+bool set_cover(QByteArray const& data)
+{
+    if (data.isEmpty())
+        return false;
+
+    /* The largest size option means that covers aren't scaled */
+    const auto cfg = config::get();
+    const int size = cfg->cover_size >= COVER_SIZE_LARGEST ? 0 : cfg->cover_size;
+    static QByteArray last_data;
+    static int last_size = -1;
+    static QString written_path;
+    auto output_path = cfg->cover_path;
+    uint64_t request;
+    {
+        std::lock_guard<std::mutex> lock(cover_mutex);
+        request = ++cover_request;
+        if (data == last_data && size == last_size && output_path == written_path)
+            return true;
+    }
+
+    static auto* normalize_time = metrics::get_histogram("tuna_cover_normalize_seconds", "Duration of decoding, scaling and encoding covers");
+    std::shared_ptr<cover_image> normalized;
+    {
+        metrics::timer t(normalize_time);
+        normalized = normalize_cover(data, size);
+    }
+    if (!normalized)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(cover_mutex);
+        if (request != cover_request)
+            return false; /* A newer cover was set in the meantime */
+        last_data = data;
+        last_size = size;
+        written_path = output_path;
+        cover = normalized;
+        cover_data_version++;
+    }
+
+    /* Whoever gets here writes the newest cover, so the file can't end up
+     * with an older one if two calls finish at the same time */
+    std::lock_guard<std::mutex> file_lock(cover_file_mutex);
+    std::shared_ptr<const cover_image> current;
+    uint64_t version;
+    {
+        std::lock_guard<std::mutex> lock(cover_mutex);
+        current = cover;
+        version = cover_data_version;
+        output_path = written_path;
+    }
+    if (version == cover_file_version)
+        return true;
+
+    /* Replace cover only after writing is done */
+    auto tmp = output_path + ".tmp";
+    QFile f(tmp);
+    if (!f.open(QIODevice::WriteOnly) || f.write(current->png) != current->png.size()) {
+        berr("Couldn't write cover to %s", qt_to_utf8(tmp));
+        return false;
+    }
+    f.close();
+
+    QFile(output_path).remove();
+    if (!QFile::rename(tmp, output_path)) {
+        berr("Couldn't rename temporary cover file");
+        return false;
+    }
+    cover_file_version = version;
+    return true;
+}
+
+std::shared_ptr<const cover_image> get_cover(uint64_t* version)
+{
+    std::lock_guard<std::mutex> lock(cover_mutex);
+    if (version)
+        *version = cover_data_version;
+    return cover;
+}
+
+uint64_t cover_version()
+{
+    return cover_data_version;
+}
+
+/* Output files that were written since OBS started, by path. Outputs are part
+ * of the immutable config, so the last written text is tracked here */
+static std::mutex output_mutex;
+static QHash<QString, QString> last_outputs;
+
+QString last_output(config::output const& o)
+{
+    std::lock_guard<std::mutex> lock(output_mutex);
+    return last_outputs.value(o.path, o.last_output);
 }
 
-void write_song(config::output& o, const QString& str)
+void write_song(config::output const& o, const QString& str)
 {
-    if (o.last_output == str)
-        return;
-    o.last_output = str;
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        auto it = last_outputs.find(o.path);
+        if (it == last_outputs.end())
+            it = last_outputs.insert(o.path, o.last_output);
+        if (*it == str)
+            return;
+        *it = str;
+    }
 
+    static auto* write_time = metrics::get_histogram("tuna_output_write_seconds", "Duration of writing output files");
+    static auto* write_errors = metrics::get_counter("tuna_output_errors_total", "Output files that couldn't be written");
+    metrics::timer t(write_time);
     QFile out(o.path);
     bool success = false;
     if (o.log_mode)
@@ -205,6 +397,7 @@ void write_song(config::output& o, const QString& str)
         stream.flush();
         out.close();
     } else {
+        write_errors->add();
         berr("Couldn't open song output file %s", qt_to_utf8(o.path));
     }
 }
@@ -212,14 +405,20 @@ void write_song(config::output& o, const QString& str)
 void handle_outputs(const song& s)
 {
     static QString tmp_text = "";
+    const auto cfg = config::get();
+
+    static auto* format_time = metrics::get_histogram("tuna_format_seconds", "Duration of evaluating output formats");
 
-    for (auto& o : config::outputs) {
+    for (auto const& o : cfg->outputs) {
         tmp_text.clear();
         tmp_text = o.format;
-        format::execute(tmp_text);
+        {
+            metrics::timer t(format_time);
+            format::execute(tmp_text, s);
+        }
 
         if (tmp_text.isEmpty() || s.get<int>(meta::STATUS) >= state_paused) {
-            tmp_text = config::placeholder;
+            tmp_text = cfg->placeholder;
             /* OBS seems to cut leading and trailing spaces
              * when loading the config file so this workaround
              * allows users to still use them */
@@ -258,7 +457,7 @@ size_t write_callback(char* ptr, size_t size, size_t nmemb, std::string* str)
     return new_length;
 }
 
-QJsonDocument curl_get_json(const char* url)
+QJsonDocument curl_get_json(const char* url, const char* target)
 {
     CURL* curl = curl_easy_init();
     if (curl) {
@@ -269,7 +468,7 @@ QJsonDocument curl_get_json(const char* url)
 #ifdef DEBUG
         curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
 #endif
-        CURLcode res = curl_easy_perform(curl);
+        CURLcode res = curl_perform(curl, target);
 
         if (res != CURLE_OK) {
             berr("Couldn't fetch json from %s curl error: %s (%i)", url, curl_easy_strerror(res), res);
@@ -290,43 +489,7 @@ QJsonDocument curl_get_json(const char* url)
 void set_thread_name(const char* name)
 {
     os_set_thread_name(name);
-}
-
-QString remove_extensions(QString const& str)
-{
-    QString result = str;
-    if (CGET_BOOL(CFG_REMOVE_EXTENSIONS)) {
-        /* that's every single format supported by vlc, i think */
-        auto exts = { ".aac", ".ac3", ".adts", ".aif", ".aifc", ".aiff", ".amr", ".amv",
-            ".aob", ".aqt", ".asf", ".ass", ".asx", ".au", ".avc", ".avchd",
-            ".avi", ".ax", ".b4s", ".bdmv", ".cda", ".cdg", ".clpi", ".cue",
-            ".dash", ".div", ".divx", ".dts", ".dv", ".dvdmedia", ".f4v", ".flac",
-            ".flh", ".flv", ".gsm", ".gvi", ".gvp", ".h264", ".hdmov", ".ifo",
-            ".iso", ".it", ".jss", ".kmv", ".lrv", ".m1v", ".m2a", ".m2p",
-            ".m2t", ".m2ts", ".m3u", ".m3u8", ".m4a", ".m4b", ".m4p", ".m4v",
-            ".mid", ".mka", ".mkv", ".mlp", ".mod", ".moi", ".moov", ".mov",
-            ".mp1", ".mp2", /* yeah, as if anybody still uses mp2 */
-            ".mp2v", ".mp3", ".mp4", ".mp4.infovid", ".mp4v", ".mpa", ".mpc", ".mpe",
-            ".mpeg", ".mpeg1", ".mpeg4", ".mpg", ".mpg2", ".mpls", ".mpsub", ".mpv",
-            ".mpv2", ".mts", ".mxf", ".nsv", ".nuv", ".oga", ".ogg", ".ogm",
-            ".ogv", ".ogx", ".oma", ".opus", ".pjs", ".pss", ".ra", ".ram",
-            ".rec", ".rm", ".rmi", ".rmvb", ".rt", ".s3m", ".s3z", ".smi",
-            ".snd", ".spx", ".srt", ".sub", ".svi", ".tod", ".trp", ".ts",
-            ".tta", ".usf", ".vlc", ".vlt", ".vob", ".voc", ".vp6", ".vqf",
-            ".vro", ".vse", ".w64", ".wav", ".webm", ".wma", ".wmv", ".wv",
-            ".xa", ".xm", ".xspf", ".xvid", ".3g2", ".3ga", ".3gp", ".3gp2",
-            ".3gpp", ".3p2", ".261", ".3gp_128x96", ".axa", ".axv", ".cache-2", ".cache-3",
-            ".eac3", ".flvat", ".h260", ".mbv", ".mks", ".ml20", ".mp3a", ".mp4a",
-            ".mpeg2", ".mpg4", ".mpgv", ".thd", ".vfo", ".xavc", ".xwm", ".zab" };
-
-        for (const auto& ext : exts) {
-            if (result.endsWith(ext, Qt::CaseInsensitive)) {
-                result.chop(strlen(ext));
-                break;
-            }
-        }
-    }
-    return result;
+    trace::set_thread_name(name);
 }
 
 QString get_config_file_path_legacy(const char* name)
@@ -411,7 +574,9 @@ void create_config_folder()
 
 void reset_lyrics()
 {
-    QFile out(config::lyrics_path);
+    lyrics::set_current(nullptr);
+    auto path = config::get()->lyrics_path;
+    QFile out(path);
     if (out.open(QIODevice::WriteOnly | QIODevice::Text)) {
         QTextStream stream(&out);
 #if QT_VERSION_MAJOR < 6
@@ -423,13 +588,14 @@ void reset_lyrics()
         stream.flush();
         out.close();
     } else {
-        berr("Failed to reset lyrics file at %s", qt_to_utf8(config::lyrics_path));
+        berr("Failed to reset lyrics file at %s", qt_to_utf8(path));
     }
 }
 
 bool write_lyrics(const QString& lyrics)
 {
-    QFile out(config::lyrics_path);
+    auto path = config::get()->lyrics_path;
+    QFile out(path);
     if (out.open(QIODevice::WriteOnly | QIODevice::Text)) {
         QTextStream stream(&out);
 #if QT_VERSION_MAJOR < 6
@@ -442,7 +608,7 @@ bool write_lyrics(const QString& lyrics)
         out.close();
         return true;
     }
-    berr("Failed to write lyrics file at %s", qt_to_utf8(config::lyrics_path));
+    berr("Failed to write lyrics file at %s", qt_to_utf8(path));
     return false;
 }
 
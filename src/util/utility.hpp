@@ -18,8 +18,13 @@
 
 #pragma once
 
+#include "palette.hpp"
+#include <QByteArray>
+#include <QImage>
 #include <QRect>
 #include <QString>
+#include <curl/curl.h>
+#include <memory>
 #include <obs-module.h>
 #include <stdint.h>
 
@@ -39,9 +44,15 @@
 
 #define SECOND_TO_NS 1000000000
 
+/* Cover size option that disables scaling */
+#define COVER_SIZE_LARGEST 8129
+
 #define UTIL_MAX(a, b) ((a) > (b) ? (a) : (b))
 
 class song;
+namespace config {
+struct output;
+}
 
 class QJsonDocument;
 
@@ -49,14 +60,37 @@ namespace util {
 
 extern bool have_vlc_source;
 
+/* curl_easy_perform, which also records the duration and
+ * errors for the metrics under the given target name */
+extern CURLcode curl_perform(CURL* curl, const char* target);
+
 extern bool curl_download(const char* url, const char* path);
 
-QJsonDocument curl_get_json(const char* url);
+QJsonDocument curl_get_json(const char* url, const char* target = "json");
 
 extern bool download_cover(const QString& url);
 
 extern void reset_cover();
 
+/* The current cover, scaled down to the cover size */
+struct cover_image {
+    QImage image;
+    QByteArray png;
+    QByteArray webp; /* Empty if Qt can't write WebP */
+    palette::colors palette;
+};
+
+/* Decodes, scales and encodes the cover once, then writes the cover file and
+ * keeps the result in memory for the cover sources and the web server.
+ * Unchanged covers are skipped */
+extern bool set_cover(QByteArray const& data);
+
+/* Null if there is no cover yet */
+extern std::shared_ptr<const cover_image> get_cover(uint64_t* version = nullptr);
+
+/* Incremented whenever the cover image changes */
+extern uint64_t cover_version();
+
 extern void reset_lyrics();
 
 extern bool write_lyrics(QString const& lyrics);
@@ -65,6 +99,9 @@ extern void download_lyrics(const song& song);
 
 extern void handle_outputs(const song& song);
 
+/* Text that was last written to the output */
+extern QString last_output(config::output const& o);
+
 extern int64_t epoch();
 
 extern bool window_pos_valid(QRect rect);
@@ -74,10 +111,10 @@ extern size_t write_callback(char* ptr, size_t size, size_t nmemb, std::string*
 /* Redirected from util/threading.h because it clashes with mongoose */
 extern void set_thread_name(const char* name);
 
-extern QString remove_extensions(QString const& str);
-
 extern QString file_from_path(QString const& file);
 
+/* Path of a file in the plugin config folder */
+extern QString get_config_file_path(QString const& name);
 extern bool open_config(const char* name, QJsonDocument&);
 extern bool save_config(const char* name, const QJsonDocument&);
 
@@ -19,12 +19,18 @@
 #include "web_server.hpp"
 #include "../plugin-macros.generated.h"
 #include "config.hpp"
+#include "history.hpp"
+#include "lyrics_handler.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include "tuna_thread.hpp"
 #include "utility.hpp"
 #include <QDateTime>
+#include <QJsonArray>
 #include <QFile>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <algorithm>
 #include <ctime>
 #include <httplib.h>
 #include <sstream>
@@ -41,6 +47,7 @@ httplib::Server* server {};
 //* GET requests will result in song information */
 static inline void handle_info_get(const httplib::Request&, httplib::Response& res)
 {
+    TRACE_SCOPE("http GET /");
     /* Write current song to json
      * and properly convert it to utf8
      */
@@ -48,9 +55,10 @@ static inline void handle_info_get(const httplib::Request&, httplib::Response& r
     QJsonDocument doc;
     QString json;
 
-    tuna_thread::copy_mutex.lock();
-    tuna_thread::copy.to_json(obj);
-    tuna_thread::copy_mutex.unlock();
+    {
+        auto lock = trace::lock(tuna_thread::copy_mutex, "wait copy_mutex");
+        tuna_thread::copy.to_json(obj);
+    }
 
     doc.setObject(obj);
     json = QString(doc.toJson(QJsonDocument::Indented));
@@ -71,9 +79,61 @@ static inline void handle_info_get(const httplib::Request&, httplib::Response& r
     res.status = 200;
 }
 
+//* Synced lyrics of the current song, so that widgets only need to fetch them once per song */
+static inline void handle_lyrics_get(const httplib::Request&, httplib::Response& res)
+{
+    TRACE_SCOPE("http GET /lyrics");
+    QJsonObject obj;
+    QJsonArray lines;
+    int32_t progress = 0;
+
+    {
+        auto lock = trace::lock(tuna_thread::copy_mutex, "wait copy_mutex");
+        progress = tuna_thread::copy.progress_now();
+    }
+
+    auto l = lyrics::current();
+    if (l) {
+        for (auto const& line : l->lines())
+            lines.append(QJsonObject { { "time", line.time }, { "text", line.text } });
+    }
+    obj["lines"] = lines;
+    obj["index"] = l ? l->index_at(progress) : -1;
+    obj["progress"] = progress;
+
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-store");
+    res.set_content(QJsonDocument(obj).toJson(QJsonDocument::Compact).toStdString(), "application/json; charset=utf-8");
+    res.status = 200;
+}
+
+//* Recently played songs, newest first, ?limit=n (20 by default) */
+static void handle_history_get(const httplib::Request& req, httplib::Response& res)
+{
+    TRACE_SCOPE("http GET /history");
+    int limit = 20;
+    if (req.has_param("limit"))
+        limit = std::max(0, atoi(req.get_param_value("limit").c_str()));
+
+    QJsonArray songs;
+    for (auto const& e : history::recent(size_t(limit))) {
+        QJsonObject obj;
+        history::to_json(e, obj);
+        songs.append(obj);
+    }
+
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Server", "tuna/" PLUGIN_VERSION);
+    res.set_header("Cache-Control", "no-store");
+    res.set_content(QJsonDocument(QJsonObject { { "history", songs } }).toJson(QJsonDocument::Compact).toStdString(), "application/json; charset=utf-8");
+    res.status = 200;
+}
+
 //* POST means we're getting information */
 static void handle_post(const httplib::Request& req, httplib::Response& res)
 {
+    TRACE_SCOPE("http POST /");
     /* Parse POST data JSON */
     auto str = utf8_to_qt(req.body.c_str());
     QJsonParseError err {};
@@ -131,9 +191,18 @@ bool start()
         res.set_content(date, "text/plain");
     });
     server->Get("/cover.png", [](const httplib::Request&, httplib::Response& res) {
-        QFile f(config::cover_path);
-        if (f.open(QIODevice::ReadOnly)) {
-            auto data = f.readAll();
+        TRACE_SCOPE("http GET /cover.png");
+        /* The cover is usually still in memory, the file is only read
+         * if nothing was set since OBS started */
+        QByteArray data;
+        if (auto cover = util::get_cover()) {
+            data = cover->png;
+        } else {
+            QFile f(config::get()->cover_path);
+            if (f.open(QIODevice::ReadOnly))
+                data = f.readAll();
+        }
+        if (!data.isEmpty()) {
             res.set_content(data, data.length(), "image/png");
             res.set_header("Access-Control-Allow-Origin", "*");
             res.set_header("Cache-Control", "no-cache");
@@ -145,6 +214,35 @@ bool start()
             res.status = 500;
         }
     });
+    server->Get("/cover.webp", [](const httplib::Request&, httplib::Response& res) {
+        TRACE_SCOPE("http GET /cover.webp");
+        auto cover = util::get_cover();
+        res.set_header("Server", "tuna/" PLUGIN_VERSION);
+        if (cover && !cover->webp.isEmpty()) {
+            res.set_content(cover->webp.constData(), size_t(cover->webp.size()), "image/webp");
+            res.set_header("Access-Control-Allow-Origin", "*");
+            res.set_header("Cache-Control", "no-cache");
+            res.status = 200;
+        } else {
+            res.set_content("404 Not Found: No WebP cover available", "text/plain");
+            res.status = 404;
+        }
+    });
+    server->Get("/lyrics", handle_lyrics_get);
+    server->Get("/history", handle_history_get);
+    server->Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(metrics::to_prometheus(), "text/plain; version=0.0.4");
+        res.set_header("Server", "tuna/" PLUGIN_VERSION);
+        res.status = 200;
+    });
+    /* Load into chrome://tracing or ui.perfetto.dev, empty unless recording was enabled */
+    server->Get("/trace", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(trace::to_json(), "application/json");
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_header("Cache-Control", "no-store");
+        res.set_header("Server", "tuna/" PLUGIN_VERSION);
+        res.status = 200;
+    });
     server->Get("/", handle_info_get);
     server->Post("/", handle_post);
 
@@ -168,8 +266,8 @@ void stop()
 void thread_method()
 {
     util::set_thread_name("tuna-webserver");
-    auto port = CGET_STR(CFG_SERVER_PORT);
-    binfo("Webserver listening on %s", port);
-    server->listen("0.0.0.0", atoi(port));
+    auto port = config::get()->webserver_port;
+    binfo("Webserver listening on %i", int(port));
+    server->listen("0.0.0.0", port);
 }
 }
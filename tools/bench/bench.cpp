@@ -0,0 +1,291 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+/* Benchmarks the OBS independent parts of tuna: formatting, songs, outputs,
+ * covers and the JSON served by the web server. Every benchmark reports the
+ * time and the number of heap allocations per operation, so that regressions
+ * show up before a release.
+ *
+ *   tuna-bench [--filter <substring>] [--iterations <n>]
+ */
+
+#include "../../src/query/song.hpp"
+#include "../../src/util/config.hpp"
+#include "../../src/util/format.hpp"
+#include "../../src/util/palette.hpp"
+#include "../../src/util/utility.hpp"
+#include "obs_shim.hpp"
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QImage>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+static std::atomic<uint64_t> allocations { 0 };
+
+#if defined(__GLIBC__)
+/* Counting malloc also catches Qt's containers, which don't use operator new */
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* result = __libc_memalign(alignment, size);
+    if (!result)
+        return ENOMEM;
+    *ptr = result;
+    return 0;
+}
+}
+#    define ALLOCATION_SOURCE "malloc"
+#else
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+#    define ALLOCATION_SOURCE "operator new"
+#endif
+
+struct options {
+    const char* filter = nullptr;
+    int iterations = 20000;
+};
+
+static options opt;
+static volatile size_t sink = 0; /* Keeps results from being optimized away */
+
+template<class F>
+static void run(const char* name, int iterations, F&& f)
+{
+    if (opt.filter && !strstr(name, opt.filter))
+        return;
+    /* Slow benchmarks run a fraction of the iterations, which can round down to zero */
+    iterations = std::max(1, iterations);
+
+    for (int i = 0; i < iterations / 10 + 1; i++)
+        f(i);
+
+    const auto allocs = allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        f(i);
+    const auto end = std::chrono::steady_clock::now();
+    const auto count = allocations.load() - allocs;
+
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    printf("%-32s %12.1f ns/op %10.2f allocs/op\n", name, ns, double(count) / iterations);
+    fflush(stdout);
+}
+
+static song make_song(int n)
+{
+    song s;
+    s.set(meta::TITLE, QString("Song number %1 (Remastered 2011)").arg(n));
+    s.set(meta::ARTIST, QStringList { "First artist", QString("Second artist %1").arg(n) });
+    s.set(meta::ALBUM, QString("An album"));
+    s.set(meta::RELEASE, QString("2011-02-03"));
+    s.set(meta::DURATION, 215000);
+    s.set(meta::PROGRESS, 42000 + n);
+    s.set(meta::TRACK_NUMBER, 3);
+    s.set(meta::DISC_NUMBER, 1);
+    s.set(meta::EXPLICIT, false);
+    s.set(meta::STATUS, state_playing);
+    s.update_release_precision();
+    return s;
+}
+
+static QByteArray make_cover(int size, QRgb color)
+{
+    QImage img(size, size, QImage::Format_RGB32);
+    img.fill(color);
+    for (int y = size / 4; y < size * 3 / 4; y++) {
+        for (int x = size / 4; x < size * 3 / 4; x++)
+            img.setPixel(x, y, qRgb(x % 256, y % 256, 128));
+    }
+
+    QByteArray data;
+    QBuffer buf(&data);
+    buf.open(QIODevice::WriteOnly);
+    img.save(&buf, "PNG");
+    return data;
+}
+
+static bool parse_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        auto arg = std::string(argv[i]);
+        if (arg == "--filter" && i + 1 < argc) {
+            opt.filter = argv[++i];
+            continue;
+        }
+        if (arg == "--iterations" && i + 1 < argc) {
+            opt.iterations = std::max(1, atoi(argv[++i]));
+            continue;
+        }
+        printf("usage: %s [--filter substring] [--iterations n]\n", argv[0]);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    if (!parse_args(argc, argv))
+        return 1;
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        printf("Couldn't create a temporary folder\n");
+        return 1;
+    }
+    obs_shim::set_config_dir(dir.path());
+    format::init();
+
+    config::snapshot cfg;
+    cfg.placeholder = "Nothing playing";
+    cfg.cover_path = dir.filePath("cover.png");
+    cfg.outputs.append({ "{title} - {artists}", dir.filePath("song.txt"), "", false });
+    cfg.outputs.append({ "{artists} - {title} ({duration})", dir.filePath("log.txt"), "", true });
+    config::publish(cfg);
+
+    const song a = make_song(1), b = make_song(2);
+    printf("Allocations are counted via %s, %i iterations\n", ALLOCATION_SOURCE, opt.iterations);
+
+    const format::compiled_format simple("{title} - {artists}");
+    const format::compiled_format complex("{TITLE:20} by {artists} from {album} ({release_year}) {progress}/{duration}");
+    run("format/simple", opt.iterations, [&](int) {
+        QString out;
+        simple.execute(out, a);
+        sink += size_t(out.size());
+    });
+    run("format/complex", opt.iterations, [&](int) {
+        QString out;
+        complex.execute(out, a);
+        sink += size_t(out.size());
+    });
+    run("format/uncompiled", opt.iterations, [&](int) {
+        QString out = "{title} - {artists}";
+        format::execute(out, a);
+        sink += size_t(out.size());
+    });
+
+    run("song/copy", opt.iterations, [&](int) {
+        song copy = a;
+        sink += size_t(copy.data().size());
+    });
+    run("song/compare", opt.iterations, [&](int) {
+        sink += a == b ? 1 : 0;
+    });
+    run("song/to_json", opt.iterations, [&](int) {
+        QJsonObject obj;
+        a.to_json(obj);
+        sink += size_t(obj.size());
+    });
+
+    /* Same as GET / on the web server */
+    run("web/info_json", opt.iterations, [&](int) {
+        QJsonObject obj;
+        a.to_json(obj);
+        auto json = QJsonDocument(obj).toJson(QJsonDocument::Indented);
+        sink += size_t(json.size());
+    });
+
+    /* Alternate between two songs, otherwise nothing would be written */
+    run("outputs/changed", opt.iterations / 10, [&](int i) {
+        util::handle_outputs(i % 2 ? a : b);
+    });
+    run("outputs/unchanged", opt.iterations, [&](int) {
+        util::handle_outputs(a);
+    });
+
+    const auto cover_a = make_cover(1024, qRgb(200, 40, 30)), cover_b = make_cover(1024, qRgb(30, 90, 200));
+    run("cover/set", opt.iterations / 100, [&](int i) {
+        sink += util::set_cover(i % 2 ? cover_a : cover_b) ? 1 : 0;
+    });
+    run("cover/set_unchanged", opt.iterations, [&](int) {
+        sink += util::set_cover(cover_a) ? 1 : 0;
+    });
+    if (auto cover = util::get_cover()) {
+        const auto img = cover->image;
+        run("cover/palette", opt.iterations / 10, [&](int) {
+            sink += palette::extract(img).dominant;
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+/* The few libobs and module functions the core library calls, so that it
+ * can run without OBS. Strings aren't translated, log messages go to stderr
+ * and the module config folder is the one set with set_config_dir()
+ */
+
+#include "obs_shim.hpp"
+#include <QDir>
+#include <QString>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <obs-module.h>
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+static QString config_dir = QDir::tempPath();
+static int min_log_level = LOG_WARNING;
+
+namespace obs_shim {
+void set_config_dir(QString const& dir)
+{
+    config_dir = dir;
+}
+
+void set_log_level(int level)
+{
+    min_log_level = level;
+}
+}
+
+extern "C" {
+
+void blog(int log_level, const char* format, ...)
+{
+    /* Lower values are more severe */
+    if (log_level > min_log_level)
+        return;
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void* bmalloc(size_t size)
+{
+    return malloc(size ? size : 1);
+}
+
+void bfree(void* ptr)
+{
+    free(ptr);
+}
+
+uint64_t os_gettime_ns(void)
+{
+    using namespace std::chrono;
+    return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+int os_mkdirs(const char* path)
+{
+    QDir dir(QString::fromUtf8(path));
+    if (dir.exists())
+        return MKDIR_EXISTS;
+    return dir.mkpath(".") ? MKDIR_SUCCESS : MKDIR_ERROR;
+}
+
+size_t os_utf8_to_wcs_ptr(const char* str, size_t len, wchar_t** pstr)
+{
+    auto wstr = QString::fromUtf8(str, int(len)).toStdWString();
+    *pstr = static_cast<wchar_t*>(bmalloc((wstr.size() + 1) * sizeof(wchar_t)));
+    memcpy(*pstr, wstr.c_str(), (wstr.size() + 1) * sizeof(wchar_t));
+    return wstr.size();
+}
+
+/* Only shows up in debuggers, nothing to do here */
+void os_set_thread_name(const char*) { }
+
+obs_module_t* obs_current_module(void)
+{
+    return nullptr;
+}
+
+const char* obs_module_text(const char* lookup_string)
+{
+    return lookup_string;
+}
+
+char* obs_module_get_config_path(obs_module_t*, const char* file)
+{
+    auto path = QDir(config_dir).filePath(QString::fromUtf8(file)).toUtf8();
+    auto* result = static_cast<char*>(bmalloc(size_t(path.size()) + 1));
+    memcpy(result, path.constData(), size_t(path.size()) + 1);
+    return result;
+}
+}
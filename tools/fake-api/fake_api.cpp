@@ -0,0 +1,533 @@
+/*************************************************************************
+ * This file is part of tuna
+ * git.vrsal.xyz/alex/tuna
+ * Copyright 2023 univrsal <uni@vrsal.xyz>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+/* Stand-ins for the remote APIs used by tuna, so that every HTTP path can be
+ * tested, timed and soak tested without the real services and their rate
+ * limits. Point the sources at it with these keys in the [tuna] section of
+ * the OBS global config:
+ *
+ *   spotify.token_url   http://localhost:<port>/api/token    POST token
+ *   spotify.api_url     http://localhost:<port>/v1           GET player, PUT play/pause, POST next/previous
+ *   lastfm.api_url      http://localhost:<port>/2.0/         GET user.getrecenttracks
+ *   itunes.search_url   http://localhost:<port>/search       GET search, covers are served under /artwork
+ *
+ * and use http://localhost:<port> as the IceCast server url (status-json.xsl).
+ *
+ * How each endpoint (token, player, lastfm, itunes, artwork, icecast or all)
+ * misbehaves is set with --set on start, or while running with
+ *
+ *   curl "http://localhost:<port>/fake/set?endpoint=player&latency=500&error=0.1"
+ *
+ * latency    ms before the response is sent
+ * jitter     up to this many ms are added to the latency at random
+ * error      share of requests that fail with 500 (0 to 1)
+ * limit      every n-th request is answered with 429 and Retry-After
+ * retry      seconds sent in Retry-After
+ * payload    bytes of padding added to json responses
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <httplib.h>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct behavior {
+    int latency_ms = 0;
+    int jitter_ms = 0;
+    double error_rate = 0;
+    int limit = 0;
+    int retry_after = 1;
+    int payload = 0;
+};
+
+struct options {
+    int port = 1609;
+    int expires_in = 60;    /* Lifetime of issued tokens in seconds */
+    bool rotate = false;    /* Hand out a new refresh token on every renewal */
+    int track_length = 30;  /* Seconds until the fake player moves on */
+    int mounts = 1;         /* IceCast mounts, a single one isn't sent as an array */
+};
+
+static const char* endpoint_names[] = { "token", "player", "lastfm", "itunes", "artwork", "icecast" };
+
+static options opt;
+static std::mutex behavior_mutex;
+static std::map<std::string, behavior> behaviors;
+static std::map<std::string, std::atomic<uint64_t>> request_counts;
+static const auto start_time = std::chrono::steady_clock::now();
+
+static double seconds_since_start()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+/* key=value[,key=value...] for one endpoint or all of them */
+static bool apply_behavior(std::string const& endpoint, std::string const& key, std::string const& value)
+{
+    std::lock_guard<std::mutex> lock(behavior_mutex);
+    for (auto const* name : endpoint_names) {
+        if (endpoint != "all" && endpoint != name)
+            continue;
+        auto& b = behaviors[name];
+        if (key == "latency")
+            b.latency_ms = atoi(value.c_str());
+        else if (key == "jitter")
+            b.jitter_ms = atoi(value.c_str());
+        else if (key == "error")
+            b.error_rate = atof(value.c_str());
+        else if (key == "limit")
+            b.limit = atoi(value.c_str());
+        else if (key == "retry")
+            b.retry_after = atoi(value.c_str());
+        else if (key == "payload")
+            b.payload = atoi(value.c_str());
+        else
+            return false;
+    }
+    return endpoint == "all" || behaviors.count(endpoint) > 0;
+}
+
+static bool parse_set(std::string const& arg)
+{
+    auto colon = arg.find(':');
+    if (colon == std::string::npos)
+        return false;
+    auto endpoint = arg.substr(0, colon);
+    size_t pos = colon + 1;
+    while (pos < arg.size()) {
+        auto end = arg.find(',', pos);
+        if (end == std::string::npos)
+            end = arg.size();
+        auto pair = arg.substr(pos, end - pos);
+        auto eq = pair.find('=');
+        if (eq == std::string::npos || !apply_behavior(endpoint, pair.substr(0, eq), pair.substr(eq + 1)))
+            return false;
+        pos = end + 1;
+    }
+    return true;
+}
+
+/* Returns true if the request was already answered with an error */
+static bool misbehave(const char* endpoint, httplib::Response& res)
+{
+    behavior b;
+    {
+        std::lock_guard<std::mutex> lock(behavior_mutex);
+        b = behaviors[endpoint];
+    }
+    const auto n = ++request_counts[endpoint];
+
+    thread_local std::mt19937 rng { std::random_device {}() };
+    auto delay = b.latency_ms;
+    if (b.jitter_ms > 0)
+        delay += std::uniform_int_distribution<int>(0, b.jitter_ms)(rng);
+    if (delay > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+    if (b.limit > 0 && n % uint64_t(b.limit) == 0) {
+        res.status = 429;
+        res.set_header("Retry-After", std::to_string(b.retry_after));
+        res.set_content("{\"error\": {\"status\": 429, \"message\": \"API rate limit exceeded\"}}", "application/json");
+        return true;
+    }
+    if (b.error_rate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < b.error_rate) {
+        res.status = 500;
+        res.set_content("{\"error\": {\"status\": 500, \"message\": \"Server error\"}}", "application/json");
+        return true;
+    }
+    return false;
+}
+
+static void send_json(const char* endpoint, httplib::Response& res, std::string json)
+{
+    int payload;
+    {
+        std::lock_guard<std::mutex> lock(behavior_mutex);
+        payload = behaviors[endpoint].payload;
+    }
+    if (payload > 0 && !json.empty() && json.back() == '}')
+        json.insert(json.size() - 1, ", \"padding\": \"" + std::string(size_t(payload), 'x') + "\"");
+    res.set_content(json, "application/json");
+}
+
+/* === Fake player, which all endpoints report on === */
+
+struct track {
+    int number;
+    std::string title, artist, album;
+    int duration_ms;
+};
+
+static std::mutex player_mutex;
+static int current_track = 0;
+static bool playing = true;
+static std::chrono::steady_clock::time_point track_started = std::chrono::steady_clock::now();
+static int paused_position = 0;
+
+static track make_track(int n)
+{
+    return { n, "Fake track " + std::to_string(n), "Fake artist " + std::to_string(n % 5),
+        "Fake album " + std::to_string(n / 3), opt.track_length * 1000 };
+}
+
+/* Current track and position, moves on to the next track when one is over */
+static track now_playing(int& position)
+{
+    std::lock_guard<std::mutex> lock(player_mutex);
+    const auto length = opt.track_length * 1000;
+    if (playing) {
+        auto elapsed = int(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - track_started).count());
+        if (elapsed >= length) {
+            current_track += elapsed / length;
+            track_started += std::chrono::milliseconds(elapsed / length * length);
+            elapsed %= length;
+        }
+        position = elapsed;
+    } else {
+        position = paused_position;
+    }
+    return make_track(current_track);
+}
+
+static void skip(int offset)
+{
+    std::lock_guard<std::mutex> lock(player_mutex);
+    current_track = std::max(0, current_track + offset);
+    track_started = std::chrono::steady_clock::now();
+    paused_position = 0;
+}
+
+static void set_playing(bool play)
+{
+    std::lock_guard<std::mutex> lock(player_mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (play && !playing)
+        track_started = now - std::chrono::milliseconds(paused_position);
+    else if (!play && playing)
+        paused_position = int(std::chrono::duration_cast<std::chrono::milliseconds>(now - track_started).count());
+    playing = play;
+}
+
+static std::string artwork_url(int number, int size)
+{
+    auto s = std::to_string(size);
+    return "http://localhost:" + std::to_string(opt.port) + "/artwork/" + std::to_string(number) + "/" + s + "x" + s + "bb.png";
+}
+
+/* === Covers, uncompressed pngs so that the size follows the requested resolution === */
+
+static uint32_t crc32(const std::string& data, size_t offset)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = offset; i < data.size(); i++) {
+        crc ^= uint8_t(data[i]);
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static void put_u32(std::string& out, uint32_t v)
+{
+    out += char(v >> 24);
+    out += char(v >> 16);
+    out += char(v >> 8);
+    out += char(v);
+}
+
+static void put_chunk(std::string& out, const char* type, std::string const& data)
+{
+    put_u32(out, uint32_t(data.size()));
+    const auto start = out.size();
+    out += type;
+    out += data;
+    put_u32(out, crc32(out, start));
+}
+
+static std::string make_png(int size, uint32_t rgb)
+{
+    std::string raw;
+    for (int y = 0; y < size; y++) {
+        raw += '\0'; /* No filter */
+        for (int x = 0; x < size; x++) {
+            const bool inner = x > size / 4 && x < size * 3 / 4 && y > size / 4 && y < size * 3 / 4;
+            const auto c = inner ? ~rgb : rgb;
+            raw += char(c >> 16);
+            raw += char(c >> 8);
+            raw += char(c);
+        }
+    }
+
+    /* zlib stream made of stored deflate blocks */
+    std::string z = "\x78\x01";
+    for (size_t pos = 0; pos < raw.size() || pos == 0; pos += 65535) {
+        const auto len = std::min<size_t>(65535, raw.size() - pos);
+        z += char(pos + len >= raw.size() ? 1 : 0);
+        z += char(len & 0xff);
+        z += char(len >> 8);
+        z += char(~len & 0xff);
+        z += char((~len >> 8) & 0xff);
+        z.append(raw, pos, len);
+    }
+    uint32_t a = 1, b = 0;
+    for (auto c : raw) {
+        a = (a + uint8_t(c)) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(z, (b << 16) | a);
+
+    std::string header;
+    put_u32(header, uint32_t(size));
+    put_u32(header, uint32_t(size));
+    header += std::string("\x08\x02\x00\x00\x00", 5); /* 8 bit rgb */
+
+    std::string png = "\x89PNG\r\n\x1a\n";
+    put_chunk(png, "IHDR", header);
+    put_chunk(png, "IDAT", z);
+    put_chunk(png, "IEND", "");
+    return png;
+}
+
+static bool parse_args(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        auto arg = std::string(argv[i]);
+        auto next = [&](int& v) {
+            if (i + 1 >= argc)
+                return false;
+            v = atoi(argv[++i]);
+            return true;
+        };
+
+        if (arg == "--port" && next(opt.port))
+            continue;
+        if (arg == "--expires" && next(opt.expires_in))
+            continue;
+        if (arg == "--track-length" && next(opt.track_length))
+            continue;
+        if (arg == "--mounts" && next(opt.mounts))
+            continue;
+        if (arg == "--rotate") {
+            opt.rotate = true;
+            continue;
+        }
+        if (arg == "--set" && i + 1 < argc && parse_set(argv[++i]))
+            continue;
+        printf("usage: %s [--port n] [--expires seconds] [--rotate] [--track-length seconds] [--mounts n]\n"
+               "       [--set endpoint:key=value[,key=value...]]...\n",
+            argv[0]);
+        return false;
+    }
+    opt.track_length = std::max(1, opt.track_length);
+    opt.mounts = std::max(1, opt.mounts);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    for (auto const* name : endpoint_names) {
+        behaviors[name] = {};
+        request_counts[name] = 0;
+    }
+    if (!parse_args(argc, argv))
+        return 1;
+
+    std::atomic<int> issued { 0 };
+    httplib::Server server;
+
+    server.set_logger([](const httplib::Request& req, const httplib::Response& res) {
+        printf("[%9.3f] %s %s -> %i (%i bytes)\n", seconds_since_start(), req.method.c_str(), req.path.c_str(), res.status, int(res.body.size()));
+        fflush(stdout);
+    });
+
+    server.Post("/api/token", [&](const httplib::Request& req, httplib::Response& res) {
+        if (misbehave("token", res))
+            return;
+
+        auto grant = req.get_param_value("grant_type");
+        if (req.get_header_value("Authorization").rfind("Basic ", 0) != 0) {
+            res.status = 400;
+            res.set_content("{\"error\": \"invalid_client\"}", "application/json");
+            return;
+        }
+
+        if (grant != "refresh_token" && grant != "authorization_code") {
+            res.status = 400;
+            res.set_content("{\"error\": \"unsupported_grant_type\"}", "application/json");
+            return;
+        }
+
+        auto n = ++issued;
+        std::string body = "{\"access_token\": \"fake-access-" + std::to_string(n) + "\", "
+                           "\"token_type\": \"Bearer\", "
+                           "\"scope\": \"user-read-playback-state\", "
+                           "\"expires_in\": " + std::to_string(opt.expires_in);
+        if (grant == "authorization_code" || opt.rotate)
+            body += ", \"refresh_token\": \"fake-refresh-" + std::to_string(n) + "\"";
+        body += "}";
+        send_json("token", res, body);
+    });
+
+    auto authorized = [](const httplib::Request& req, httplib::Response& res) {
+        if (req.get_header_value("Authorization").rfind("Bearer fake-access-", 0) == 0)
+            return true;
+        res.status = 401;
+        res.set_content("{\"error\": {\"status\": 401, \"message\": \"Invalid access token\"}}", "application/json");
+        return false;
+    };
+
+    server.Get("/v1/me/player", [&](const httplib::Request& req, httplib::Response& res) {
+        if (misbehave("player", res) || !authorized(req, res))
+            return;
+        int position;
+        auto t = now_playing(position);
+        bool is_playing;
+        {
+            std::lock_guard<std::mutex> lock(player_mutex);
+            is_playing = playing;
+        }
+        send_json("player", res,
+            "{\"device\": {\"id\": \"fake\", \"is_active\": true, \"is_private\": false, \"name\": \"tuna-fake-api\", \"volume_percent\": 50}, "
+            "\"progress_ms\": " + std::to_string(position) + ", "
+            "\"is_playing\": " + (is_playing ? "true" : "false") + ", "
+            "\"currently_playing_type\": \"track\", "
+            "\"item\": {\"name\": \"" + t.title + "\", \"duration_ms\": " + std::to_string(t.duration_ms) + ", "
+            "\"explicit\": false, \"disc_number\": 1, \"track_number\": " + std::to_string(t.number % 12 + 1) + ", "
+            "\"external_urls\": {\"spotify\": \"https://open.spotify.com/track/fake" + std::to_string(t.number) + "\"}, "
+            "\"artists\": [{\"name\": \"" + t.artist + "\"}], "
+            "\"album\": {\"name\": \"" + t.album + "\", \"release_date\": \"2011-02-03\", \"release_date_precision\": \"day\", "
+            "\"images\": [{\"url\": \"" + artwork_url(t.number, 640) + "\", \"width\": 640, \"height\": 640}]}}}");
+    });
+
+    auto command = [&](const char* path, std::function<void()> action) {
+        auto handler = [&authorized, action](const httplib::Request& req, httplib::Response& res) {
+            if (misbehave("player", res) || !authorized(req, res))
+                return;
+            action();
+            res.status = 204;
+        };
+        server.Put(path, handler);
+        server.Post(path, handler);
+    };
+    command("/v1/me/player/play", [] { set_playing(true); });
+    command("/v1/me/player/pause", [] { set_playing(false); });
+    command("/v1/me/player/next", [] { skip(1); });
+    command("/v1/me/player/previous", [] { skip(-1); });
+
+    server.Get("/2.0/", [](const httplib::Request& req, httplib::Response& res) {
+        if (misbehave("lastfm", res))
+            return;
+        if (req.get_param_value("api_key").empty()) {
+            res.status = 403;
+            res.set_content("{\"error\": 10, \"message\": \"Invalid API key\"}", "application/json");
+            return;
+        }
+        if (req.get_param_value("method") != "user.getrecenttracks") {
+            res.status = 400;
+            res.set_content("{\"error\": 3, \"message\": \"Invalid Method\"}", "application/json");
+            return;
+        }
+        int position;
+        auto t = now_playing(position);
+        send_json("lastfm", res,
+            "{\"recenttracks\": {\"track\": [{\"name\": \"" + t.title + "\", "
+            "\"artist\": {\"#text\": \"" + t.artist + "\"}, \"album\": {\"#text\": \"" + t.album + "\"}, "
+            "\"image\": [{\"size\": \"extralarge\", \"#text\": \"" + artwork_url(t.number, 300) + "\"}], "
+            "\"@attr\": {\"nowplaying\": \"true\"}}], "
+            "\"@attr\": {\"user\": \"" + req.get_param_value("user") + "\", \"page\": \"1\", \"total\": \"1\"}}}");
+    });
+
+    server.Get("/search", [](const httplib::Request& req, httplib::Response& res) {
+        if (misbehave("itunes", res))
+            return;
+        int position;
+        auto t = now_playing(position);
+        send_json("itunes", res,
+            "{\"resultCount\": 1, \"results\": [{\"wrapperType\": \"collection\", "
+            "\"collectionName\": \"" + t.album + "\", \"artistName\": \"" + t.artist + "\", "
+            "\"artworkUrl60\": \"" + artwork_url(t.number, 60) + "\", "
+            "\"artworkUrl100\": \"" + artwork_url(t.number, 100) + "\", "
+            "\"term\": \"" + std::to_string(req.get_param_value("term").size()) + " characters\"}]}");
+    });
+
+    server.Get(R"(/artwork/(\d+)/(\d+)x\d+bb\.png)", [](const httplib::Request& req, httplib::Response& res) {
+        if (misbehave("artwork", res))
+            return;
+        const auto number = atoi(req.matches[1].str().c_str());
+        const auto size = std::min(std::max(atoi(req.matches[2].str().c_str()), 1), 1024);
+        static const uint32_t colors[] = { 0xc0392b, 0x2980b9, 0x27ae60, 0x8e44ad, 0xf39c12 };
+        res.set_content(make_png(size, colors[number % 5]), "image/png");
+    });
+
+    server.Get("/status-json.xsl", [](const httplib::Request&, httplib::Response& res) {
+        if (misbehave("icecast", res))
+            return;
+        int position;
+        auto t = now_playing(position);
+        std::string sources;
+        for (int i = 0; i < opt.mounts; i++) {
+            if (i > 0)
+                sources += ", ";
+            sources += "{\"listenurl\": \"http://localhost:" + std::to_string(opt.port) + "/stream" + (i > 0 ? std::to_string(i) : "") + "\", "
+                "\"server_name\": \"tuna-fake-api\", \"server_type\": \"audio/mpeg\", "
+                "\"listeners\": " + std::to_string(10 + i) + ", "
+                "\"title\": \"" + t.artist + " - " + t.title + "\"}";
+        }
+        if (opt.mounts > 1)
+            sources = "[" + sources + "]";
+        send_json("icecast", res,
+            "{\"icestats\": {\"admin\": \"admin@localhost\", \"host\": \"localhost\", "
+            "\"server_id\": \"Icecast 2.4.4\", \"source\": " + sources + "}}");
+    });
+
+    server.Get("/fake/set", [](const httplib::Request& req, httplib::Response& res) {
+        auto endpoint = req.get_param_value("endpoint");
+        for (auto const& p : req.params) {
+            if (p.first != "endpoint" && !apply_behavior(endpoint.empty() ? "all" : endpoint, p.first, p.second)) {
+                res.status = 400;
+                res.set_content("Unknown endpoint or option " + p.first + "\n", "text/plain");
+                return;
+            }
+        }
+
+        std::string out;
+        std::lock_guard<std::mutex> lock(behavior_mutex);
+        for (auto const& b : behaviors) {
+            char line[256];
+            snprintf(line, sizeof(line), "%-8s latency=%i jitter=%i error=%.3f limit=%i retry=%i payload=%i requests=%llu\n",
+                b.first.c_str(), b.second.latency_ms, b.second.jitter_ms, b.second.error_rate, b.second.limit,
+                b.second.retry_after, b.second.payload, (unsigned long long)request_counts[b.first].load());
+            out += line;
+        }
+        res.set_content(out, "text/plain");
+    });
+
+    printf("Fake APIs listening on http://localhost:%i (token expires_in=%i, tracks of %is)\n",
+        opt.port, opt.expires_in, opt.track_length);
+    fflush(stdout);
+    return server.listen("0.0.0.0", opt.port) ? 0 : 1;
+}